@@ -63,6 +63,30 @@ BENCHMARK_DEFINE_F(BmPicoCoverTree, KnnCt)(benchmark::State& state) {
 
 BENCHMARK_REGISTER_F(BmPicoCoverTree, KnnCt)
     ->Unit(benchmark::kMillisecond)
-    ->Args({13, 1});
+    ->Args({13, 1})
+    ->Args({13, 8});
+
+// The SearchKnn method of the CoverTree visits nodes depth-first. This
+// benchmark visits them best-first for comparison.
+BENCHMARK_DEFINE_F(BmPicoCoverTree, KnnCtBestFirst)(benchmark::State& state) {
+  Scalar base = static_cast<Scalar>(state.range(0)) / Scalar(10.0);
+  int knn_count = state.range(1);
+
+  PicoCoverTree<PointX> tree(points_tree_, base);
+
+  for (auto _ : state) {
+    std::vector<pico_tree::Neighbor<Index, Scalar>> results;
+    std::size_t sum = 0;
+    for (auto const& p : points_test_) {
+      tree.SearchKnnBestFirst(p, knn_count, results);
+      benchmark::DoNotOptimize(sum += results.size());
+    }
+  }
+}
+
+BENCHMARK_REGISTER_F(BmPicoCoverTree, KnnCtBestFirst)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({13, 1})
+    ->Args({13, 8});
 
 BENCHMARK_MAIN();
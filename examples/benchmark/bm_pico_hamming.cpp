@@ -0,0 +1,108 @@
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <pico_toolshed/format/format_xvecs.hpp>
+#include <pico_tree/array_traits.hpp>
+#include <pico_tree/vector_traits.hpp>
+#include <pico_understory/brute_force.hpp>
+#include <pico_understory/cover_tree.hpp>
+
+// Benchmarks of the Hamming metric using 256-bit binary descriptors, such as
+// those of ORB or BRIEF. The descriptors are read from bvecs files in which
+// each vector has 32 bytes.
+class BmPicoHamming : public benchmark::Fixture {
+ protected:
+  using Index = int;
+  using Scalar = float;
+  using Descriptor = std::array<std::uint64_t, 4>;
+  using Space = std::reference_wrapper<std::vector<Descriptor>>;
+
+ public:
+  BmPicoHamming() {
+    ReadDescriptors("./descriptors_base.bvecs", points_tree_);
+    ReadDescriptors("./descriptors_query.bvecs", points_test_);
+  }
+
+ protected:
+  //! Reads the bytes of each descriptor and packs them into 64-bit words.
+  static void ReadDescriptors(
+      std::string const& filename, std::vector<Descriptor>& descriptors) {
+    std::vector<std::array<unsigned char, 32>> bytes;
+    pico_tree::ReadXvecs(filename, bytes);
+
+    descriptors.resize(bytes.size());
+    for (std::size_t i = 0; i < bytes.size(); ++i) {
+      std::memcpy(descriptors[i].data(), bytes[i].data(), bytes[i].size());
+    }
+  }
+
+  std::vector<Descriptor> points_tree_;
+  std::vector<Descriptor> points_test_;
+};
+
+// ****************************************************************************
+// Building the tree
+// ****************************************************************************
+
+BENCHMARK_DEFINE_F(BmPicoHamming, BuildCt)(benchmark::State& state) {
+  Scalar base = static_cast<Scalar>(state.range(0)) / Scalar(10.0);
+
+  for (auto _ : state) {
+    pico_tree::CoverTree<Space, pico_tree::Hamming> tree(points_tree_, base);
+  }
+}
+
+BENCHMARK_REGISTER_F(BmPicoHamming, BuildCt)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(13)
+    ->Arg(20);
+
+// ****************************************************************************
+// Knn
+// ****************************************************************************
+
+BENCHMARK_DEFINE_F(BmPicoHamming, KnnCt)(benchmark::State& state) {
+  Scalar base = static_cast<Scalar>(state.range(0)) / Scalar(10.0);
+  int knn_count = state.range(1);
+
+  pico_tree::CoverTree<Space, pico_tree::Hamming> tree(points_tree_, base);
+
+  for (auto _ : state) {
+    std::vector<pico_tree::Neighbor<Index, Scalar>> results;
+    std::size_t sum = 0;
+    for (auto const& p : points_test_) {
+      tree.SearchKnn(p, knn_count, results);
+      benchmark::DoNotOptimize(sum += results.size());
+    }
+  }
+}
+
+BENCHMARK_REGISTER_F(BmPicoHamming, KnnCt)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({13, 1})
+    ->Args({13, 8});
+
+// The baseline against which the CoverTree is compared.
+BENCHMARK_DEFINE_F(BmPicoHamming, KnnBf)(benchmark::State& state) {
+  int knn_count = state.range(0);
+
+  pico_tree::BruteForce<Space, pico_tree::Hamming> brute_force(points_tree_);
+
+  for (auto _ : state) {
+    std::vector<pico_tree::Neighbor<Index, Scalar>> results;
+    std::size_t sum = 0;
+    for (auto const& p : points_test_) {
+      brute_force.SearchKnn(p, knn_count, results);
+      benchmark::DoNotOptimize(sum += results.size());
+    }
+  }
+}
+
+BENCHMARK_REGISTER_F(BmPicoHamming, KnnBf)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(1)
+    ->Arg(8);
+
+BENCHMARK_MAIN();
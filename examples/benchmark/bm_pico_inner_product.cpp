@@ -0,0 +1,165 @@
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <pico_toolshed/format/format_mnist.hpp>
+#include <pico_toolshed/format/format_xvecs.hpp>
+#include <pico_tree/array_traits.hpp>
+#include <pico_tree/kd_tree.hpp>
+#include <pico_tree/vector_traits.hpp>
+#include <pico_understory/inner_product.hpp>
+#include <pico_understory/kd_forest.hpp>
+
+// Benchmarks of cosine similarity and maximum inner product searches. The
+// SIFT descriptors are read from fvecs files and the MNIST images from the
+// original idx files. The pixels of each image are converted to floats.
+
+namespace {
+
+template <typename Point_>
+using Space = std::reference_wrapper<std::vector<Point_>>;
+
+template <typename Point_>
+using CosineKdTree = pico_tree::CosineSearch<pico_tree::KdTree<
+    pico_tree::CosineSpaceType<Space<Point_>>,
+    pico_tree::L2Squared>>;
+
+template <typename Point_>
+using MipsKdTree = pico_tree::MipsSearch<pico_tree::KdTree<
+    pico_tree::MipsSpaceType<Space<Point_>>,
+    pico_tree::L2Squared>>;
+
+template <typename Point_>
+using MipsKdForest = pico_tree::MipsSearch<pico_tree::KdForest<
+    pico_tree::MipsSpaceType<Space<Point_>>,
+    pico_tree::L2Squared>>;
+
+template <typename Search_, typename Point_, typename... Args_>
+void KnnSearch(
+    benchmark::State& state,
+    std::vector<Point_> const& queries,
+    Search_ const& search,
+    pico_tree::Size k,
+    Args_... args) {
+  for (auto _ : state) {
+    std::vector<typename Search_::NeighborType> results;
+    std::size_t sum = 0;
+    for (auto const& q : queries) {
+      search.SearchKnn(q, k, args..., results);
+      benchmark::DoNotOptimize(sum += results.size());
+    }
+  }
+}
+
+}  // namespace
+
+class BmSift : public benchmark::Fixture {
+ protected:
+  using PointX = std::array<float, 128>;
+
+ public:
+  BmSift() {
+    pico_tree::ReadXvecs("./sift_base.fvecs", points_tree_);
+    pico_tree::ReadXvecs("./sift_query.fvecs", points_test_);
+  }
+
+ protected:
+  std::vector<PointX> points_tree_;
+  std::vector<PointX> points_test_;
+};
+
+class BmMnist : public benchmark::Fixture {
+ protected:
+  using PointX = std::array<float, 28 * 28>;
+
+ public:
+  BmMnist() {
+    ReadImages("./train-images.idx3-ubyte", points_tree_);
+    ReadImages("./t10k-images.idx3-ubyte", points_test_);
+  }
+
+ protected:
+  static void ReadImages(
+      std::string const& filename, std::vector<PointX>& points) {
+    std::vector<std::array<std::byte, 28 * 28>> images;
+    pico_tree::ReadMnistImages(filename, images);
+
+    points.resize(images.size());
+    for (std::size_t i = 0; i < images.size(); ++i) {
+      for (std::size_t j = 0; j < images[i].size(); ++j) {
+        points[i][j] = static_cast<float>(images[i][j]);
+      }
+    }
+  }
+
+  std::vector<PointX> points_tree_;
+  std::vector<PointX> points_test_;
+};
+
+// ****************************************************************************
+// Cosine similarity
+// ****************************************************************************
+
+BENCHMARK_DEFINE_F(BmSift, CosineKnnKdTree)(benchmark::State& state) {
+  CosineKdTree<PointX> search(points_tree_, state.range(0));
+  KnnSearch(state, points_test_, search, state.range(1));
+}
+
+BENCHMARK_REGISTER_F(BmSift, CosineKnnKdTree)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({16, 10});
+
+BENCHMARK_DEFINE_F(BmMnist, CosineKnnKdTree)(benchmark::State& state) {
+  CosineKdTree<PointX> search(points_tree_, state.range(0));
+  KnnSearch(state, points_test_, search, state.range(1));
+}
+
+BENCHMARK_REGISTER_F(BmMnist, CosineKnnKdTree)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({16, 10});
+
+// ****************************************************************************
+// Maximum inner product
+// ****************************************************************************
+
+BENCHMARK_DEFINE_F(BmSift, MipsKnnKdTree)(benchmark::State& state) {
+  MipsKdTree<PointX> search(points_tree_, state.range(0));
+  KnnSearch(state, points_test_, search, state.range(1));
+}
+
+BENCHMARK_REGISTER_F(BmSift, MipsKnnKdTree)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({16, 10});
+
+// Arguments: max leaf size, forest size, k and the maximum number of leaves
+// visited.
+BENCHMARK_DEFINE_F(BmSift, MipsKnnKdForest)(benchmark::State& state) {
+  MipsKdForest<PointX> search(points_tree_, state.range(0), state.range(1));
+  KnnSearch(
+      state,
+      points_test_,
+      search,
+      state.range(2),
+      static_cast<pico_tree::Size>(state.range(3)));
+}
+
+BENCHMARK_REGISTER_F(BmSift, MipsKnnKdForest)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({16, 8, 10, 64})
+    ->Args({16, 8, 10, 256});
+
+BENCHMARK_DEFINE_F(BmMnist, MipsKnnKdForest)(benchmark::State& state) {
+  MipsKdForest<PointX> search(points_tree_, state.range(0), state.range(1));
+  KnnSearch(
+      state,
+      points_test_,
+      search,
+      state.range(2),
+      static_cast<pico_tree::Size>(state.range(3)));
+}
+
+BENCHMARK_REGISTER_F(BmMnist, MipsKnnKdForest)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({16, 8, 10, 64})
+    ->Args({16, 8, 10, 256});
+
+BENCHMARK_MAIN();
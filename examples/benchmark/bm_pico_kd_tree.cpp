@@ -1,3 +1,5 @@
+#include <random>
+
 #include <pico_toolshed/dynamic_space.hpp>
 #include <pico_toolshed/point.hpp>
 #include <pico_tree/kd_tree.hpp>
@@ -98,7 +100,125 @@ BENCHMARK_REGISTER_F(BmPicoKdTree, KnnCtSldMid)
     ->Args({8, 12})
     ->Args({10, 12})
     ->Args({12, 12})
-    ->Args({14, 12});
+    ->Args({14, 12})
+    ->Args({8, 64})
+    ->Args({8, 128})
+    ->Args({8, 256})
+    ->Args({8, 512});
+
+// The run time dimension of the space is dispatched to a search with a compile
+// time dimension. Its timings should match those of KnnCtSldMid.
+BENCHMARK_DEFINE_F(BmPicoKdTree, KnnRtSldMid)(benchmark::State& state) {
+  int max_leaf_size = state.range(0);
+  int knn_count = state.range(1);
+
+  PicoKdTreeRtSldMid<PointX> tree(
+      PicoRtSpace<PointX>(points_tree_), max_leaf_size);
+
+  for (auto _ : state) {
+    std::vector<pico_tree::Neighbor<Index, Scalar>> results;
+    std::size_t sum = 0;
+    for (auto const& p : points_test_) {
+      tree.SearchKnn(p, knn_count, results);
+      benchmark::DoNotOptimize(sum += results.size());
+    }
+  }
+}
+
+BENCHMARK_REGISTER_F(BmPicoKdTree, KnnRtSldMid)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({8, 1})
+    ->Args({8, 4})
+    ->Args({8, 8})
+    ->Args({8, 12});
+
+// Each test point is the start of a sequence of queries that each lie within a
+// small distance of the previous one, as in tracking. The cold search starts
+// each query from scratch. The warm search starts from the neighbors of the
+// previous query.
+class BmPicoKdTreeSequence : public BmPicoKdTree {
+ protected:
+  void SetUp(benchmark::State const& state) override {
+    Scalar const step = static_cast<Scalar>(state.range(2)) / Scalar(100.0);
+    std::size_t const length = 8;
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<Scalar> jitter(-step, step);
+
+    sequences_.clear();
+    for (auto p : points_test_) {
+      for (std::size_t i = 0; i < length; ++i) {
+        for (std::size_t d = 0; d < p.size(); ++d) {
+          p[d] += jitter(gen);
+        }
+        sequences_.push_back(p);
+      }
+    }
+    length_ = length;
+  }
+
+  std::vector<PointX> sequences_;
+  std::size_t length_;
+};
+
+BENCHMARK_DEFINE_F(BmPicoKdTreeSequence, KnnColdCtSldMid)
+(benchmark::State& state) {
+  int max_leaf_size = state.range(0);
+  int knn_count = state.range(1);
+
+  PicoKdTreeCtSldMid<PointX> tree(points_tree_, max_leaf_size);
+
+  for (auto _ : state) {
+    std::vector<pico_tree::Neighbor<Index, Scalar>> results;
+    std::size_t sum = 0;
+    for (auto const& p : sequences_) {
+      tree.SearchKnn(p, knn_count, results);
+      benchmark::DoNotOptimize(sum += results.size());
+    }
+  }
+}
+
+BENCHMARK_DEFINE_F(BmPicoKdTreeSequence, KnnWarmCtSldMid)
+(benchmark::State& state) {
+  int max_leaf_size = state.range(0);
+  int knn_count = state.range(1);
+
+  PicoKdTreeCtSldMid<PointX> tree(points_tree_, max_leaf_size);
+
+  for (auto _ : state) {
+    std::vector<pico_tree::Neighbor<Index, Scalar>> results;
+    std::vector<Index> candidates;
+    std::size_t sum = 0;
+    for (std::size_t i = 0; i < sequences_.size(); ++i) {
+      if (i % length_ == 0) {
+        tree.SearchKnn(sequences_[i], knn_count, results);
+      } else {
+        candidates.resize(results.size());
+        for (std::size_t j = 0; j < results.size(); ++j) {
+          candidates[j] = results[j].index;
+        }
+        tree.SearchKnnWarm(sequences_[i], knn_count, candidates, results);
+      }
+      benchmark::DoNotOptimize(sum += results.size());
+    }
+  }
+}
+
+// Argument 1: Maximum leaf size.
+// Argument 2: Knn count.
+// Argument 3: Maximum step per coordinate between queries (divided by 100.0).
+BENCHMARK_REGISTER_F(BmPicoKdTreeSequence, KnnColdCtSldMid)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({8, 8, 5})
+    ->Args({8, 8, 50})
+    ->Args({8, 64, 5})
+    ->Args({8, 64, 50});
+
+BENCHMARK_REGISTER_F(BmPicoKdTreeSequence, KnnWarmCtSldMid)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({8, 8, 5})
+    ->Args({8, 8, 50})
+    ->Args({8, 64, 5})
+    ->Args({8, 64, 50});
 
 // ****************************************************************************
 // Radius
@@ -138,6 +258,30 @@ BENCHMARK_REGISTER_F(BmPicoKdTree, RadiusCtSldMid)
     ->Args({12, 30})
     ->Args({14, 30});
 
+// Stores the neighbors of all queries in a single array using two passes: one
+// that counts the neighbors of each query and one that stores them.
+BENCHMARK_DEFINE_F(BmPicoKdTree, RadiusCsrCtSldMid)(benchmark::State& state) {
+  int max_leaf_size = state.range(0);
+  Scalar radius = static_cast<Scalar>(state.range(1)) / Scalar(10.0);
+  Scalar squared = radius * radius;
+
+  PicoKdTreeCtSldMid<PointX> tree(points_tree_, max_leaf_size);
+
+  for (auto _ : state) {
+    std::vector<pico_tree::Size> offsets;
+    std::vector<pico_tree::Neighbor<Index, Scalar>> results;
+    tree.SearchRadiusCsr(points_test_, squared, offsets, results);
+    benchmark::DoNotOptimize(results.data());
+  }
+}
+
+// Argument 1: Maximum leaf size.
+// Argument 2: Search radius (divided by 10.0).
+BENCHMARK_REGISTER_F(BmPicoKdTree, RadiusCsrCtSldMid)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({8, 15})
+    ->Args({8, 30});
+
 // ****************************************************************************
 // Box
 // ****************************************************************************
@@ -0,0 +1,122 @@
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cmath>
+#include <pico_tree/array_traits.hpp>
+#include <pico_tree/kd_tree.hpp>
+#include <pico_tree/vector_traits.hpp>
+#include <pico_understory/brute_force.hpp>
+#include <random>
+
+// Benchmarks of nearest neighbor searches between rigid motions in 3D, as used
+// by sampling-based motion planners. Each pose is a translation followed by a
+// unit quaternion.
+class BmPicoPose : public benchmark::Fixture {
+ protected:
+  using Index = int;
+  using Scalar = float;
+  using Pose = std::array<Scalar, 7>;
+  using Space = std::reference_wrapper<std::vector<Pose>>;
+  using Metric = pico_tree::SE3Squared<Scalar>;
+
+ public:
+  BmPicoPose()
+      : points_tree_(GenerateRandomPoses(1000000)),
+        points_test_(GenerateRandomPoses(1000)) {}
+
+ protected:
+  //! Generates translations within [0, 10]^3 and uniformly distributed
+  //! rotations.
+  static std::vector<Pose> GenerateRandomPoses(std::size_t n) {
+    std::mt19937 e2(n);
+    std::uniform_real_distribution<Scalar> translation(0.0, 10.0);
+    std::normal_distribution<Scalar> rotation;
+
+    std::vector<Pose> poses(n);
+    for (auto& p : poses) {
+      Scalar norm = Scalar(0.0);
+      for (std::size_t i = 0; i < 3; ++i) {
+        p[i] = translation(e2);
+      }
+      for (std::size_t i = 3; i < 7; ++i) {
+        p[i] = rotation(e2);
+        norm += p[i] * p[i];
+      }
+      norm = std::sqrt(norm);
+      for (std::size_t i = 3; i < 7; ++i) {
+        p[i] /= norm;
+      }
+    }
+    return poses;
+  }
+
+  std::vector<Pose> points_tree_;
+  std::vector<Pose> points_test_;
+};
+
+// ****************************************************************************
+// Building the tree
+// ****************************************************************************
+
+BENCHMARK_DEFINE_F(BmPicoPose, BuildKdTree)(benchmark::State& state) {
+  int max_leaf_size = state.range(0);
+
+  for (auto _ : state) {
+    pico_tree::KdTree<Space, Metric> tree(points_tree_, max_leaf_size);
+  }
+}
+
+BENCHMARK_REGISTER_F(BmPicoPose, BuildKdTree)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(8)
+    ->Arg(16);
+
+// ****************************************************************************
+// Knn
+// ****************************************************************************
+
+BENCHMARK_DEFINE_F(BmPicoPose, KnnKdTree)(benchmark::State& state) {
+  int max_leaf_size = state.range(0);
+  int knn_count = state.range(1);
+
+  pico_tree::KdTree<Space, Metric> tree(points_tree_, max_leaf_size);
+
+  for (auto _ : state) {
+    std::vector<pico_tree::Neighbor<Index, Scalar>> results;
+    std::size_t sum = 0;
+    for (auto const& p : points_test_) {
+      tree.SearchKnn(p, knn_count, results);
+      benchmark::DoNotOptimize(sum += results.size());
+    }
+  }
+}
+
+BENCHMARK_REGISTER_F(BmPicoPose, KnnKdTree)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({8, 1})
+    ->Args({8, 16})
+    ->Args({16, 1})
+    ->Args({16, 16});
+
+// The baseline against which the KdTree is compared.
+BENCHMARK_DEFINE_F(BmPicoPose, KnnBf)(benchmark::State& state) {
+  int knn_count = state.range(0);
+
+  pico_tree::BruteForce<Space, Metric> brute_force(points_tree_);
+
+  for (auto _ : state) {
+    std::vector<pico_tree::Neighbor<Index, Scalar>> results;
+    std::size_t sum = 0;
+    for (auto const& p : points_test_) {
+      brute_force.SearchKnn(p, knn_count, results);
+      benchmark::DoNotOptimize(sum += results.size());
+    }
+  }
+}
+
+BENCHMARK_REGISTER_F(BmPicoPose, KnnBf)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(1)
+    ->Arg(16);
+
+BENCHMARK_MAIN();
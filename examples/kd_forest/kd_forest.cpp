@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <pico_toolshed/format/format_bin.hpp>
 #include <pico_toolshed/scoped_timer.hpp>
@@ -13,24 +14,31 @@
 // building a KdTree. However, the KdForest is usually a lot faster with queries
 // in high dimensions with the added trade-off that the exact nearest neighbor
 // may not be found.
+//
+// The quality of the KdForest is measured as the recall@k: the fraction of the
+// true k nearest neighbors, obtained using the KdTree, that are found by the
+// KdForest.
 template <typename Dataset>
 void RunDataset(
     std::size_t tree_max_leaf_size,
     std::size_t forest_size,
     std::size_t forest_max_leaf_size,
-    std::size_t forest_max_leaves_visited) {
+    std::size_t forest_max_leaves_visited,
+    std::size_t knn_count) {
   using Point = typename Dataset::PointType;
   using Space = std::reference_wrapper<std::vector<Point>>;
   using Scalar = typename Point::value_type;
+  using Neighbor = pico_tree::Neighbor<int, Scalar>;
 
   auto train = Dataset::ReadTrain();
   auto test = Dataset::ReadTest();
   std::size_t count = test.size();
-  std::vector<pico_tree::Neighbor<int, Scalar>> nns(count);
-  std::string fn_nns_gt = Dataset::kDatasetName + "_nns_gt.bin";
+  std::vector<Neighbor> knns_gt(count * knn_count);
+  std::string fn_knns_gt = Dataset::kDatasetName + "_knn" +
+                           std::to_string(knn_count) + "_gt.bin";
 
-  if (!std::filesystem::exists(fn_nns_gt)) {
-    std::cout << "Creating " << fn_nns_gt
+  if (!std::filesystem::exists(fn_knns_gt)) {
+    std::cout << "Creating " << fn_knns_gt
               << " using the KdTree. Be *very* patient." << std::endl;
 
     auto kd_tree = [&train, &tree_max_leaf_size]() {
@@ -40,19 +48,21 @@ void RunDataset(
 
     {
       ScopedTimer t1("kd_tree query");
-      for (std::size_t i = 0; i < nns.size(); ++i) {
-        kd_tree.SearchNn(test[i], nns[i]);
+      for (std::size_t i = 0; i < count; ++i) {
+        auto begin = knns_gt.begin() + i * knn_count;
+        kd_tree.SearchKnn(test[i], begin, begin + knn_count);
       }
     }
 
-    pico_tree::WriteBin(fn_nns_gt, nns);
+    pico_tree::WriteBin(fn_knns_gt, knns_gt);
   } else {
-    pico_tree::ReadBin(fn_nns_gt, nns);
-    std::cout << "KdTree not created. Read " << fn_nns_gt << " instead."
+    pico_tree::ReadBin(fn_knns_gt, knns_gt);
+    std::cout << "KdTree not created. Read " << fn_knns_gt << " instead."
               << std::endl;
   }
 
-  std::size_t equal = 0;
+  std::size_t equal_nn = 0;
+  std::size_t equal_knn = 0;
   {
     auto rkd_tree = [&train, &forest_max_leaf_size, &forest_size]() {
       ScopedTimer t0("kd_forest build");
@@ -60,33 +70,59 @@ void RunDataset(
           train, forest_max_leaf_size, forest_size);
     }();
 
-    ScopedTimer t1("kd_forest query");
-    pico_tree::Neighbor<int, Scalar> nn;
-    for (std::size_t i = 0; i < nns.size(); ++i) {
-      rkd_tree.SearchNn(test[i], forest_max_leaves_visited, nn);
+    std::vector<std::vector<Neighbor>> knns(count);
+    {
+      ScopedTimer t1("kd_forest query");
+      for (std::size_t i = 0; i < count; ++i) {
+        rkd_tree.SearchKnn(
+            test[i], knn_count, forest_max_leaves_visited, knns[i]);
+      }
+    }
+
+    for (std::size_t i = 0; i < count; ++i) {
+      auto begin = knns_gt.begin() + i * knn_count;
+      auto end = begin + knn_count;
 
-      if (nns[i].index == nn.index) {
-        ++equal;
+      if (!knns[i].empty() && knns[i][0].index == begin->index) {
+        ++equal_nn;
+      }
+
+      for (auto const& n : knns[i]) {
+        if (std::find_if(begin, end, [&n](Neighbor const& m) {
+              return m.index == n.index;
+            }) != end) {
+          ++equal_knn;
+        }
       }
     }
   }
 
-  std::cout << "Precision: "
-            << (static_cast<float>(equal) / static_cast<float>(count))
+  std::cout << "Recall@1: "
+            << (static_cast<float>(equal_nn) / static_cast<float>(count))
+            << std::endl;
+  std::cout << "Recall@" << knn_count << ": "
+            << (static_cast<float>(equal_knn) /
+                static_cast<float>(count * knn_count))
             << std::endl;
 }
 
 int main() {
+  // The value of forest_max_leaves_visited is the total number of leaves that
+  // may be visited by a query. It is shared by all the trees of the forest.
+  // The precisions below were measured when each tree still had its own budget
+  // of respectively 16 and 64 leaves. The values used below give a forest of
+  // size 8 the same total budget.
+  //
   // forest_max_leaf_size = 16
-  // forest_max_leaves_visited = 16
-  //    forest_size 8: a precision of around 0.915.
-  //    forest_size 16: a precision of around 0.976.
-  RunDataset<Mnist>(16, 8, 16, 16);
+  // forest_max_leaves_visited = 8 * 16
+  //    forest_size 8: a precision (recall@1) of around 0.915.
+  //    forest_size 16: a precision (recall@1) of around 0.976.
+  RunDataset<Mnist>(16, 8, 16, 8 * 16, 10);
   // forest_max_leaf_size = 32
-  // forest_max_leaves_visited = 64
-  //    forest_size 8: a precision of around 0.884.
-  //    forest_size 16: a precision of around 0.940.
+  // forest_max_leaves_visited = 8 * 64
+  //    forest_size 8: a precision (recall@1) of around 0.884.
+  //    forest_size 16: a precision (recall@1) of around 0.940.
   //    forest_size 128: out of memory :'(
-  RunDataset<Sift>(16, 8, 32, 64);
+  RunDataset<Sift>(16, 8, 32, 8 * 64, 10);
   return 0;
 }
@@ -35,6 +35,11 @@ class SearchNnCounter {
   // required. The nodes of the KdTree are filtered using this method.
   inline ScalarType const& max() const { return nn_.distance; }
 
+  // A visitor may also define the method "bool done() const". The search ends
+  // as soon as it returns true, which is checked after visiting each leaf. It
+  // can be used to stop after finding any point within a radius or when a
+  // time budget runs out.
+
   // The amount of points visited during a query.
   inline IndexType const& count() const { return count_; }
 
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <pico_tree/internal/point_wrapper.hpp>
+#include <pico_tree/internal/search_visitor.hpp>
+#include <pico_tree/internal/space_wrapper.hpp>
+
+#include "metric.hpp"
+
+namespace pico_tree {
+
+//! \brief The BruteForce search compares a query against each point of the
+//! space.
+//! \details It supports any metric and has no build cost. It is mostly useful
+//! as a baseline for the other search structures or when the metric doesn't
+//! allow any pruning, e.g., for high dimensional binary descriptors.
+template <typename Space_, typename Metric_ = L2, typename Index_ = int>
+class BruteForce {
+ private:
+  using Index = Index_;
+  using Space = Space_;
+  using SpaceWrapperType = internal::SpaceWrapper<Space>;
+  using Scalar = internal::MetricDistanceType<SpaceWrapperType, Metric_>;
+
+ public:
+  //! \brief Index type.
+  using IndexType = Index;
+  //! \brief Scalar type of the distances. It equals the return type of the
+  //! metric, which may differ from the coordinate type of the points.
+  using ScalarType = Scalar;
+  //! \brief Spatial dimension. It equals pico_tree::kDynamicSize in case Dim is
+  //! only known at run-time.
+  static constexpr int Dim = SpaceWrapperType::Dim;
+  //! \brief Point set or adaptor type.
+  using SpaceType = Space;
+  //! \brief The metric used for various searches.
+  using MetricType = Metric_;
+  //! \brief Neighbor type of various search resuls.
+  using NeighborType = Neighbor<Index, Scalar>;
+
+  //! \brief Creates a BruteForce search for \p space.
+  explicit BruteForce(Space space) : space_(std::move(space)), metric_() {}
+
+  //! \brief Returns the nearest neighbor (or neighbors) of point \p x depending
+  //! on their selection by visitor \p visitor .
+  template <typename P, typename V>
+  inline void SearchNearest(P const& x, V& visitor) const {
+    SpaceWrapperType space(space_);
+    internal::PointWrapper<P> p(x);
+
+    for (Size i = 0; i < space.size(); ++i) {
+      Scalar const d = metric_(p.begin(), p.end(), space[i]);
+      if (visitor.max() > d) {
+        visitor(static_cast<Index>(i), d);
+        if (internal::IsDone(visitor)) {
+          break;
+        }
+      }
+    }
+  }
+
+  //! \brief Searches for the nearest neighbor of point \p x.
+  template <typename P>
+  inline void SearchNn(P const& x, NeighborType& nn) const {
+    internal::SearchNn<NeighborType> v(nn);
+    SearchNearest(x, v);
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x and stores
+  //! the results in output vector \p knn.
+  template <typename P>
+  inline void SearchKnn(
+      P const& x, Size const k, std::vector<NeighborType>& knn) const {
+    knn.resize(std::min(k, SpaceWrapperType(space_).size()));
+    if (knn.empty()) {
+      return;
+    }
+    internal::SearchKnn<typename std::vector<NeighborType>::iterator> v(
+        knn.begin(), knn.end());
+    SearchNearest(x, v);
+  }
+
+  //! \brief Searches for all the neighbors of point \p x that are within radius
+  //! \p radius and stores the results in output vector \p n.
+  template <typename P>
+  inline void SearchRadius(
+      P const& x,
+      Scalar const radius,
+      std::vector<NeighborType>& n,
+      bool const sort = false) const {
+    internal::SearchRadius<NeighborType> v(radius, n);
+    SearchNearest(x, v);
+
+    if (sort) {
+      v.Sort();
+    }
+  }
+
+  //! \brief Point set used by the search.
+  inline Space const& points() const { return space_; }
+
+  //! \brief Metric used for search queries.
+  inline MetricType const& metric() const { return metric_; }
+
+ private:
+  //! Point set used for querying point data.
+  SpaceType space_;
+  //! Metric used for comparing distances.
+  MetricType metric_;
+};
+
+}  // namespace pico_tree
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <cassert>
+#include <memory>
+
 #include <pico_tree/internal/point_wrapper.hpp>
 #include <pico_tree/internal/search_visitor.hpp>
 #include <pico_tree/internal/space_wrapper.hpp>
+#include <pico_tree/internal/stream.hpp>
 
 // Use this define to enable a simplified version of the nearest ancestor tree
 // or disable it to use the regular one from "Faster Cover Trees".
@@ -28,6 +32,7 @@
 #include "internal/cover_tree_data.hpp"
 #include "internal/cover_tree_node.hpp"
 #include "internal/cover_tree_search.hpp"
+#include "internal/cover_tree_view.hpp"
 #include "metric.hpp"
 
 namespace pico_tree {
@@ -38,16 +43,23 @@ class CoverTree {
   using Index = Index_;
   using Space = Space_;
   using SpaceWrapperType = internal::SpaceWrapper<Space>;
-  using Scalar = typename SpaceWrapperType::ScalarType;
-  using Node = internal::CoverTreeNode<Index, Scalar>;
+  using Scalar = internal::MetricDistanceType<SpaceWrapperType, Metric_>;
   using BuildCoverTreeType =
       internal::BuildCoverTree<SpaceWrapperType, Metric_, Index_>;
   using CoverTreeDataType = typename BuildCoverTreeType::CoverTreeDataType;
+  using CoverTreeDynamicDataType =
+      internal::CoverTreeDynamicData<Index_, Scalar>;
+  using UpdateCoverTreeType =
+      internal::UpdateCoverTree<SpaceWrapperType, Metric_, Index_>;
+  using FlatViewType = internal::CoverTreeFlatView<CoverTreeDataType>;
+  using DynamicViewType = internal::
+      CoverTreeDynamicView<CoverTreeDynamicDataType, SpaceWrapperType>;
 
  public:
   //! \brief Index type.
   using IndexType = Index;
-  //! \brief Scalar type.
+  //! \brief Scalar type of the distances. It equals the return type of the
+  //! metric, which may differ from the coordinate type of the points.
   using ScalarType = Scalar;
   //! \brief CoverTree dimension. It equals pico_tree::kDynamicSize in case Dim
   //! is only known at run-time.
@@ -74,23 +86,106 @@ class CoverTree {
   CoverTree(CoverTree&&) = default;
 
   //! \brief Creates a CoverTree given \p points and a leveling \p base.
+  //! \details The build is deterministic. The structure of the tree only
+  //! depends on the order of the points.
   CoverTree(Space space, Scalar base)
       : space_(std::move(space)),
         metric_(),
         data_(BuildCoverTreeType()(SpaceWrapperType(space_), metric_, base)) {}
 
+  //! \brief Inserts the point with index \p idx into the tree.
+  //! \details The point should already be part of the point set, e.g., by
+  //! appending it to a vector that is referenced by a std::reference_wrapper,
+  //! and it should not yet be part of the tree.
+  //!
+  //! The first insertion or removal converts the tree into a layout that can
+  //! be modified, but that is slower to search. The maximum distance of each
+  //! node is updated incrementally and can become somewhat loose. Compact()
+  //! restores both the original layout and the maximum distances.
+  void Insert(Index const idx) {
+    SpaceWrapperType space(space_);
+    assert(static_cast<Size>(idx) < space.size());
+
+    CoverTreeDynamicDataType& dynamic = Dynamic();
+    dynamic.Resize(space.size());
+    auto const i = static_cast<std::size_t>(idx);
+    assert(!dynamic.contained[i]);
+
+    dynamic.root = UpdateCoverTreeType(space, metric_, data_.base)
+                       .Insert(dynamic.root, &dynamic.nodes[i]);
+    dynamic.contained[i] = true;
+    ++dynamic.size;
+  }
+
+  //! \brief Removes the point with index \p idx from the tree.
+  //! \details The point should be part of the tree. All descendants of its
+  //! node are inserted again.
+  //! \see Insert()
+  void Remove(Index const idx) {
+    CoverTreeDynamicDataType& dynamic = Dynamic();
+    auto const i = static_cast<std::size_t>(idx);
+    assert(i < dynamic.contained.size() && dynamic.contained[i]);
+
+    dynamic.root =
+        UpdateCoverTreeType(SpaceWrapperType(space_), metric_, data_.base)
+            .Remove(dynamic.root, &dynamic.nodes[i]);
+    dynamic.contained[i] = false;
+    --dynamic.size;
+  }
+
+  //! \brief Restores the cache friendly layout of the tree after inserting or
+  //! removing points.
+  //! \details The maximum distance of each node is recomputed such that
+  //! searches can skip as many nodes as possible.
+  void Compact() {
+    if (!dynamic_) {
+      return;
+    }
+
+    SpaceWrapperType space(space_);
+    if (dynamic_->root != nullptr) {
+      UpdateCoverTreeType(space, metric_, data_.base)
+          .UpdateMaxDistance(dynamic_->root);
+    }
+    data_ = internal::FlattenCoverTree<CoverTreeDataType>(
+        space, dynamic_->root, dynamic_->size, data_.base);
+    dynamic_.reset();
+  }
+
+  //! \brief Returns the nearest neighbor (or neighbors) of point \p x depending
+  //! on their selection by visitor \p visitor .
+  //! \details Nodes are visited depth-first. The scratch memory of the search
+  //! is reused by all queries of the current thread. A visitor should therefore
+  //! not start another search with a tree of the same type.
+  template <typename P, typename V>
+  inline void SearchNearest(P const& x, V& visitor) const {
+    Search<internal::SearchNearestMetric>(x, visitor);
+  }
+
+  //! \brief Returns the nearest neighbor (or neighbors) of point \p x depending
+  //! on their selection by visitor \p visitor .
+  //! \details Nodes are visited best-first using a priority queue. The scratch
+  //! memory of the search is reused by all queries of the current thread. A
+  //! visitor should therefore not start another search with a tree of the same
+  //! type.
+  //! \see internal::PrioritySearchNearestMetric
+  template <typename P, typename V>
+  inline void SearchNearestBestFirst(P const& x, V& visitor) const {
+    Search<internal::PrioritySearchNearestMetric>(x, visitor);
+  }
+
   //! \brief Searches for the nearest neighbor of point \p x.
   template <typename P>
   inline void SearchNn(P const& x, NeighborType& nn) const {
     internal::SearchNn<NeighborType> v(nn);
-    SearchNearest(data_.root_node, x, v);
+    SearchNearest(x, v);
   }
 
   //! \brief Searches for an approximate nearest neighbor of point \p x.
   template <typename P>
   inline void SearchNn(P const& x, ScalarType const e, NeighborType& nn) const {
     internal::SearchApproximateNn<NeighborType> v(e, nn);
-    SearchNearest(data_.root_node, x, v);
+    SearchNearest(x, v);
   }
 
   //! \brief Searches for the k nearest neighbors of point \p x, where k equals
@@ -106,7 +201,7 @@ class CoverTree {
         "ITERATOR_VALUE_TYPE_DOES_NOT_EQUAL_NEIGHBOR_TYPE");
 
     internal::SearchKnn<RandomAccessIterator> v(begin, end);
-    SearchNearest(data_.root_node, x, v);
+    SearchNearest(x, v);
   }
 
   //! \brief Searches for the \p k nearest neighbors of point \p x and stores
@@ -116,8 +211,27 @@ class CoverTree {
       P const& x, Size const k, std::vector<NeighborType>& knn) const {
     // If it happens that the point set has less points than k we just return
     // all points in the set.
-    knn.resize(std::min(k, SpaceWrapperType(space_).size()));
-    SearchKnn(x, knn.begin(), knn.end());
+    knn.resize(std::min(k, size()));
+    // The visitor requires at least one neighbor.
+    if (!knn.empty()) {
+      SearchKnn(x, knn.begin(), knn.end());
+    }
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x and stores
+  //! the results in output vector \p knn.
+  //! \details Nodes are visited best-first. Depending on the data this can be
+  //! faster or slower than SearchKnn(), which visits nodes depth-first.
+  template <typename P>
+  inline void SearchKnnBestFirst(
+      P const& x, Size const k, std::vector<NeighborType>& knn) const {
+    knn.resize(std::min(k, size()));
+    if (knn.empty()) {
+      return;
+    }
+    internal::SearchKnn<typename std::vector<NeighborType>::iterator> v(
+        knn.begin(), knn.end());
+    SearchNearestBestFirst(x, v);
   }
 
   //! \brief Searches for the k approximate nearest neighbors of point \p x,
@@ -136,7 +250,7 @@ class CoverTree {
         "ITERATOR_VALUE_TYPE_DOES_NOT_EQUAL_NEIGHBOR_TYPE");
 
     internal::SearchApproximateKnn<RandomAccessIterator> v(e, begin, end);
-    SearchNearest(data_.root_node, x, v);
+    SearchNearest(x, v);
   }
 
   //! \brief Searches for the \p k approximate nearest neighbors of point \p x
@@ -149,8 +263,10 @@ class CoverTree {
       std::vector<NeighborType>& knn) const {
     // If it happens that the point set has less points than k we just return
     // all points in the set.
-    knn.resize(std::min(k, SpaceWrapperType(space_).size()));
-    SearchKnn(x, e, knn.begin(), knn.end());
+    knn.resize(std::min(k, size()));
+    if (!knn.empty()) {
+      SearchKnn(x, e, knn.begin(), knn.end());
+    }
   }
 
   //! \brief Searches for all the neighbors of point \p x that are within radius
@@ -162,7 +278,7 @@ class CoverTree {
       std::vector<NeighborType>& n,
       bool const sort = false) const {
     internal::SearchRadius<NeighborType> v(radius, n);
-    SearchNearest(data_.root_node, x, v);
+    SearchNearest(x, v);
 
     if (sort) {
       v.Sort();
@@ -179,33 +295,124 @@ class CoverTree {
       std::vector<NeighborType>& n,
       bool const sort = false) const {
     internal::SearchApproximateRadius<NeighborType> v(e, radius, n);
-    SearchNearest(data_.root_node, x, v);
+    SearchNearest(x, v);
 
     if (sort) {
       v.Sort();
     }
   }
 
+  //! \brief Returns the number of points contained by the tree.
+  inline Size size() const {
+    return dynamic_ ? dynamic_->size : data_.nodes.size();
+  }
+
   //! \brief Point set used by the tree.
   inline Space const& points() const { return space_; }
 
   //! \brief Metric used for search queries.
   inline MetricType const& metric() const { return metric_; }
 
+  //! \brief Loads the tree in binary from file.
+  static CoverTree Load(SpaceType points, std::string const& filename) {
+    std::fstream stream =
+        internal::OpenStream(filename, std::ios::in | std::ios::binary);
+    return Load(std::move(points), stream);
+  }
+
+  //! \brief Loads the tree in binary from \p stream .
+  //! \details This is considered a convinience function to be able to save and
+  //! load a CoverTree on a single machine.
+  //! \li Does not take memory endianness into account.
+  //! \li Does not check if the stored tree structure is valid for the given
+  //! point set.
+  //! \li Does not check if the stored tree structure is valid for the given
+  //! template arguments.
+  static CoverTree Load(SpaceType points, std::iostream& stream) {
+    internal::Stream s(stream);
+    return CoverTree(std::move(points), s);
+  }
+
+  //! \brief Saves the tree in binary to file.
+  static void Save(CoverTree const& tree, std::string const& filename) {
+    std::fstream stream =
+        internal::OpenStream(filename, std::ios::out | std::ios::binary);
+    Save(tree, stream);
+  }
+
+  //! \brief Saves the tree in binary to \p stream .
+  //! \details This is considered a convinience function to be able to save and
+  //! load a CoverTree on a single machine.
+  //! \li Does not take memory endianness into account.
+  //! \li Stores the tree structure but not the points.
+  //! \li A tree with inserted or removed points is stored as if it were
+  //! compacted, but without recomputing the maximum distance of each node.
+  static void Save(CoverTree const& tree, std::iostream& stream) {
+    internal::Stream s(stream);
+    if (tree.dynamic_) {
+      CoverTreeDataType::Save(
+          internal::FlattenCoverTree<CoverTreeDataType>(
+              SpaceWrapperType(tree.space_),
+              tree.dynamic_->root,
+              tree.dynamic_->size,
+              tree.data_.base),
+          s);
+    } else {
+      CoverTreeDataType::Save(tree.data_, s);
+    }
+  }
+
  private:
-  //! \brief Returns the nearest neighbor (or neighbors) of point \p x depending
-  //! on their selection by visitor \p visitor for node \p node .
-  template <typename P, typename Visitor_>
-  inline void SearchNearest(
-      Node const* const node, P const& x, Visitor_& visitor) const {
+  //! \brief Constructs a CoverTree by reading its structure from a Stream.
+  CoverTree(SpaceType space, internal::Stream& stream)
+      : space_(std::move(space)),
+        metric_(),
+        data_(CoverTreeDataType::Load(SpaceWrapperType(space_), stream)) {}
+
+  //! \brief Returns the modifiable version of the tree. It is created from the
+  //! current tree when it doesn't exist yet.
+  inline CoverTreeDynamicDataType& Dynamic() {
+    if (!dynamic_) {
+      dynamic_ = std::make_unique<CoverTreeDynamicDataType>(
+          CoverTreeDynamicDataType::FromData(
+              data_, SpaceWrapperType(space_).size()));
+    }
+    return *dynamic_;
+  }
+
+  //! \brief Runs search algorithm \p Search_ for point \p x and visitor \p
+  //! visitor .
+  template <
+      template <typename, typename, typename, typename>
+      class Search_,
+      typename P,
+      typename Visitor_>
+  inline void Search(P const& x, Visitor_& visitor) const {
+    if (dynamic_) {
+      Search<Search_>(
+          DynamicViewType(*dynamic_, SpaceWrapperType(space_)), x, visitor);
+    } else {
+      Search<Search_>(FlatViewType(data_), x, visitor);
+    }
+  }
+
+  //! \brief Runs search algorithm \p Search_ on the tree provided by \p view .
+  //! \details The scratch memory of the search is reused by all queries of the
+  //! current thread. It is cleared at the start of each search, such that a
+  //! nested search would corrupt the stack or queue of the outer one.
+  template <
+      template <typename, typename, typename, typename>
+      class Search_,
+      typename View_,
+      typename P,
+      typename Visitor_>
+  inline void Search(View_ view, P const& x, Visitor_& visitor) const {
+    using SearchType =
+        Search_<View_, MetricType, internal::PointWrapper<P>, Visitor_>;
+
+    static thread_local typename SearchType::ScratchType scratch;
     internal::PointWrapper<P> p(x);
-    SpaceWrapperType space(space_);
-    internal::SearchNearestMetric<
-        SpaceWrapperType,
-        MetricType,
-        internal::PointWrapper<P>,
-        Visitor_,
-        IndexType>(space, metric_, p, visitor)(node);
+    SearchType(view, metric_, p, visitor, scratch)();
   }
 
   //! Point set used for querying point data.
@@ -214,6 +421,9 @@ class CoverTree {
   MetricType metric_;
   //! Data structure of the CoverTree.
   CoverTreeDataType data_;
+  //! Modifiable version of the CoverTree. It replaces data_ from the first
+  //! insertion or removal until the next compaction.
+  std::unique_ptr<CoverTreeDynamicDataType> dynamic_;
 };
 
 }  // namespace pico_tree
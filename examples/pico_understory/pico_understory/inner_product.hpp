@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <utility>
+
+#include "pico_tree/internal/point.hpp"
+#include "pico_tree/internal/point_wrapper.hpp"
+#include "pico_tree/internal/space_wrapper.hpp"
+#include "pico_tree/metric.hpp"
+#include "pico_understory/internal/matrix_space_traits.hpp"
+#include "pico_understory/internal/point_traits.hpp"
+
+namespace pico_tree {
+
+namespace internal {
+
+//! \brief Returns the squared L2 norm of the first \p sdim coordinates of \p x.
+template <typename Scalar_, typename InputIterator_>
+inline Scalar_ SquaredNorm(InputIterator_ x, Size sdim) {
+  Scalar_ n = Scalar_(0);
+  for (Size i = 0; i < sdim; ++i) {
+    n += x[i] * x[i];
+  }
+  return n;
+}
+
+//! \brief Copies the first \p sdim coordinates of \p x to \p y scaled to unit
+//! length. A zero vector remains a zero vector.
+template <typename Scalar_, typename InputIterator_, typename OutputIterator_>
+inline void CopyNormalized(InputIterator_ x, Size sdim, OutputIterator_ y) {
+  Scalar_ const n = std::sqrt(SquaredNorm<Scalar_>(x, sdim));
+  Scalar_ const s = n > Scalar_(0) ? Scalar_(1) / n : Scalar_(0);
+  for (Size i = 0; i < sdim; ++i) {
+    y[i] = x[i] * s;
+  }
+}
+
+//! \brief Dimension of a space of dimension \p Dim_ after appending one
+//! coordinate.
+template <Size Dim_>
+inline Size constexpr kAugmentedDim = Dim_ == kDynamicSize ? kDynamicSize
+                                                           : Dim_ + 1;
+
+//! \brief Checks that Tree_ searches its space using the L2Squared metric.
+template <typename Tree_>
+inline bool constexpr kIsL2SquaredTree =
+    std::is_same_v<typename Tree_::MetricType, L2Squared>;
+
+}  // namespace internal
+
+//! \brief Type of the normalized copy of a space of type Space_ that is indexed
+//! by a CosineSearch.
+template <typename Space_>
+using CosineSpaceType = internal::MatrixSpace<
+    typename internal::SpaceWrapper<Space_>::ScalarType,
+    internal::SpaceWrapper<Space_>::Dim>;
+
+//! \brief Type of the augmented copy of a space of type Space_ that is indexed
+//! by a MipsSearch. It has one more dimension than Space_.
+template <typename Space_>
+using MipsSpaceType = internal::MatrixSpace<
+    typename internal::SpaceWrapper<Space_>::ScalarType,
+    internal::kAugmentedDim<internal::SpaceWrapper<Space_>::Dim>>;
+
+//! \brief Searches for the points with the largest cosine similarity to a
+//! query.
+//! \details The points are normalized once, when the search is created. For
+//! unit vectors, the squared Euclidean distance equals 2 - 2 * cos(angle).
+//! Tree_ is a KdTree or KdForest that uses the L2Squared metric to search the
+//! normalized copy of the space, e.g.:
+//! \code{.cpp}
+//! using Tree = KdTree<CosineSpaceType<Space>, L2Squared>;
+//! \endcode
+//! The distance of each resulting neighbor is replaced by its cosine
+//! similarity. Neighbors are sorted from most to least similar.
+template <typename Tree_>
+class CosineSearch {
+  static_assert(
+      internal::kIsL2SquaredTree<Tree_>, "TREE_METRIC_SHOULD_BE_L2_SQUARED");
+
+ public:
+  using TreeType = Tree_;
+  using IndexType = typename Tree_::IndexType;
+  using ScalarType = typename Tree_::ScalarType;
+  using SpaceType = typename Tree_::SpaceType;
+  using NeighborType = typename Tree_::NeighborType;
+
+  //! \brief Creates a CosineSearch for the points of \p space. The remaining
+  //! arguments \p args are passed to the constructor of the tree.
+  template <typename Space_, typename... Args_>
+  CosineSearch(Space_ const& space, Args_&&... args)
+      : tree_(
+            Normalize(internal::SpaceWrapper<Space_>(space)),
+            std::forward<Args_>(args)...) {}
+
+  //! \brief Searches for the \p k points with the largest cosine similarity to
+  //! point \p x.
+  template <typename P>
+  inline void SearchKnn(
+      P const& x, Size const k, std::vector<NeighborType>& knn) const {
+    tree_.SearchKnn(Query(x), k, knn);
+    ToSimilarity(knn);
+  }
+
+  //! \brief Searches for the \p k points with the largest cosine similarity to
+  //! point \p x. Only available when the tree is a KdForest.
+  template <typename P>
+  inline void SearchKnn(
+      P const& x,
+      Size const k,
+      Size const max_leaves_visited,
+      std::vector<NeighborType>& knn) const {
+    tree_.SearchKnn(Query(x), k, max_leaves_visited, knn);
+    ToSimilarity(knn);
+  }
+
+  //! \brief The tree that indexes the normalized points.
+  inline TreeType const& tree() const { return tree_; }
+
+ private:
+  using QueryType = internal::Point<ScalarType, SpaceType::Dim>;
+
+  template <typename SpaceWrapper_>
+  static SpaceType Normalize(SpaceWrapper_ space) {
+    SpaceType s(space.size(), space.sdim());
+    for (Size i = 0; i < space.size(); ++i) {
+      internal::CopyNormalized<ScalarType>(space[i], space.sdim(), s.data(i));
+    }
+    return s;
+  }
+
+  template <typename P>
+  inline QueryType Query(P const& x) const {
+    internal::PointWrapper<P> p(x);
+    Size const sdim = static_cast<Size>(p.end() - p.begin());
+    QueryType q = QueryType::FromSize(sdim);
+    internal::CopyNormalized<ScalarType>(p.begin(), sdim, q.data());
+    return q;
+  }
+
+  static inline void ToSimilarity(std::vector<NeighborType>& knn) {
+    for (auto& n : knn) {
+      n.distance = ScalarType(1) - n.distance / ScalarType(2);
+    }
+  }
+
+  TreeType tree_;
+};
+
+//! \brief Searches for the points with the largest inner product with a
+//! query, also known as maximum inner product search (MIPS).
+//! \details Each point x is augmented with the coordinate
+//! sqrt(M - |x|^2), where M is the largest squared norm of all points, and
+//! each query q with a zero. The squared Euclidean distance between them then
+//! equals |q|^2 + M - 2 * dot(q, x), such that the nearest neighbors are the
+//! points with the largest inner product. Tree_ is a KdTree or KdForest that
+//! uses the L2Squared metric to search the augmented copy of the space, e.g.:
+//! \code{.cpp}
+//! using Tree = KdTree<MipsSpaceType<Space>, L2Squared>;
+//! \endcode
+//! The distance of each resulting neighbor is replaced by its inner product.
+//! Neighbors are sorted from largest to smallest inner product.
+//!
+//! Bachrach et al., Speeding Up the Xbox Recommender System Using a Euclidean
+//! Transformation for Inner-Product Spaces, In RecSys, 2014.
+template <typename Tree_>
+class MipsSearch {
+  static_assert(
+      internal::kIsL2SquaredTree<Tree_>, "TREE_METRIC_SHOULD_BE_L2_SQUARED");
+
+ public:
+  using TreeType = Tree_;
+  using IndexType = typename Tree_::IndexType;
+  using ScalarType = typename Tree_::ScalarType;
+  using SpaceType = typename Tree_::SpaceType;
+  using NeighborType = typename Tree_::NeighborType;
+
+  //! \brief Creates a MipsSearch for the points of \p space. The remaining
+  //! arguments \p args are passed to the constructor of the tree.
+  template <typename Space_, typename... Args_>
+  MipsSearch(Space_ const& space, Args_&&... args)
+      : max_squared_norm_(
+            MaxSquaredNorm(internal::SpaceWrapper<Space_>(space))),
+        tree_(
+            Augment(internal::SpaceWrapper<Space_>(space), max_squared_norm_),
+            std::forward<Args_>(args)...) {}
+
+  //! \brief Searches for the \p k points with the largest inner product with
+  //! point \p x.
+  template <typename P>
+  inline void SearchKnn(
+      P const& x, Size const k, std::vector<NeighborType>& knn) const {
+    QueryType q = Query(x);
+    tree_.SearchKnn(q, k, knn);
+    ToInnerProduct(q, knn);
+  }
+
+  //! \brief Searches for the \p k points with the largest inner product with
+  //! point \p x. Only available when the tree is a KdForest.
+  template <typename P>
+  inline void SearchKnn(
+      P const& x,
+      Size const k,
+      Size const max_leaves_visited,
+      std::vector<NeighborType>& knn) const {
+    QueryType q = Query(x);
+    tree_.SearchKnn(q, k, max_leaves_visited, knn);
+    ToInnerProduct(q, knn);
+  }
+
+  //! \brief The tree that indexes the augmented points.
+  inline TreeType const& tree() const { return tree_; }
+
+ private:
+  using QueryType = internal::Point<ScalarType, SpaceType::Dim>;
+
+  template <typename SpaceWrapper_>
+  static ScalarType MaxSquaredNorm(SpaceWrapper_ space) {
+    ScalarType max = ScalarType(0);
+    for (Size i = 0; i < space.size(); ++i) {
+      max = std::max(max, internal::SquaredNorm<ScalarType>(
+                              space[i], space.sdim()));
+    }
+    return max;
+  }
+
+  template <typename SpaceWrapper_>
+  static SpaceType Augment(SpaceWrapper_ space, ScalarType max_squared_norm) {
+    Size const sdim = space.sdim();
+    SpaceType s(space.size(), sdim + 1);
+    for (Size i = 0; i < space.size(); ++i) {
+      auto x = space[i];
+      auto y = s.data(i);
+      std::copy(x, x + sdim, y);
+      // Rounding errors may result in a tiny negative value.
+      y[sdim] = std::sqrt(std::max(
+          ScalarType(0),
+          max_squared_norm - internal::SquaredNorm<ScalarType>(x, sdim)));
+    }
+    return s;
+  }
+
+  template <typename P>
+  inline QueryType Query(P const& x) const {
+    internal::PointWrapper<P> p(x);
+    Size const sdim = static_cast<Size>(p.end() - p.begin());
+    QueryType q = QueryType::FromSize(sdim + 1);
+    std::copy(p.begin(), p.end(), q.data());
+    q[sdim] = ScalarType(0);
+    return q;
+  }
+
+  inline void ToInnerProduct(
+      QueryType const& q, std::vector<NeighborType>& knn) const {
+    ScalarType const offset =
+        internal::SquaredNorm<ScalarType>(q.data(), q.size()) +
+        max_squared_norm_;
+    for (auto& n : knn) {
+      n.distance = (offset - n.distance) / ScalarType(2);
+    }
+  }
+
+  ScalarType max_squared_norm_;
+  TreeType tree_;
+};
+
+}  // namespace pico_tree
@@ -1,71 +1,185 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <future>
+#include <limits>
 #include <numeric>
-#include <random>
+#include <thread>
+#include <tuple>
 
 #include "cover_tree_base.hpp"
 #include "cover_tree_data.hpp"
+#include "pico_understory/metric.hpp"
 
 namespace pico_tree::internal {
 
-template <typename SpaceWrapper_, typename Metric_, typename CoverTreeData_>
-class BuildCoverTreeImpl {
+//! \brief Inserts points into and removes points from a CoverTree one at a
+//! time.
+//! \details The maximum distance of each node remains an upper bound of the
+//! distance to its farthest descendant. Inserting a point tightens it for each
+//! node the point passes on its way down the tree. Removing a point leaves it
+//! untouched. UpdateMaxDistance() makes the maximum distance of each node
+//! exact again.
+template <typename SpaceWrapper_, typename Metric_, typename Index_>
+class UpdateCoverTree {
  public:
-  using IndexType = typename CoverTreeData_::IndexType;
-  using ScalarType = typename CoverTreeData_::ScalarType;
-  using NodeType = typename CoverTreeData_::NodeType;
-  using NodeAllocatorType = typename CoverTreeData_::NodeAllocatorType;
+  using IndexType = Index_;
+  using ScalarType = MetricDistanceType<SpaceWrapper_, Metric_>;
+  using NodeType = CoverTreeNode<IndexType, ScalarType>;
 
-  BuildCoverTreeImpl(
-      SpaceWrapper_ space,
-      Metric_ metric,
-      ScalarType base,
-      NodeAllocatorType& allocator)
-      : space_(space), metric_(metric), base_{base}, allocator_(allocator) {}
+  UpdateCoverTree(SpaceWrapper_ space, Metric_ metric, ScalarType base)
+      : space_(space), metric_(metric), base_{base} {}
 
-  NodeType* operator()() {
-    // Both building and querying become a great deal faster for any of the
-    // nearest ancestor cover trees when they are constructed with randomly
-    // inserted points. It saves a huge deal of rebalancing (the build time of
-    // the LiDAR dataset goes from 1.5 hour+ to about 3 minutes) and the tree
-    // has a high probablity to be better balanced for queries.
-    // For the simplified cover tree, query performance is greatly improved
-    // using a randomized insertion at the price of construction time.
-    Size const npts = space_.size();
-    std::vector<IndexType> indices(npts);
-    std::iota(indices.begin(), indices.end(), 0);
-    std::random_device rd;
-    std::mt19937 g(rd());
-    std::shuffle(indices.begin(), indices.end(), g);
-
-    NodeType* node = InsertFirstTwo(indices);
-    for (IndexType i = 2; i < static_cast<IndexType>(npts); ++i) {
-      node = Insert(node, CreateNode(indices[i]));
-    }
-
-    // Cache friendly tree.
-    // TODO Take 1. A better version is probably where the contents of the
-    // vector are part of the node and not in a different memory blocks.
-    NodeAllocatorType allocator(npts);
-    NodeType* root = DepthFirstBufferCopy(node, allocator);
-    std::swap(allocator_, allocator);
-    node = root;
-
-    // TODO This is quite expensive. We can do better by using the values
-    // calculated during an insert.
-    // Current version is well worth it vs. queries but maybe not for high
-    // dimensions.
-    UpdateMaxDistance(node);
+  //! \brief Returns the root of \p tree after inserting \p node.
+  //! \details The \p tree may be empty, in which case it equals nullptr.
+  NodeType* Insert(NodeType* tree, NodeType* node) {
+    node->children.clear();
+    node->max_distance = ScalarType(0);
 
-    return node;
+    if (tree == nullptr) {
+      node->level = ScalarType(0);
+      return node;
+    }
+
+    // Both papers don't really handle the case of a tree with a single node.
+    if (tree->IsLeaf()) {
+      ScalarType const d = Distance(tree, node);
+      if (d > base_.CoverDistance(*tree)) {
+        tree->level = std::ceil(base_.Level(d));
+      }
+      tree->max_distance = std::max(tree->max_distance, d);
+      PushChild(tree, node);
+      return tree;
+    }
+
+    return InsertTree(tree, node);
+  }
+
+  //! \brief Returns the root of \p tree after removing \p node.
+  //! \details All descendants of \p node are inserted again. The result equals
+  //! nullptr when \p node was the only node of the tree.
+  NodeType* Remove(NodeType* tree, NodeType* node) {
+    std::vector<NodeType*> descendants;
+    Collect(node, descendants);
+
+    if (tree == node) {
+      if (descendants.empty()) {
+        return nullptr;
+      }
+
+      // Any descendant can take the place of the root. Inserting the others
+      // raises its level when it doesn't cover them.
+      tree = descendants.back();
+      descendants.pop_back();
+      tree->children.clear();
+      tree->level = node->level;
+      tree->max_distance = ScalarType(0);
+    } else {
+      auto x = space_[node->index];
+      NodeType* parent = FindParentOf(tree, node, x, true);
+      // Rounding errors may cause a maximum distance to be a tiny bit too
+      // small, in which case the search is repeated without pruning.
+      if (parent == nullptr) {
+        parent = FindParentOf(tree, node, x, false);
+      }
+      assert(parent != nullptr);
+      parent->children.erase(
+          std::find(parent->children.begin(), parent->children.end(), node));
+    }
+
+    for (NodeType* m : descendants) {
+      tree = Insert(tree, m);
+    }
+
+    return tree;
+  }
+
+  //! \brief Updates the maximum distance of \p node and all its descendants.
+  //! \details The descendants of a node are updated before the node itself.
+  //! Their maximum distances are then used to skip any subtree that cannot
+  //! contain a point farther away than the current maximum.
+  void UpdateMaxDistance(NodeType* node) const {
+    for (NodeType* m : node->children) {
+      UpdateMaxDistance(m);
+    }
+
+    auto x = space_[node->index];
+    ScalarType max = ScalarType(0);
+    for (NodeType const* const m : node->children) {
+      max = MaxDistance(m, x, max);
+    }
+    node->max_distance = max;
   }
 
  private:
-  inline NodeType* CreateNode(IndexType idx) {
-    NodeType* node = allocator_.Allocate();
-    node->index = idx;
-    return node;
+  //! \brief Returns the maximum of \p max and the distance between \p x and
+  //! any of the points in the subtree of \p node.
+  template <typename PointCoords>
+  ScalarType MaxDistance(
+      NodeType const* const node, PointCoords x, ScalarType max) const {
+    ScalarType const d = metric_(x, x + space_.sdim(), space_[node->index]);
+
+    // None of the descendants can be farther away than this bound.
+    if (d + node->max_distance <= max) {
+      return max;
+    }
+
+    max = std::max(max, d);
+    for (NodeType const* const m : node->children) {
+      max = MaxDistance(m, x, max);
+    }
+
+    return max;
+  }
+
+  inline ScalarType Distance(
+      NodeType const* const a, NodeType const* const b) const {
+    auto x = space_[a->index];
+    return metric_(x, x + space_.sdim(), space_[b->index]);
+  }
+
+  //! \brief Returns the parent of \p node, which has point \p x, or nullptr
+  //! if \p node is not a descendant of \p tree.
+  //! \details When \p prune is true, only subtrees of which the maximum
+  //! distance includes \p x are searched.
+  template <typename PointCoords>
+  NodeType* FindParentOf(
+      NodeType* tree,
+      NodeType const* const node,
+      PointCoords x,
+      bool prune) const {
+    for (NodeType* m : tree->children) {
+      if (m == node) {
+        return tree;
+      }
+    }
+
+    for (NodeType* m : tree->children) {
+      // The point can only be a descendant of m when it is within its maximum
+      // distance.
+      if (!prune || metric_(x, x + space_.sdim(), space_[m->index]) <=
+                        m->max_distance) {
+        NodeType* parent = FindParentOf(m, node, x, prune);
+        if (parent != nullptr) {
+          return parent;
+        }
+      }
+    }
+
+    return nullptr;
+  }
+
+  //! \brief Appends all descendants of \p node to \p descendants and removes
+  //! them from the tree.
+  void Collect(NodeType* node, std::vector<NodeType*>& descendants) const {
+    for (NodeType* m : node->children) {
+      descendants.push_back(m);
+      Collect(m, descendants);
+    }
+    node->children.clear();
   }
 
   inline void PushChild(NodeType* parent, NodeType* child) const {
@@ -77,6 +191,7 @@ class BuildCoverTreeImpl {
     assert(parent->IsLeaf());
 
     parent->level = child->level + ScalarType(1.0);
+    parent->max_distance = Distance(parent, child) + child->max_distance;
     parent->children.push_back(child);
     return parent;
   }
@@ -96,27 +211,8 @@ class BuildCoverTreeImpl {
     return tree;
   }
 
-  //! \brief Inserts the first or first two nodes of the tree.
-  //! \details Both papers don't really handle these cases but here we go.
-  inline NodeType* InsertFirstTwo(std::vector<IndexType> const& indices) {
-    NodeType* node = allocator_.Allocate();
-    node->index = indices[0];
-
-    if (space_.size() == 1) {
-      node->level = 0;
-    } else {
-      auto x0 = space_[indices[0]];
-      auto x1 = space_[indices[1]];
-      ScalarType d = metric_(x0, x0 + space_.sdim(), x1);
-      node->level = std::ceil(base_.Level(d));
-      PushChild(node, CreateNode(indices[1]));
-    }
-
-    return node;
-  }
-
   //! \brief Returns a new tree inserting \p node into \p tree.
-  inline NodeType* Insert(NodeType* tree, NodeType* node) {
+  inline NodeType* InsertTree(NodeType* tree, NodeType* node) {
     auto x = space_[node->index];
     ScalarType d = metric_(x, x + space_.sdim(), space_[tree->index]);
     ScalarType c = base_.CoverDistance(*tree);
@@ -138,18 +234,23 @@ class BuildCoverTreeImpl {
 
       return NodeToParent(node, tree);
     } else {
-      InsertCovered(tree, node);
+      InsertCovered(tree, node, d);
       return tree;
     }
   }
 
-  //! \brief Insert \p node somewhere in \p tree. If the new parent for \p
+  //! \brief Insert leaf \p node somewhere in \p tree. If the new parent for \p
   //! node already has children, rebalancing may occur.
-  inline void InsertCovered(NodeType* tree, NodeType* node) {
+  //! \details The distance between \p tree and \p node equals \p d.
+  inline void InsertCovered(NodeType* tree, NodeType* node, ScalarType d) {
     // The following line may replace the contents of this function to get a
     // simplified cover tree:
     // PushChild(FindParent(tree, space_[node->index], node);
 
+    assert(node->IsLeaf());
+    node->max_distance = ScalarType(0);
+    tree->max_distance = std::max(tree->max_distance, d);
+
     auto x = space_[node->index];
     NodeType* parent = FindParent(tree, x);
 
@@ -160,6 +261,8 @@ class BuildCoverTreeImpl {
     }
   }
 
+  //! \brief Returns the node that becomes the parent of point \p x. The
+  //! maximum distance of each node on the way down is updated to include \p x.
   template <typename PointCoords>
   inline NodeType* FindParent(NodeType* tree, PointCoords x) const {
     if (tree->IsLeaf()) {
@@ -185,7 +288,9 @@ class BuildCoverTreeImpl {
       }
 
       if (min_d <= base_.ChildDistance(*tree)) {
-        return FindParent(tree->children[min_i], x);
+        NodeType* child = tree->children[min_i];
+        child->max_distance = std::max(child->max_distance, min_d);
+        return FindParent(child, x);
       }
 
       return tree;
@@ -217,7 +322,7 @@ class BuildCoverTreeImpl {
         Extract(x, y, child, to_move, to_stay);
 
         for (auto it = to_stay.rbegin(); it != to_stay.rend(); ++it) {
-          InsertCovered(child, *it);
+          InsertCovered(child, *it, Distance(child, *it));
         }
 
         to_stay.clear();
@@ -227,7 +332,7 @@ class BuildCoverTreeImpl {
     node->level = parent->level - ScalarType(1.0);
 
     for (auto it = to_move.rbegin(); it != to_move.rend(); ++it) {
-      InsertCovered(node, *it);
+      InsertCovered(node, *it, Distance(node, *it));
     }
 
     PushChild(parent, node);
@@ -236,7 +341,7 @@ class BuildCoverTreeImpl {
       Extract(x, space_[child->index], child, to_move, to_stay);
 
       for (auto it = to_stay.rbegin(); it != to_stay.rend(); ++it) {
-        child = Insert(child, *it);
+        child = InsertTree(child, *it);
       }
 
       to_stay.clear();
@@ -245,7 +350,7 @@ class BuildCoverTreeImpl {
     node->level = parent->level - ScalarType(1.0);
 
     for (auto it = to_move.rbegin(); it != to_move.rend(); ++it) {
-      node = Insert(node, *it);
+      node = InsertTree(node, *it);
     }
 
     PushChild(parent, node);
@@ -316,70 +421,293 @@ class BuildCoverTreeImpl {
     descendant->children.clear();
   }
 
-  NodeType* DepthFirstBufferCopy(
-      NodeType const* const node, NodeAllocatorType& allocator) {
-    NodeType* copy = allocator.Allocate();
-    copy->index = node->index;
-    copy->level = node->level;
-    copy->children.reserve(node->children.size());
+  SpaceWrapper_ space_;
+  Metric_ metric_;
+  Base<ScalarType> base_;
+};
+
+//! \brief Builds a CoverTree by recursively dividing the points between the
+//! children of each node.
+//! \details Starting at the root, the children of a node are greedily selected
+//! from the points it covers: a point becomes a child when it is not within the
+//! cover distance of any of the children selected before it. The children of a
+//! node are therefore separated by more than their cover distance. Each of the
+//! remaining points becomes a descendant of its nearest child, similar to the
+//! nearest ancestor cover tree. Because the subtrees of the children are
+//! independent of each other, large subtrees are built concurrently.
+//!
+//! The distances between a node and its descendants are all known when the
+//! node is created, which gives the maximum distance of each node for free.
+template <typename SpaceWrapper_, typename Metric_, typename Index_>
+class BuildCoverTreeBatchImpl {
+ public:
+  using IndexType = Index_;
+  using ScalarType = MetricDistanceType<SpaceWrapper_, Metric_>;
+  using NodeType = CoverTreeNode<IndexType, ScalarType>;
+
+  //! \brief Creates a builder that stores the node of the i-th point of \p
+  //! space at position i of \p nodes.
+  BuildCoverTreeBatchImpl(
+      SpaceWrapper_ space,
+      Metric_ metric,
+      ScalarType base,
+      Size thread_count,
+      std::vector<NodeType>& nodes)
+      : space_(space),
+        metric_(metric),
+        base_{base},
+        idle_threads_(thread_count > 0 ? thread_count - 1 : 0),
+        nodes_(nodes) {}
 
-    for (auto const m : node->children) {
-      copy->children.push_back(DepthFirstBufferCopy(m, allocator));
+  NodeType* operator()() {
+    Size const npts = space_.size();
+    nodes_.resize(npts);
+
+    // The first point becomes the root and all other points its descendants.
+    std::vector<ItemType> items;
+    items.reserve(npts - 1);
+    auto x = space_[0];
+    ScalarType max = ScalarType(0);
+    for (IndexType i = 1; i < static_cast<IndexType>(npts); ++i) {
+      ScalarType const d = metric_(x, x + space_.sdim(), space_[i]);
+      items.push_back({i, d});
+      max = std::max(max, d);
     }
 
-    return copy;
+    ScalarType const level =
+        max > ScalarType(0) ? std::ceil(base_.Level(max)) : ScalarType(0);
+    NodeType* root = CreateNode(IndexType(0), level);
+    Build(root, items.data(), items.data() + items.size());
+
+    return root;
   }
 
-  void UpdateMaxDistance(NodeType* node) const {
-    node->max_distance = MaxDistance(node, space_[node->index]);
+ private:
+  //! \brief The index of a point and its distance to the node that covers it.
+  using ItemType = std::pair<IndexType, ScalarType>;
 
-    for (NodeType* m : node->children) {
-      UpdateMaxDistance(m);
-    }
+  //! \brief Subtrees with fewer descendants are never built concurrently.
+  static Size constexpr kMinTaskSize = 1024 * 4;
+
+  inline NodeType* CreateNode(IndexType idx, ScalarType level) {
+    NodeType* node = &nodes_[static_cast<std::size_t>(idx)];
+    node->index = idx;
+    node->level = level;
+    return node;
   }
 
-  template <typename PointCoords>
-  ScalarType MaxDistance(NodeType const* const node, PointCoords x) const {
-    ScalarType max = metric_(x, x + space_.sdim(), space_[node->index]);
+  //! \brief Builds the subtree of \p node given its descendants [begin, end).
+  //! The second member of each item must equal its distance to \p node.
+  void Build(NodeType* node, ItemType* begin, ItemType* end) {
+    node->max_distance = ScalarType(0);
+    for (ItemType const* it = begin; it != end; ++it) {
+      node->max_distance = std::max(node->max_distance, it->second);
+    }
 
-    for (NodeType const* const m : node->children) {
-      max = std::max(max, MaxDistance(m, x));
+    if (begin == end) {
+      return;
     }
 
-    return max;
+    ScalarType const child_level = node->level - ScalarType(1.0);
+
+    // All descendants are duplicates of the node. They can't be separated.
+    if (node->max_distance == ScalarType(0)) {
+      for (ItemType const* it = begin; it != end; ++it) {
+        NodeType* child = CreateNode(it->first, child_level);
+        child->max_distance = ScalarType(0);
+        node->children.push_back(child);
+      }
+      return;
+    }
+
+    ScalarType const cover = base_.ChildDistance(*node);
+
+    // The first pass selects the children. A point becomes a child when it is
+    // not covered by any of the children selected before it. Children are
+    // moved to the front of the range.
+    ItemType* centers_end = begin;
+    for (ItemType* it = begin; it != end; ++it) {
+      auto x = space_[it->first];
+      bool covered = false;
+      for (ItemType const* c = begin; c != centers_end; ++c) {
+        if (metric_(x, x + space_.sdim(), space_[c->first]) <= cover) {
+          covered = true;
+          break;
+        }
+      }
+      if (!covered) {
+        std::swap(*it, *centers_end);
+        ++centers_end;
+      }
+    }
+
+    // The second pass assigns each remaining point to its nearest child.
+    // Compared to assigning it to the first child that covers it, this
+    // results in smaller maximum distances.
+    std::size_t const child_count =
+        static_cast<std::size_t>(centers_end - begin);
+    std::vector<std::size_t> assigned;
+    assigned.reserve(static_cast<std::size_t>(end - centers_end));
+    std::vector<std::size_t> counts(child_count + 1, 0);
+    for (ItemType* it = centers_end; it != end; ++it) {
+      auto x = space_[it->first];
+      std::size_t min_c = 0;
+      ScalarType min_d = std::numeric_limits<ScalarType>::max();
+      for (std::size_t c = 0; c < child_count; ++c) {
+        ScalarType const d =
+            metric_(x, x + space_.sdim(), space_[begin[c].first]);
+        if (d < min_d) {
+          min_d = d;
+          min_c = c;
+        }
+      }
+      it->second = min_d;
+      assigned.push_back(min_c);
+      ++counts[min_c + 1];
+    }
+
+    // Group the descendants of each child using a counting sort.
+    std::partial_sum(counts.begin(), counts.end(), counts.begin());
+    std::vector<ItemType> grouped(assigned.size());
+    {
+      std::vector<std::size_t> offsets(counts.begin(), counts.end() - 1);
+      for (std::size_t i = 0; i < assigned.size(); ++i) {
+        grouped[offsets[assigned[i]]++] = centers_end[i];
+      }
+    }
+    std::copy(grouped.begin(), grouped.end(), centers_end);
+
+    std::vector<std::tuple<NodeType*, ItemType*, ItemType*>> subtrees;
+    subtrees.reserve(child_count);
+    for (std::size_t c = 0; c < child_count; ++c) {
+      NodeType* child = CreateNode(begin[c].first, child_level);
+      node->children.push_back(child);
+      subtrees.push_back(
+          {child, centers_end + counts[c], centers_end + counts[c + 1]});
+    }
+
+    std::vector<std::future<void>> tasks;
+    for (auto const& [child, b, e] : subtrees) {
+      if (static_cast<Size>(e - b) >= kMinTaskSize && AcquireThread()) {
+        NodeType* c = child;
+        ItemType* cb = b;
+        ItemType* ce = e;
+        tasks.push_back(std::async(std::launch::async, [this, c, cb, ce]() {
+          Build(c, cb, ce);
+          ++idle_threads_;
+        }));
+      } else {
+        Build(child, b, e);
+      }
+    }
+
+    for (auto& task : tasks) {
+      task.get();
+    }
+  }
+
+  //! \brief Returns true if a thread could be reserved for building a subtree.
+  inline bool AcquireThread() {
+    Size idle = idle_threads_.load();
+    while (idle > 0) {
+      if (idle_threads_.compare_exchange_weak(idle, idle - 1)) {
+        return true;
+      }
+    }
+    return false;
   }
 
   SpaceWrapper_ space_;
   Metric_ metric_;
   Base<ScalarType> base_;
-  NodeAllocatorType& allocator_;
+  std::atomic<Size> idle_threads_;
+  std::vector<NodeType>& nodes_;
 };
 
+//! \brief Copies the tree rooted at \p root into a CoverTreeData in
+//! breadth-first order.
+//! \details The children of each node end up contiguously in memory, as well as
+//! the coordinates of their points. An empty tree has a \p root equal to
+//! nullptr.
+template <typename CoverTreeData_, typename SpaceWrapper_, typename Node_>
+CoverTreeData_ FlattenCoverTree(
+    SpaceWrapper_ space,
+    Node_ const* const root,
+    Size node_count,
+    typename CoverTreeData_::ScalarType base) {
+  using IndexType = typename CoverTreeData_::IndexType;
+  using SpaceType = typename CoverTreeData_::SpaceType;
+
+  CoverTreeData_ data{{}, SpaceType(node_count, space.sdim()), base};
+  if (root == nullptr) {
+    return data;
+  }
+  data.nodes.reserve(node_count);
+
+  // The order vector doubles as the queue of the breadth-first traversal.
+  std::vector<Node_ const*> order;
+  order.reserve(node_count);
+  order.push_back(root);
+
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    Node_ const* const node = order[i];
+    IndexType const begin = static_cast<IndexType>(order.size());
+    order.insert(order.end(), node->children.begin(), node->children.end());
+    data.nodes.push_back(
+        {node->level,
+         node->max_distance,
+         node->index,
+         begin,
+         static_cast<IndexType>(order.size())});
+
+    auto const x = space[node->index];
+    std::copy(x, x + space.sdim(), data.points.data(i));
+  }
+
+  return data;
+}
+
 template <typename SpaceWrapper_, typename Metric_, typename Index_>
 class BuildCoverTree {
   using IndexType = Index_;
-  using ScalarType = typename SpaceWrapper_::ScalarType;
+  using ScalarType = MetricDistanceType<SpaceWrapper_, Metric_>;
   static Size constexpr Dim = SpaceWrapper_::Dim;
 
  public:
-  using CoverTreeDataType = CoverTreeData<IndexType, ScalarType>;
-
-  //! \brief Construct a KdTree given \p points , \p max_leaf_size and
-  //! SplitterType.
+  using CoverTreeDataType = CoverTreeData<
+      IndexType,
+      ScalarType,
+      Dim,
+      typename SpaceWrapper_::ScalarType>;
+
+  //! \brief Construct a CoverTree given \p space , \p metric and a leveling
+  //! \p base.
+  //! \details The tree is built using at most \p thread_count threads. A value
+  //! of 0 uses the number of concurrent threads supported by the hardware.
   CoverTreeDataType operator()(
-      SpaceWrapper_ space, Metric_ metric, ScalarType base) {
+      SpaceWrapper_ space,
+      Metric_ metric,
+      ScalarType base,
+      Size thread_count = 0) {
     assert(space.size() > 0);
 
     using BuildCoverTreeImplType =
-        BuildCoverTreeImpl<SpaceWrapper_, Metric_, CoverTreeDataType>;
-    using NodeType = typename CoverTreeDataType::NodeType;
-    using NodeAllocatorType = typename CoverTreeDataType::NodeAllocatorType;
+        BuildCoverTreeBatchImpl<SpaceWrapper_, Metric_, IndexType>;
+    using NodeType = typename BuildCoverTreeImplType::NodeType;
+
+    if (thread_count == 0) {
+      thread_count =
+          std::max(Size(1), Size(std::thread::hardware_concurrency()));
+    }
 
-    NodeAllocatorType allocator(space.size());
-    NodeType* root_node =
-        BuildCoverTreeImplType{space, metric, base, allocator}();
+    // The nodes used during construction are discarded once the tree is
+    // copied into its cache friendly layout.
+    std::vector<NodeType> nodes;
+    NodeType const* const root_node =
+        BuildCoverTreeImplType{space, metric, base, thread_count, nodes}();
 
-    return CoverTreeDataType{std::move(allocator), root_node};
+    return FlattenCoverTree<CoverTreeDataType>(
+        space, root_node, space.size(), base);
   }
 };
 
@@ -1,23 +1,136 @@
 #pragma once
 
+#include <algorithm>
+#include <deque>
+#include <vector>
+
 #include "cover_tree_node.hpp"
-#include "static_buffer.hpp"
+#include "matrix_space.hpp"
+#include "pico_tree/internal/stream.hpp"
 
 namespace pico_tree::internal {
 
 //! \brief The data structure that represents a CoverTree.
-template <typename Index_, typename Scalar_>
+//! \details The nodes are stored in breadth-first order such that the children
+//! of each node form a contiguous block. The coordinates of the point of each
+//! node are copied into a matrix using the same order. Visiting the children
+//! of a node then results in a linear scan over both arrays.
+//!
+//! Distances are of type Scalar_ and coordinates of type Coordinate_.
+template <
+    typename Index_,
+    typename Scalar_,
+    Size Dim_,
+    typename Coordinate_ = Scalar_>
 class CoverTreeData {
+ public:
+  using IndexType = Index_;
+  using ScalarType = Scalar_;
+  static Size constexpr Dim = Dim_;
+  using NodeType = CoverTreeFlatNode<Index_, Scalar_>;
+  using SpaceType = MatrixSpace<Coordinate_, Dim_>;
+
+  //! \brief Position of the root node.
+  static IndexType constexpr kRoot = IndexType(0);
+
+  //! \brief Loads the tree from \p stream.
+  //! \details The coordinates of the point of each node are copied from \p
+  //! space.
+  template <typename SpaceWrapper_>
+  static CoverTreeData Load(SpaceWrapper_ space, Stream& stream) {
+    ScalarType base;
+    stream.Read(base);
+
+    typename std::vector<NodeType>::size_type node_count;
+    stream.Read(node_count);
+    std::vector<NodeType> nodes(node_count);
+    stream.Read(node_count, nodes.data());
+
+    SpaceType points(node_count, space.sdim());
+    for (std::size_t i = 0; i < node_count; ++i) {
+      auto const x = space[nodes[i].index];
+      std::copy(x, x + space.sdim(), points.data(i));
+    }
+
+    return {std::move(nodes), std::move(points), base};
+  }
+
+  //! \brief Saves the tree to \p stream.
+  //! \details The nodes are written as a single contiguous block. The copy of
+  //! the points is not stored.
+  static void Save(CoverTreeData const& data, Stream& stream) {
+    stream.Write(data.base);
+    stream.Write(data.nodes.size());
+    stream.Write(data.nodes.data(), data.nodes.size());
+  }
+
+  //! \brief Nodes of the tree in breadth-first order.
+  std::vector<NodeType> nodes;
+  //! \brief Copy of the point coordinates of each node. The i-th point belongs
+  //! to the i-th node.
+  SpaceType points;
+  //! \brief Leveling base of the tree.
+  ScalarType base;
+};
+
+//! \brief The data structure that represents a CoverTree that supports the
+//! insertion and removal of points.
+//! \details The node of the i-th point of the space is stored at position i.
+//! The nodes are stored in a deque such that they keep their address when the
+//! space grows.
+template <typename Index_, typename Scalar_>
+class CoverTreeDynamicData {
  public:
   using IndexType = Index_;
   using ScalarType = Scalar_;
   using NodeType = CoverTreeNode<Index_, Scalar_>;
-  using NodeAllocatorType = internal::StaticBuffer<NodeType>;
 
-  //! \brief Memory allocator for tree nodes.
-  NodeAllocatorType allocator;
-  //! \brief Root of the CoverTree.
-  NodeType* root_node;
+  //! \brief Creates a CoverTreeDynamicData from the breadth-first layout of a
+  //! tree over a space of \p npts points.
+  template <typename CoverTreeData_>
+  static CoverTreeDynamicData FromData(
+      CoverTreeData_ const& data, Size npts) {
+    CoverTreeDynamicData dynamic;
+    dynamic.Resize(npts);
+
+    for (auto const& n : data.nodes) {
+      NodeType& node = dynamic.nodes[static_cast<std::size_t>(n.index)];
+      node.level = n.level;
+      node.max_distance = n.max_distance;
+      node.children.reserve(
+          static_cast<std::size_t>(n.children_end - n.children_begin));
+      for (IndexType c = n.children_begin; c < n.children_end; ++c) {
+        node.children.push_back(
+            &dynamic.nodes[static_cast<std::size_t>(data.nodes[c].index)]);
+      }
+      dynamic.contained[static_cast<std::size_t>(n.index)] = true;
+    }
+
+    if (!data.nodes.empty()) {
+      dynamic.root =
+          &dynamic.nodes[static_cast<std::size_t>(data.nodes[0].index)];
+    }
+    dynamic.size = data.nodes.size();
+
+    return dynamic;
+  }
+
+  //! \brief Makes room for the nodes of a space of \p npts points.
+  inline void Resize(Size npts) {
+    for (Size i = nodes.size(); i < npts; ++i) {
+      nodes.emplace_back().index = static_cast<IndexType>(i);
+      contained.push_back(false);
+    }
+  }
+
+  //! \brief Node of each point of the space.
+  std::deque<NodeType> nodes;
+  //! \brief Indicates for each point of the space if it is part of the tree.
+  std::vector<bool> contained;
+  //! \brief Root of the tree. It equals nullptr when the tree is empty.
+  NodeType* root = nullptr;
+  //! \brief Number of points contained by the tree.
+  Size size = 0;
 };
 
 }  // namespace pico_tree::internal
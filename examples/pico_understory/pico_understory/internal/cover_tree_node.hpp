@@ -4,6 +4,7 @@
 
 namespace pico_tree::internal {
 
+//! \brief Node of a CoverTree that is under construction.
 template <typename Index_, typename Scalar_>
 struct CoverTreeNode {
   using IndexType = Index_;
@@ -20,4 +21,27 @@ struct CoverTreeNode {
   std::vector<CoverTreeNode*> children;
 };
 
+//! \brief Node of a CoverTree of which all nodes are stored in a single array
+//! in breadth-first order.
+//! \details The children of a node are stored contiguously and are referred to
+//! by the range [children_begin, children_end) of node positions.
+template <typename Index_, typename Scalar_>
+struct CoverTreeFlatNode {
+  using IndexType = Index_;
+  using ScalarType = Scalar_;
+
+  inline bool IsBranch() const { return children_begin != children_end; }
+  inline bool IsLeaf() const { return children_begin == children_end; }
+
+  ScalarType level;
+  //! \brief Distance to the farthest child.
+  ScalarType max_distance;
+  //! \brief Index of the point of the node.
+  IndexType index;
+  //! \brief Position of the first child.
+  IndexType children_begin;
+  //! \brief Position one past the last child.
+  IndexType children_end;
+};
+
 }  // namespace pico_tree::internal
@@ -1,61 +1,89 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 
-#include "cover_tree_node.hpp"
+#include "pico_tree/internal/search_visitor.hpp"
 
 namespace pico_tree::internal {
 
-//! \brief This class provides a search nearest function for the CoverTree.
+//! \brief This class provides a depth-first search nearest function for the
+//! CoverTree.
+//! \details The children of each node are visited in order of increasing
+//! distance to the query. Each distance is computed once: the distance of a
+//! child is computed by its parent and passed down. Children are buffered on a
+//! scratch stack that is shared by all nodes visited by a query.
+//!
+//! The tree is accessed through a view such as CoverTreeFlatView.
 template <
-    typename SpaceWrapper_,
+    typename View_,
     typename Metric_,
     typename PointWrapper_,
-    typename Visitor_,
-    typename Index_>
+    typename Visitor_>
 class SearchNearestMetric {
  public:
-  using IndexType = Index_;
-  using ScalarType = typename SpaceWrapper_::ScalarType;
-  using PointType = Point<ScalarType, SpaceWrapper_::Dim>;
-  using NodeType = CoverTreeNode<IndexType, ScalarType>;
+  using IndexType = typename View_::IndexType;
+  using ScalarType = typename View_::ScalarType;
+  using NodeRefType = typename View_::NodeRefType;
+  //! \brief A node and the distance of its point to the query.
+  using ItemType = std::pair<NodeRefType, ScalarType>;
+  //! \brief Storage that can be reused between queries.
+  using ScratchType = std::vector<ItemType>;
 
   SearchNearestMetric(
-      SpaceWrapper_ space,
+      View_ view,
       Metric_ metric,
       PointWrapper_ query,
-      Visitor_& visitor)
-      : space_(space), metric_(metric), query_(query), visitor_(visitor) {}
+      Visitor_& visitor,
+      ScratchType& scratch)
+      : view_(view),
+        metric_(metric),
+        query_(query),
+        visitor_(visitor),
+        scratch_(scratch) {}
 
-  //! \brief Search nearest neighbors starting from \p node.
-  inline void operator()(NodeType const* const node) const {
-    SearchNearest(node);
+  //! \brief Search nearest neighbors starting from the root node.
+  inline void operator()() const {
+    scratch_.clear();
+    if (!view_.empty()) {
+      SearchNearest(view_.Root(), Distance(view_.Root()));
+    }
   }
 
  private:
-  inline void SearchNearest(NodeType const* const node) const {
-    ScalarType const d =
-        metric_(query_.begin(), query_.end(), space_[node->index]);
+  //! \brief Returns the distance between the query and the point of node \p n.
+  inline ScalarType Distance(NodeRefType const n) const {
+    return metric_(query_.begin(), query_.end(), view_.Point(n));
+  }
+
+  //! \brief Searches node \p n of which the point is at distance \p d from
+  //! the query.
+  inline void SearchNearest(NodeRefType const n, ScalarType const d) const {
     if (visitor_.max() > d) {
-      visitor_(node->index, d);
+      visitor_(view_.Index(n), d);
     }
 
-    std::vector<std::pair<NodeType const*, ScalarType>> sorted;
-    sorted.reserve(node->children.size());
-    for (auto const child : node->children) {
-      sorted.push_back(
-          {child, metric_(query_.begin(), query_.end(), space_[child->index])});
+    if (IsDone(visitor_)) {
+      return;
     }
 
+    std::size_t const begin = scratch_.size();
+    view_.ForEachChild(n, [this](NodeRefType const c) {
+      scratch_.push_back({c, Distance(c)});
+    });
+    std::size_t const end = scratch_.size();
+
     std::sort(
-        sorted.begin(),
-        sorted.end(),
-        [](std::pair<NodeType const*, ScalarType> const& a,
-           std::pair<NodeType const*, ScalarType> const& b) -> bool {
+        scratch_.begin() + begin,
+        scratch_.end(),
+        [](ItemType const& a, ItemType const& b) -> bool {
           return a.second < b.second;
         });
 
-    for (auto const& m : sorted) {
+    // The scratch stack may be reallocated by any of the recursive calls.
+    // Items are accessed by position and copied before use.
+    for (std::size_t k = begin; k < end; ++k) {
+      ItemType const m = scratch_[k];
       // Algorithm 1 from paper "Faster Cover Trees" has a mistake. It checks
       // with respect to the nearest point, not the query point itself,
       // intersecting the wrong spheres.
@@ -68,21 +96,124 @@ class SearchNearestMetric {
       // added when they are within cover distance.
       // For "Faster Cover Trees" it is twice the cover distance due to the
       // first phase of the insert algorithm (not having a root at infinity).
+      if (visitor_.max() > (m.second - view_.MaxDistance(m.first))) {
+        SearchNearest(m.first, m.second);
+        if (IsDone(visitor_)) {
+          break;
+        }
+      }
+    }
+
+    scratch_.resize(begin);
+  }
+
+  View_ view_;
+  Metric_ metric_;
+  PointWrapper_ query_;
+  Visitor_& visitor_;
+  ScratchType& scratch_;
+};
+
+//! \brief This class provides a best-first search nearest function for the
+//! CoverTree.
+//! \details All nodes that may contain a neighbor are kept in a single priority
+//! queue and they are visited in order of increasing distance between the query
+//! and their point. A node is skipped when the lower bound distance of its
+//! descendants is no longer within the search distance of the visitor.
+//!
+//! Ordering by the distance of the point of a node, rather than by the lower
+//! bound, shrinks the search distance faster as the point of a node is always
+//! visited.
+template <
+    typename View_,
+    typename Metric_,
+    typename PointWrapper_,
+    typename Visitor_>
+class PrioritySearchNearestMetric {
+ public:
+  using IndexType = typename View_::IndexType;
+  using ScalarType = typename View_::ScalarType;
+  using NodeRefType = typename View_::NodeRefType;
 
-      // TODO The distance calculation can be cached. When SearchNeighbor is
-      // called it's calculated again.
-      if (visitor_.max() >
-          (metric_(query_.begin(), query_.end(), space_[m.first->index]) -
-           m.first->max_distance)) {
-        SearchNearest(m.first);
+  //! \brief An item of the priority queue.
+  struct ItemType {
+    //! \brief Lower bound distance of any descendant of the node.
+    ScalarType bound;
+    //! \brief Distance between the query and the point of the node.
+    ScalarType distance;
+    //! \brief The node.
+    NodeRefType node;
+  };
+
+  //! \brief Storage that can be reused between queries.
+  using ScratchType = std::vector<ItemType>;
+
+  PrioritySearchNearestMetric(
+      View_ view,
+      Metric_ metric,
+      PointWrapper_ query,
+      Visitor_& visitor,
+      ScratchType& scratch)
+      : view_(view),
+        metric_(metric),
+        query_(query),
+        visitor_(visitor),
+        queue_(scratch) {}
+
+  //! \brief Search nearest neighbors starting from the root node.
+  inline void operator()() const {
+    queue_.clear();
+    if (!view_.empty()) {
+      Push(view_.Root(), Distance(view_.Root()));
+    }
+
+    while (!queue_.empty()) {
+      std::pop_heap(queue_.begin(), queue_.end(), Greater);
+      ItemType const item = queue_.back();
+      queue_.pop_back();
+
+      // The search distance may have shrunk since the node was queued.
+      if (visitor_.max() <= item.bound) {
+        continue;
+      }
+
+      if (visitor_.max() > item.distance) {
+        visitor_(view_.Index(item.node), item.distance);
+        if (IsDone(visitor_)) {
+          break;
+        }
       }
+
+      view_.ForEachChild(item.node, [this](NodeRefType const c) {
+        ScalarType const d = Distance(c);
+        if (visitor_.max() > (d - view_.MaxDistance(c))) {
+          Push(c, d);
+        }
+      });
     }
   }
 
-  SpaceWrapper_ space_;
+ private:
+  static inline bool Greater(ItemType const& a, ItemType const& b) {
+    return a.distance > b.distance;
+  }
+
+  //! \brief Returns the distance between the query and the point of node \p n.
+  inline ScalarType Distance(NodeRefType const n) const {
+    return metric_(query_.begin(), query_.end(), view_.Point(n));
+  }
+
+  inline void Push(NodeRefType const n, ScalarType const d) const {
+    queue_.push_back(
+        {std::max(ScalarType(0), d - view_.MaxDistance(n)), d, n});
+    std::push_heap(queue_.begin(), queue_.end(), Greater);
+  }
+
+  View_ view_;
   Metric_ metric_;
   PointWrapper_ query_;
   Visitor_& visitor_;
+  ScratchType& queue_;
 };
 
 }  // namespace pico_tree::internal
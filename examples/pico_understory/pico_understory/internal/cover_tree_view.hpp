@@ -0,0 +1,84 @@
+#pragma once
+
+namespace pico_tree::internal {
+
+//! \brief Provides the search algorithms of the CoverTree with access to the
+//! breadth-first layout of a tree.
+//! \details Nodes are referred to by their position.
+template <typename CoverTreeData_>
+class CoverTreeFlatView {
+ public:
+  using IndexType = typename CoverTreeData_::IndexType;
+  using ScalarType = typename CoverTreeData_::ScalarType;
+  using NodeRefType = IndexType;
+
+  explicit CoverTreeFlatView(CoverTreeData_ const& data) : data_(data) {}
+
+  inline bool empty() const { return data_.nodes.empty(); }
+
+  inline NodeRefType Root() const { return CoverTreeData_::kRoot; }
+
+  //! \brief Returns the index of the point of node \p n.
+  inline IndexType Index(NodeRefType n) const { return data_.nodes[n].index; }
+
+  inline ScalarType MaxDistance(NodeRefType n) const {
+    return data_.nodes[n].max_distance;
+  }
+
+  //! \brief Returns the coordinates of the point of node \p n.
+  inline auto Point(NodeRefType n) const { return data_.points.data(n); }
+
+  //! \brief Calls \p f for each child of node \p n.
+  template <typename F>
+  inline void ForEachChild(NodeRefType n, F f) const {
+    auto const& node = data_.nodes[n];
+    for (IndexType c = node.children_begin; c < node.children_end; ++c) {
+      f(c);
+    }
+  }
+
+ private:
+  CoverTreeData_ const& data_;
+};
+
+//! \brief Provides the search algorithms of the CoverTree with access to a
+//! tree that supports the insertion and removal of points.
+//! \details Nodes are referred to by their address.
+template <typename CoverTreeDynamicData_, typename SpaceWrapper_>
+class CoverTreeDynamicView {
+ public:
+  using IndexType = typename CoverTreeDynamicData_::IndexType;
+  using ScalarType = typename CoverTreeDynamicData_::ScalarType;
+  using NodeRefType = typename CoverTreeDynamicData_::NodeType const*;
+
+  CoverTreeDynamicView(CoverTreeDynamicData_ const& data, SpaceWrapper_ space)
+      : data_(data), space_(space) {}
+
+  inline bool empty() const { return data_.root == nullptr; }
+
+  inline NodeRefType Root() const { return data_.root; }
+
+  //! \brief Returns the index of the point of node \p n.
+  inline IndexType Index(NodeRefType n) const { return n->index; }
+
+  inline ScalarType MaxDistance(NodeRefType n) const {
+    return n->max_distance;
+  }
+
+  //! \brief Returns the coordinates of the point of node \p n.
+  inline auto Point(NodeRefType n) const { return space_[n->index]; }
+
+  //! \brief Calls \p f for each child of node \p n.
+  template <typename F>
+  inline void ForEachChild(NodeRefType n, F f) const {
+    for (NodeRefType c : n->children) {
+      f(c);
+    }
+  }
+
+ private:
+  CoverTreeDynamicData_ const& data_;
+  SpaceWrapper_ space_;
+};
+
+}  // namespace pico_tree::internal
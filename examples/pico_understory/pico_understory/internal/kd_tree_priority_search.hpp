@@ -1,92 +1,165 @@
 #pragma once
 
-#include <queue>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
 #include <vector>
 
+#include "pico_tree/internal/epoch_bitset.hpp"
 #include "pico_tree/internal/kd_tree_node.hpp"
 #include "pico_tree/internal/point.hpp"
+#include "pico_tree/internal/search_visitor.hpp"
 #include "pico_tree/metric.hpp"
 
 namespace pico_tree::internal {
 
-//! \brief This class provides a search nearest function for Euclidean spaces.
-//! \details S. Arya and D. M. Mount, Algorithms for fast vector quantization,
-//! In IEEE Data Compression Conference, pp. 381–390, March 1993.
+//! \brief A single KdTree of a forest together with the space it indexes and
+//! the query point as seen by that tree.
+template <typename SpaceWrapper_, typename PointWrapper_, typename KdTreeData_>
+struct KdForestTreeView {
+  using SpaceWrapperType = SpaceWrapper_;
+  using PointWrapperType = PointWrapper_;
+  using KdTreeDataType = KdTreeData_;
+
+  SpaceWrapper_ space;
+  PointWrapper_ query;
+  KdTreeData_ const* tree;
+};
+
+//! \brief Provides a KdForestTreeView for each of the trees of a forest.
+//! \details The views are created when requested, such that a search doesn't
+//! have to store them.
+template <typename MakeView_>
+class KdForestTreeViews {
+ public:
+  using TreeViewType = std::invoke_result_t<MakeView_ const&, Size>;
+
+  inline KdForestTreeViews(Size size, MakeView_ make_view)
+      : size_(size), make_view_(make_view) {}
+
+  inline TreeViewType operator[](Size t) const { return make_view_(t); }
+
+  inline Size size() const { return size_; }
+
+ private:
+  Size size_;
+  MakeView_ make_view_;
+};
+
+//! \brief A branch of one of the trees of a forest that is yet to be searched.
+template <typename Node_>
+struct KdForestBranch {
+  using ScalarType = typename Node_::ScalarType;
+
+  inline bool operator>(KdForestBranch const& other) const {
+    return distance > other.distance;
+  }
+
+  ScalarType distance;
+  Node_ const* node;
+  Size tree;
+};
+
+//! \brief Scratch memory of the nearest neighbor searches of a KdForest.
+//! \details Reusing a context for many queries avoids allocating memory for
+//! each of them.
+template <typename Node_, Size Dim_>
+struct KdForestSearchContext {
+  using PointType = Point<typename Node_::ScalarType, Dim_>;
+
+  //! \brief Points visited by the current query.
+  EpochBitset visited;
+  //! \brief Storage of the priority queue of unexplored branches.
+  std::vector<KdForestBranch<Node_>> queue;
+  //! \brief The query as seen by each of the trees.
+  std::vector<PointType> queries;
+};
+
+//! \brief This class provides a search nearest function for a forest of
+//! KdTrees in Euclidean spaces.
+//! \details M. Muja and D. G. Lowe, Scalable Nearest Neighbor Algorithms for
+//! High Dimensional Data, In PAMI, pp. 2227-2240, Nov. 2014.
+//! https://www.cs.ubc.ca/research/flann/uploads/FLANN/flann_pami2014.pdf
+//! The search of each tree is based on the "Priorty k-d Tree Search" technique
+//! of: S. Arya and D. M. Mount, Algorithms for fast vector quantization, In
+//! IEEE Data Compression Conference, pp. 381–390, March 1993.
 //! https://www.cs.umd.edu/~mount/Papers/DCC.pdf
-//! This paper describes the "Priorty k-d Tree Search" technique to speed up
-//! nearest neighbor queries.
+//! Each tree of the forest is descended once, after which all trees share a
+//! single priority queue of unexplored branches and a single budget of leaves
+//! that may be visited. Points contained by more than a single tree are only
+//! visited once.
 template <
-    typename SpaceWrapper_,
+    typename TreeViews_,
     typename Metric_,
-    typename PointWrapper_,
     typename Visitor_,
     typename Index_>
-class PrioritySearchNearestEuclidean {
+class PrioritySearchNearestEuclideanForest {
  public:
   using IndexType = Index_;
-  using ScalarType = typename SpaceWrapper_::ScalarType;
-  using PointType = Point<ScalarType, SpaceWrapper_::Dim>;
-  //! \brief Node type supported by this PrioritySearchNearestEuclidean.
+  using TreeViewType = typename TreeViews_::TreeViewType;
+  using ScalarType = typename TreeViewType::SpaceWrapperType::ScalarType;
+  //! \brief Node type supported by this PrioritySearchNearestEuclideanForest.
   using NodeType = KdTreeNodeTopological<IndexType, ScalarType>;
-  using QueuePairType = std::pair<ScalarType, NodeType const*>;
+  using BranchType = KdForestBranch<NodeType>;
 
-  inline PrioritySearchNearestEuclidean(
-      SpaceWrapper_ space,
+  //! \brief Creates a search that uses \p queue as the storage of its
+  //! priority queue. Reusing the storage avoids memory allocations.
+  inline PrioritySearchNearestEuclideanForest(
+      TreeViews_ const& trees,
       Metric_ metric,
-      std::vector<IndexType> const& indices,
-      PointWrapper_ query,
       Size max_leaves_visited,
+      EpochBitset& visited,
+      std::vector<BranchType>& queue,
       Visitor_& visitor)
-      : space_(space),
+      : trees_(trees),
         metric_(metric),
-        indices_(indices),
-        query_(query),
         max_leaves_visited_(max_leaves_visited),
+        leaves_visited_(0),
+        visited_(visited),
+        queue_(queue),
         visitor_(visitor) {}
 
-  //! \brief Search nearest neighbors starting from \p root_node.
-  inline void operator()(NodeType const* const root_node) {
-    std::size_t leaves_visited = 0;
-    queue_.emplace(ScalarType(0.0), root_node);
+  //! \brief Search nearest neighbors starting from the root of each tree.
+  inline void operator()() {
+    leaves_visited_ = 0;
+    queue_.clear();
+
+    for (Size i = 0; i < trees_.size(); ++i) {
+      SearchNearest(i, trees_[i].tree->root_node, ScalarType(0.0));
+      if (IsDone(visitor_)) {
+        return;
+      }
+    }
+
     while (!queue_.empty()) {
-      auto const [node_box_distance, node] = queue_.top();
+      BranchType const item = queue_.front();
 
-      if (leaves_visited >= max_leaves_visited_ ||
-          visitor_.max() < node_box_distance) {
+      if (leaves_visited_ >= max_leaves_visited_ ||
+          visitor_.max() < item.distance || IsDone(visitor_)) {
         break;
       }
 
-      queue_.pop();
+      std::pop_heap(queue_.begin(), queue_.end(), std::greater<>());
+      queue_.pop_back();
 
-      SearchNearest(node, node_box_distance);
-      ++leaves_visited;
+      SearchNearest(item.tree, item.node, item.distance);
     }
   }
 
  private:
-  // Add nodes to the priority queue until a leaf node is reached.
+  // Descend tree t until a leaf node is reached. Any branches that are not
+  // taken are added to the priority queue.
   inline void SearchNearest(
-      NodeType const* const node, ScalarType node_box_distance) {
-    if (node->IsLeaf()) {
-      for (IndexType i = node->data.leaf.begin_idx; i < node->data.leaf.end_idx;
-           ++i) {
-        visitor_(
-            indices_[i],
-            metric_(query_.begin(), query_.end(), space_[indices_[i]]));
-      }
-    } else {
-      // Go left or right and then check if we should still go down the other
-      // side based on the current minimum distance.
-      ScalarType const v = query_[node->data.branch.split_dim];
+      Size const t, NodeType const* node, ScalarType node_box_distance) {
+    TreeViewType const view = trees_[t];
+
+    while (!node->IsLeaf()) {
+      ScalarType const v = view.query[node->data.branch.split_dim];
       ScalarType old_offset;
       ScalarType new_offset;
       NodeType const* node_1st;
       NodeType const* node_2nd;
 
-      // On equals we would possibly need to go left as well. However, this is
-      // handled by the if statement below this one: the check that max search
-      // radius still hits the split value after having traversed the first
-      // branch.
       // If left_max - v > 0, this means that the query is inside the left node,
       // if right_min - v < 0 it's inside the right one. For the area in between
       // we just pick the closest one by summing them.
@@ -97,47 +170,68 @@ class PrioritySearchNearestEuclidean {
         if (v > node->data.branch.left_min) {
           old_offset = ScalarType(0);
         } else {
-          old_offset = metric_(node->data.branch.left_min, v);
+          old_offset = SplitDistance(
+              metric_,
+              node->data.branch.left_min,
+              v,
+              node->data.branch.split_dim);
         }
-        new_offset = metric_(node->data.branch.right_min, v);
+        new_offset = SplitDistance(
+            metric_,
+            node->data.branch.right_min,
+            v,
+            node->data.branch.split_dim);
       } else {
         node_1st = node->right;
         node_2nd = node->left;
         if (v < node->data.branch.right_max) {
           old_offset = ScalarType(0);
         } else {
-          old_offset = metric_(node->data.branch.right_max, v);
+          old_offset = SplitDistance(
+              metric_,
+              node->data.branch.right_max,
+              v,
+              node->data.branch.split_dim);
         }
-        new_offset = metric_(node->data.branch.left_max, v);
+        new_offset = SplitDistance(
+            metric_,
+            node->data.branch.left_max,
+            v,
+            node->data.branch.split_dim);
       }
 
-      // The distance and offset for node_1st is the same as that of its parent.
-      SearchNearest(node_1st, node_box_distance);
+      ScalarType const node_2nd_box_distance =
+          node_box_distance - old_offset + new_offset;
 
-      // Calculate the distance to node_2nd.
-      // NOTE: This method only works with Lp norms to which the exponent is not
-      // applied.
-      node_box_distance = node_box_distance - old_offset + new_offset;
+      if (visitor_.max() > node_2nd_box_distance) {
+        queue_.push_back({node_2nd_box_distance, node_2nd, t});
+        std::push_heap(queue_.begin(), queue_.end(), std::greater<>());
+      }
 
-      // Add to priority queue to be searched later.
-      if (visitor_.max() > node_box_distance) {
-        queue_.emplace(node_box_distance, node_2nd);
+      node = node_1st;
+    }
+
+    ++leaves_visited_;
+
+    std::vector<IndexType> const& indices = view.tree->indices;
+    for (IndexType i = node->data.leaf.begin_idx; i < node->data.leaf.end_idx;
+         ++i) {
+      IndexType const idx = indices[i];
+      if (visited_.Insert(idx)) {
+        visitor_(
+            idx,
+            metric_(view.query.begin(), view.query.end(), view.space[idx]));
       }
     }
   }
 
-  SpaceWrapper_ space_;
+  TreeViews_ const& trees_;
   Metric_ metric_;
-  std::vector<IndexType> const& indices_;
-  PointWrapper_ query_;
   Size max_leaves_visited_;
-  // TODO This gets created every query. Solving this would require a different
-  // PicoTree interface. The queue probably shouldn't be too big.
-  std::priority_queue<
-      QueuePairType,
-      std::vector<QueuePairType>,
-      std::greater<QueuePairType>>
-      queue_;
+  Size leaves_visited_;
+  EpochBitset& visited_;
+  // A min-heap on the distance of each branch.
+  std::vector<BranchType>& queue_;
   Visitor_& visitor_;
 };
 
@@ -5,6 +5,9 @@
 
 namespace pico_tree::internal {
 
+//! \brief Builds a forest of randomized KdTrees. Each tree is build using a
+//! random Householder reflection of the input space. The reflections are
+//! determined by a seed.
 template <typename Node_, Size Dim_, SplittingRule SplittingRule_>
 class BuildRKdTree {
  public:
@@ -12,7 +15,10 @@ class BuildRKdTree {
 
   template <typename SpaceWrapper_>
   std::vector<RKdTreeDataType> operator()(
-      SpaceWrapper_ space, Size max_leaf_size, Size forest_size) {
+      SpaceWrapper_ space,
+      Size max_leaf_size,
+      Size forest_size,
+      std::mt19937::result_type seed) {
     assert(space.size() > 0);
     assert(max_leaf_size > 0);
     assert(forest_size > 0);
@@ -20,10 +26,11 @@ class BuildRKdTree {
     using SpaceWrapperType = typename RKdTreeDataType::SpaceWrapperType;
     using BuildKdTreeType = BuildKdTree<Node_, Dim_, SplittingRule_>;
 
+    std::mt19937 random_engine(seed);
     std::vector<RKdTreeDataType> trees;
     trees.reserve(forest_size);
     for (std::size_t i = 0; i < forest_size; ++i) {
-      auto r = RKdTreeDataType::RandomRotation(space);
+      auto r = RKdTreeDataType::RandomRotation(space, random_engine);
       auto s = RKdTreeDataType::RotateSpace(r, space);
       auto t = BuildKdTreeType()(SpaceWrapperType(s), max_leaf_size);
       trees.push_back({std::move(r), std::move(s), std::move(t)});
@@ -32,4 +39,36 @@ class BuildRKdTree {
   }
 };
 
+//! \brief Builds a forest of randomized KdTrees. The splitting rule randomizes
+//! each tree and all trees share the input space. Each tree is seeded by a
+//! random engine that is seeded with a single seed.
+template <typename Node_, Size Dim_>
+class BuildRKdTree<Node_, Dim_, SplittingRule::kRandomTopVariance> {
+ public:
+  using RKdTreeDataType = KdTreeData<Node_, Dim_>;
+
+  template <typename SpaceWrapper_>
+  std::vector<RKdTreeDataType> operator()(
+      SpaceWrapper_ space,
+      Size max_leaf_size,
+      Size forest_size,
+      std::mt19937::result_type seed) {
+    assert(space.size() > 0);
+    assert(max_leaf_size > 0);
+    assert(forest_size > 0);
+
+    using BuildKdTreeType =
+        BuildKdTree<Node_, Dim_, SplittingRule::kRandomTopVariance>;
+
+    std::mt19937 random_engine(seed);
+    std::vector<RKdTreeDataType> trees;
+    trees.reserve(forest_size);
+    for (std::size_t i = 0; i < forest_size; ++i) {
+      trees.push_back(
+          BuildKdTreeType()(space, max_leaf_size, random_engine()));
+    }
+    return trees;
+  }
+};
+
 }  // namespace pico_tree::internal
@@ -5,15 +5,14 @@
 #include "pico_tree/internal/kd_tree_data.hpp"
 #include "pico_tree/internal/point.hpp"
 #include "pico_tree/internal/space_wrapper.hpp"
+#include "pico_tree/internal/stream.hpp"
 #include "pico_understory/internal/matrix_space_traits.hpp"
 #include "point_traits.hpp"
 
 namespace pico_tree::internal {
 
 template <typename Scalar_, Size Dim_>
-inline Point<Scalar_, Dim_> RandomNormal(Size dim) {
-  std::random_device rd;
-  std::mt19937 e(rd());
+inline Point<Scalar_, Dim_> RandomNormal(Size dim, std::mt19937& e) {
   std::normal_distribution<Scalar_> gaussian(Scalar_(0), Scalar_(1));
 
   Point<Scalar_, Dim_> v = Point<Scalar_, Dim_>::FromSize(dim);
@@ -45,8 +44,9 @@ class RKdTreeHhData {
   using SpaceWrapperType = SpaceWrapper<SpaceType>;
 
   template <typename SpaceWrapper_>
-  static inline auto RandomRotation(SpaceWrapper_ space) {
-    return RandomNormal<ScalarType, Dim_>(space.sdim());
+  static inline auto RandomRotation(
+      SpaceWrapper_ space, std::mt19937& random_engine) {
+    return RandomNormal<ScalarType, Dim_>(space.sdim(), random_engine);
   }
 
   template <typename SpaceWrapper_>
@@ -63,6 +63,37 @@ class RKdTreeHhData {
     return s;
   }
 
+  //! \brief Loads the data of a single tree from \p stream.
+  //! \details When the rotated space was not stored, it is recomputed from
+  //! \p space using the stored rotation.
+  template <typename SpaceWrapper_>
+  static RKdTreeHhData Load(SpaceWrapper_ space, Stream& stream) {
+    RotationType rotation = RotationType::FromSize(space.sdim());
+    stream.Read(rotation.size(), rotation.data());
+
+    bool has_space;
+    stream.Read(has_space);
+    SpaceType s = has_space ? ReadSpace(space, stream)
+                            : RotateSpace(rotation, space);
+
+    auto tree = KdTreeData<Node_, Dim_>::Load(stream);
+    return {std::move(rotation), std::move(s), std::move(tree)};
+  }
+
+  //! \brief Saves the data of a single tree to \p stream.
+  //! \details The rotation and rotated space are written as contiguous blocks.
+  //! Not storing the rotated space reduces the file size by a copy of the input
+  //! space at the cost of having to rotate it again when loading.
+  static void Save(
+      RKdTreeHhData const& data, Stream& stream, bool save_space) {
+    stream.Write(data.rotation.data(), data.rotation.size());
+    stream.Write(save_space);
+    if (save_space) {
+      stream.Write(data.space.data(), data.space.size() * data.space.sdim());
+    }
+    KdTreeData<Node_, Dim_>::Save(data.tree, stream);
+  }
+
   template <typename ArrayType_>
   Point<ScalarType, Dim_> RotatePoint(ArrayType_ const& x) const {
     Point<ScalarType, Dim_> y = Point<ScalarType, Dim_>::FromSize(space.sdim());
@@ -70,11 +101,26 @@ class RKdTreeHhData {
     return y;
   }
 
+  //! \brief Stores the rotation of \p x in \p y, which should have the same
+  //! spatial dimension as the space.
+  template <typename ArrayType_>
+  void RotatePoint(ArrayType_ const& x, Point<ScalarType, Dim_>& y) const {
+    RotatePoint(rotation, x, y);
+  }
+
   RotationType rotation;
   SpaceType space;
   KdTreeData<Node_, Dim_> tree;
 
  private:
+  //! \brief Reads a rotated space that has the same dimensions as \p space.
+  template <typename SpaceWrapper_>
+  static SpaceType ReadSpace(SpaceWrapper_ space, Stream& stream) {
+    SpaceType s(space.size(), space.sdim());
+    stream.Read(s.size() * s.sdim(), s.data());
+    return s;
+  }
+
   // In and out can be the same point.
   // https://en.wikipedia.org/wiki/Householder_transformation
   template <typename ArrayTypeIn_, typename ArrayTypeOut_>
@@ -1,14 +1,29 @@
 #pragma once
 
+#include <random>
+#include <type_traits>
+
 #include "pico_tree/internal/point_wrapper.hpp"
 #include "pico_tree/internal/search_visitor.hpp"
 #include "pico_tree/internal/space_wrapper.hpp"
 #include "pico_tree/metric.hpp"
 #include "pico_understory/internal/kd_tree_priority_search.hpp"
+#include "pico_understory/internal/point_traits.hpp"
 #include "pico_understory/internal/rkd_tree_builder.hpp"
 
 namespace pico_tree {
 
+//! \brief A KdForest is a collection of randomized KdTrees that are searched
+//! simultaneously to answer approximate nearest neighbor queries.
+//! \details By default, each tree is build using a random Householder
+//! reflection of the space. When the SplittingRule_ equals
+//! SplittingRule::kRandomTopVariance, the trees are randomized by the splitting
+//! rule instead. All trees then share the input space and queries don't have to
+//! be rotated.
+//! \tparam Space_ Type of space.
+//! \tparam Metric_ Type of metric. Determines how distances are measured.
+//! \tparam SplittingRule_ The rule that determines how space is partitioned.
+//! \tparam Index_ Type of index.
 template <
     typename Space_,
     typename Metric_ = L2Squared,
@@ -38,12 +53,23 @@ class KdForest {
   using MetricType = Metric_;
   //! \brief Neighbor type of various search resuls.
   using NeighborType = Neighbor<IndexType, ScalarType>;
+  //! \brief Scratch memory that can be reused by the searches of the KdForest.
+  using SearchContextType = internal::KdForestSearchContext<NodeType, Dim>;
 
-  KdForest(SpaceType space, SizeType max_leaf_size, SizeType forest_size)
+  //! \brief Builds \p forest_size randomized trees of which the random
+  //! choices are determined by \p seed.
+  //! \details Building a forest with the same arguments always results in the
+  //! same trees. Pass a seed such as std::random_device()() for forests that
+  //! differ per run.
+  KdForest(
+      SpaceType space,
+      SizeType max_leaf_size,
+      SizeType forest_size,
+      std::mt19937::result_type seed = std::mt19937::default_seed)
       : space_(std::move(space)),
         metric_(),
         data_(BuildRKdTreeType()(
-            SpaceWrapperType(space_), max_leaf_size, forest_size)) {}
+            SpaceWrapperType(space_), max_leaf_size, forest_size, seed)) {}
 
   //! \brief The KdForest cannot be copied.
   //! \details The KdForest uses pointers to nodes and copying pointers is not
@@ -61,11 +87,33 @@ class KdForest {
 
   //! \brief Returns the nearest neighbor (or neighbors) of point \p x depending
   //! on their selection by visitor \p visitor .
+  //! \details All trees of the forest share a single priority queue and the
+  //! total number of leaves visited is at most \p max_leaves_visited. The
+  //! scratch memory of the search is reused by all queries of the current
+  //! thread. A visitor should therefore not start another search with a forest
+  //! of the same type.
   template <typename P, typename V>
   inline void SearchNearest(
       P const& x, SizeType max_leaves_visited, V& visitor) const {
+    SearchNearest(x, max_leaves_visited, visitor, ThreadSearchContext());
+  }
+
+  //! \brief Returns the nearest neighbor (or neighbors) of point \p x depending
+  //! on their selection by visitor \p visitor . The search uses the scratch
+  //! memory of \p context .
+  template <typename P, typename V>
+  inline void SearchNearest(
+      P const& x,
+      SizeType max_leaves_visited,
+      V& visitor,
+      SearchContextType& context) const {
     internal::PointWrapper<P> p(x);
-    SearchNearest(p, max_leaves_visited, visitor, typename Metric_::SpaceTag());
+    SearchNearest(
+        p,
+        max_leaves_visited,
+        visitor,
+        context,
+        typename Metric_::SpaceTag());
   }
 
   //! \brief Searches for the nearest neighbor of point \p x.
@@ -74,11 +122,282 @@ class KdForest {
   template <typename P>
   inline void SearchNn(
       P const& x, SizeType max_leaves_visited, NeighborType& nn) const {
+    SearchNn(x, max_leaves_visited, nn, ThreadSearchContext());
+  }
+
+  //! \brief Searches for the nearest neighbor of point \p x using the scratch
+  //! memory of \p context .
+  template <typename P>
+  inline void SearchNn(
+      P const& x,
+      SizeType max_leaves_visited,
+      NeighborType& nn,
+      SearchContextType& context) const {
     internal::SearchNn<NeighborType> v(nn);
-    SearchNearest(x, max_leaves_visited, v);
+    SearchNearest(x, max_leaves_visited, v, context);
+  }
+
+  //! \brief Searches for the k approximate nearest neighbors of point \p x,
+  //! where k equals std::distance(begin, end). It is expected that the value
+  //! type of the iterator equals Neighbor<IndexType, ScalarType>.
+  //! \details A point contained by multiple trees of the forest is reported at
+  //! most once. Interpretation of the output distances depend on the Metric.
+  //! The default L2Squared results in squared distances. Large values of k use
+  //! a bounded max-heap to maintain the neighbors.
+  //! \tparam P Point type.
+  //! \tparam RandomAccessIterator Iterator type.
+  template <typename P, typename RandomAccessIterator>
+  inline void SearchKnn(
+      P const& x,
+      SizeType max_leaves_visited,
+      RandomAccessIterator begin,
+      RandomAccessIterator end) const {
+    SearchKnn(x, max_leaves_visited, begin, end, ThreadSearchContext());
+  }
+
+  //! \brief Searches for the k approximate nearest neighbors of point \p x
+  //! using the scratch memory of \p context .
+  //! \see template <typename P, typename RandomAccessIterator> void SearchKnn(P
+  //! const&, SizeType, RandomAccessIterator, RandomAccessIterator) const
+  template <typename P, typename RandomAccessIterator>
+  inline void SearchKnn(
+      P const& x,
+      SizeType max_leaves_visited,
+      RandomAccessIterator begin,
+      RandomAccessIterator end,
+      SearchContextType& context) const {
+    static_assert(
+        std::is_same_v<
+            typename std::iterator_traits<RandomAccessIterator>::value_type,
+            NeighborType>,
+        "ITERATOR_VALUE_TYPE_DOES_NOT_EQUAL_NEIGHBOR_TYPE");
+
+    if (static_cast<SizeType>(std::distance(begin, end)) <
+        internal::kSearchKnnHeapMinK) {
+      internal::SearchKnn<RandomAccessIterator> v(begin, end);
+      SearchNearest(x, max_leaves_visited, v, context);
+    } else {
+      internal::SearchKnnHeap<RandomAccessIterator> v(begin, end);
+      SearchNearest(x, max_leaves_visited, v, context);
+      v.Sort();
+    }
+  }
+
+  //! \brief Searches for the \p k approximate nearest neighbors of point \p x
+  //! and stores the results in output vector \p knn.
+  //! \tparam P Point type.
+  //! \see template <typename P, typename RandomAccessIterator> void SearchKnn(P
+  //! const&, SizeType, RandomAccessIterator, RandomAccessIterator) const
+  template <typename P>
+  inline void SearchKnn(
+      P const& x,
+      SizeType const k,
+      SizeType max_leaves_visited,
+      std::vector<NeighborType>& knn) const {
+    SearchKnn(x, k, max_leaves_visited, knn, ThreadSearchContext());
+  }
+
+  //! \brief Searches for the \p k approximate nearest neighbors of point \p x
+  //! and stores the results in output vector \p knn. The search uses the
+  //! scratch memory of \p context .
+  template <typename P>
+  inline void SearchKnn(
+      P const& x,
+      SizeType const k,
+      SizeType max_leaves_visited,
+      std::vector<NeighborType>& knn,
+      SearchContextType& context) const {
+    // If it happens that the point set has less points than k we just return
+    // all points in the set.
+    // Less than k points may be visited within the leaf budget. Unused
+    // neighbors keep their maximum distance and are removed afterwards.
+    knn.assign(
+        std::min(k, SpaceWrapperType(space_).size()),
+        NeighborType{IndexType(0), std::numeric_limits<ScalarType>::max()});
+    SearchKnn(x, max_leaves_visited, knn.begin(), knn.end(), context);
+    knn.erase(
+        std::find_if(
+            knn.begin(),
+            knn.end(),
+            [](NeighborType const& n) {
+              return n.distance == std::numeric_limits<ScalarType>::max();
+            }),
+        knn.end());
+  }
+
+  //! \brief Searches for the approximate neighbors of point \p x that are
+  //! within radius \p radius and stores the results in output vector \p n.
+  //! \details A point contained by multiple trees of the forest is reported at
+  //! most once. Interpretation of the in and output distances depend on the
+  //! Metric. The default L2Squared results in squared distances.
+  //! \tparam P Point type.
+  //! \param x Input point.
+  //! \param radius Search radius.
+  //! \param max_leaves_visited Total number of leaves visited by the search.
+  //! \param n Output points.
+  //! \param sort If true, the result set is sorted from closest to farthest
+  //! distance with respect to the query point.
+  template <typename P>
+  inline void SearchRadius(
+      P const& x,
+      ScalarType const radius,
+      SizeType max_leaves_visited,
+      std::vector<NeighborType>& n,
+      bool const sort = false) const {
+    SearchRadius(x, radius, max_leaves_visited, n, sort, ThreadSearchContext());
+  }
+
+  //! \brief Searches for the approximate neighbors of point \p x that are
+  //! within radius \p radius and stores the results in output vector \p n. The
+  //! search uses the scratch memory of \p context .
+  template <typename P>
+  inline void SearchRadius(
+      P const& x,
+      ScalarType const radius,
+      SizeType max_leaves_visited,
+      std::vector<NeighborType>& n,
+      bool const sort,
+      SearchContextType& context) const {
+    internal::SearchRadius<NeighborType> v(radius, n);
+    SearchNearest(x, max_leaves_visited, v, context);
+
+    if (sort) {
+      v.Sort();
+    }
+  }
+
+  //! \brief Point set used by the forest.
+  inline SpaceType const& points() const { return space_; }
+
+  //! \brief Metric used for search queries.
+  inline MetricType const& metric() const { return metric_; }
+
+  //! \brief Returns the number of bytes used by the forest.
+  //! \details The count includes the nodes and indices of each tree and any
+  //! rotated copies of the space. The input space is not included.
+  inline SizeType MemoryUsage() const {
+    SizeType bytes = 0;
+    for (auto const& data : data_) {
+      bytes += MemoryUsage(data);
+    }
+    return bytes;
+  }
+
+  //! \brief Loads the forest in binary from file.
+  static KdForest Load(SpaceType points, std::string const& filename) {
+    std::fstream stream =
+        internal::OpenStream(filename, std::ios::in | std::ios::binary);
+    return Load(std::move(points), stream);
+  }
+
+  //! \brief Loads the forest in binary from \p stream .
+  //! \details This is considered a convinience function to be able to save and
+  //! load a KdForest on a single machine.
+  //! \li Does not take memory endianness into account.
+  //! \li Does not check if the stored forest is valid for the given point set.
+  //! \li Does not check if the stored forest is valid for the given template
+  //! arguments.
+  //! \li Rotated spaces that were not stored are recomputed from \p points.
+  static KdForest Load(SpaceType points, std::iostream& stream) {
+    internal::Stream s(stream);
+    return KdForest(std::move(points), s);
+  }
+
+  //! \brief Saves the forest in binary to file.
+  static void Save(
+      KdForest const& forest,
+      std::string const& filename,
+      bool save_rotated_spaces = true) {
+    std::fstream stream =
+        internal::OpenStream(filename, std::ios::out | std::ios::binary);
+    Save(forest, stream, save_rotated_spaces);
+  }
+
+  //! \brief Saves the forest in binary to \p stream .
+  //! \details This is considered a convinience function to be able to save and
+  //! load a KdForest on a single machine.
+  //! \li Does not take memory endianness into account.
+  //! \li Stores the rotation and tree structure of each tree but not the
+  //! points.
+  //! \li The randomly rotated copy of the space of each tree is only stored
+  //! when \p save_rotated_spaces is true. Storing them avoids rotating the
+  //! space during loading at the cost of storing forest_size copies of it.
+  static void Save(
+      KdForest const& forest,
+      std::iostream& stream,
+      bool save_rotated_spaces = true) {
+    internal::Stream s(stream);
+    s.Write(forest.data_.size());
+    for (auto const& data : forest.data_) {
+      if constexpr (kSharesSpace) {
+        RKdTreeDataType::Save(data, s);
+      } else {
+        RKdTreeDataType::Save(data, s, save_rotated_spaces);
+      }
+    }
   }
 
  private:
+  //! \brief Returns the scratch memory that is reused by all searches of the
+  //! current thread.
+  static inline SearchContextType& ThreadSearchContext() {
+    static thread_local SearchContextType context;
+    return context;
+  }
+
+  //! \brief True when all trees index the input space directly.
+  static bool constexpr kSharesSpace =
+      std::is_same_v<RKdTreeDataType, internal::KdTreeData<NodeType, Dim>>;
+
+  //! \brief Constructs a KdForest by reading its trees from a Stream.
+  KdForest(SpaceType space, internal::Stream& stream)
+      : space_(std::move(space)),
+        metric_(),
+        data_(LoadData(SpaceWrapperType(space_), stream)) {}
+
+  //! \brief Reads the data of all trees from \p stream.
+  static std::vector<RKdTreeDataType> LoadData(
+      SpaceWrapperType space, internal::Stream& stream) {
+    typename std::vector<RKdTreeDataType>::size_type forest_size;
+    stream.Read(forest_size);
+
+    std::vector<RKdTreeDataType> data;
+    data.reserve(forest_size);
+    for (std::size_t i = 0; i < forest_size; ++i) {
+      if constexpr (kSharesSpace) {
+        data.push_back(RKdTreeDataType::Load(stream));
+      } else {
+        data.push_back(RKdTreeDataType::Load(space, stream));
+      }
+    }
+    return data;
+  }
+
+  //! \brief Returns the number of nodes of the subtree rooted at \p node.
+  static inline SizeType CountNodes(NodeType const* const node) {
+    if (node->IsLeaf()) {
+      return 1;
+    }
+    return 1 + CountNodes(node->left) + CountNodes(node->right);
+  }
+
+  //! \brief Returns the number of bytes used by a single tree.
+  static inline SizeType MemoryUsage(
+      internal::KdTreeData<NodeType, Dim> const& tree) {
+    return tree.indices.size() * sizeof(IndexType) +
+           CountNodes(tree.root_node) * sizeof(NodeType) +
+           tree.root_box.size() * 2 * sizeof(ScalarType);
+  }
+
+  //! \brief Returns the number of bytes used by a single tree and its rotated
+  //! copy of the space.
+  static inline SizeType MemoryUsage(
+      internal::RKdTreeHhData<NodeType, Dim> const& data) {
+    return MemoryUsage(data.tree) +
+           data.rotation.size() * sizeof(ScalarType) +
+           data.space.size() * data.space.sdim() * sizeof(ScalarType);
+  }
+
   //! \brief Returns the nearest neighbor (or neighbors) of point \p x depending
   //! on their selection by visitor \p visitor for node \p node.
   template <typename PointWrapper_, typename Visitor_>
@@ -86,26 +405,90 @@ class KdForest {
       PointWrapper_ point,
       SizeType max_leaves_visited,
       Visitor_& visitor,
+      SearchContextType& context,
       EuclideanSpaceTag) const {
-    // Range based for loop (rightfully) results in a warning that shouldn't be
-    // needed if the user creates the forest with at least a single tree.
-    for (std::size_t i = 0; i < data_.size(); ++i) {
-      auto p = data_[i].RotatePoint(point);
-      using PointWrapperType = internal::PointWrapper<decltype(p)>;
-      PointWrapperType point_wrapper(p);
-      internal::PrioritySearchNearestEuclidean<
-          typename RKdTreeDataType::SpaceWrapperType,
-          Metric_,
-          PointWrapperType,
-          Visitor_,
-          IndexType>(
-          typename RKdTreeDataType::SpaceWrapperType(data_[i].space),
-          metric_,
-          data_[i].tree.indices,
-          point_wrapper,
-          max_leaves_visited,
-          visitor)(data_[i].tree.root_node);
+    // The visited set only gets cleared lazily.
+    context.visited.Clear(SpaceWrapperType(space_).size());
+
+    SearchNearest(point, max_leaves_visited, visitor, context, data_);
+  }
+
+  //! \brief Searches the trees that each index a randomly rotated copy of the
+  //! space. The query point is rotated for each tree.
+  template <typename PointWrapper_, typename Visitor_>
+  inline void SearchNearest(
+      PointWrapper_ point,
+      SizeType max_leaves_visited,
+      Visitor_& visitor,
+      SearchContextType& context,
+      std::vector<internal::RKdTreeHhData<NodeType, Dim>> const& data) const {
+    using PointType = typename SearchContextType::PointType;
+    using HhDataType = internal::RKdTreeHhData<NodeType, Dim>;
+    using TreeViewType = internal::KdForestTreeView<
+        typename HhDataType::SpaceWrapperType,
+        internal::PointWrapper<PointType>,
+        internal::KdTreeData<NodeType, Dim>>;
+
+    // The rotated queries are only reallocated when the forest changes.
+    std::vector<PointType>& queries = context.queries;
+    Size const sdim = SpaceWrapperType(space_).sdim();
+    queries.resize(data.size());
+    for (std::size_t i = 0; i < data.size(); ++i) {
+      if (queries[i].size() != sdim) {
+        queries[i] = PointType::FromSize(sdim);
+      }
+      data[i].RotatePoint(point, queries[i]);
     }
+
+    internal::KdForestTreeViews trees(data.size(), [&](Size i) {
+      return TreeViewType{
+          typename HhDataType::SpaceWrapperType(data[i].space),
+          internal::PointWrapper<PointType>(queries[i]),
+          &data[i].tree};
+    });
+
+    internal::PrioritySearchNearestEuclideanForest<
+        decltype(trees),
+        Metric_,
+        Visitor_,
+        IndexType>(
+        trees,
+        metric_,
+        max_leaves_visited,
+        context.visited,
+        context.queue,
+        visitor)();
+  }
+
+  //! \brief Searches the trees that all index the original space. The query
+  //! point is used as is.
+  template <typename PointWrapper_, typename Visitor_>
+  inline void SearchNearest(
+      PointWrapper_ point,
+      SizeType max_leaves_visited,
+      Visitor_& visitor,
+      SearchContextType& context,
+      std::vector<internal::KdTreeData<NodeType, Dim>> const& data) const {
+    using TreeViewType = internal::KdForestTreeView<
+        SpaceWrapperType,
+        PointWrapper_,
+        internal::KdTreeData<NodeType, Dim>>;
+
+    internal::KdForestTreeViews trees(data.size(), [&](Size i) {
+      return TreeViewType{SpaceWrapperType(space_), point, &data[i]};
+    });
+
+    internal::PrioritySearchNearestEuclideanForest<
+        decltype(trees),
+        Metric_,
+        Visitor_,
+        IndexType>(
+        trees,
+        metric_,
+        max_leaves_visited,
+        context.visited,
+        context.queue,
+        visitor)();
   }
 
   //! \brief Point set used for querying point data.
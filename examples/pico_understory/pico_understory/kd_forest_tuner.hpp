@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+#include "pico_tree/kd_tree.hpp"
+#include "pico_understory/kd_forest.hpp"
+
+namespace pico_tree {
+
+//! \brief The construction and query parameters of a KdForest.
+struct KdForestParameters {
+  //! \brief Number of trees in the forest.
+  Size forest_size;
+  //! \brief Maximum number of points allowed in a leaf node.
+  Size max_leaf_size;
+  //! \brief Total number of leaves that may be visited by a query.
+  Size max_leaves_visited;
+};
+
+//! \brief The performance of a KdForest measured for a set of parameters.
+struct KdForestMeasurement {
+  //! \brief Parameters of the measured forest.
+  KdForestParameters parameters;
+  //! \brief The recall@k: the fraction of the true k nearest neighbors found.
+  double recall;
+  //! \brief Average duration of a single query in seconds.
+  double query_time;
+  //! \brief Number of bytes used by the forest.
+  //! \see KdForest::MemoryUsage()
+  Size memory;
+};
+
+//! \brief The cost that is minimized when tuning a KdForest.
+enum class KdForestObjective {
+  //! \brief Minimize the average query time.
+  kQueryTime,
+  //! \brief Minimize the memory used by the forest.
+  kMemory
+};
+
+//! \brief The candidate values of each of the KdForest parameters. All of
+//! their combinations are measured.
+struct KdForestTuningGrid {
+  std::vector<Size> forest_sizes{1, 2, 4, 8, 16};
+  std::vector<Size> max_leaf_sizes{8, 16, 32};
+  std::vector<Size> max_leaves_visited{16, 32, 64, 128, 256, 512};
+};
+
+//! \brief The result of tuning a KdForest.
+struct KdForestTuning {
+  //! \brief All measurements in the order in which they were taken.
+  std::vector<KdForestMeasurement> measurements;
+  //! \brief The measurements for which no other measurement has both a lower
+  //! cost and a higher recall. Sorted by increasing cost and recall.
+  std::vector<KdForestMeasurement> pareto_front;
+  //! \brief The measurement with the lowest cost that meets the target recall.
+  //! It is empty if none of the measurements meets the target.
+  std::optional<KdForestMeasurement> best;
+};
+
+namespace internal {
+
+//! \brief Returns the cost of measurement \p m given objective \p objective.
+inline double KdForestCost(
+    KdForestMeasurement const& m, KdForestObjective objective) {
+  return objective == KdForestObjective::kQueryTime
+             ? m.query_time
+             : static_cast<double>(m.memory);
+}
+
+//! \brief Returns the Pareto front of \p measurements with respect to the
+//! recall and cost.
+inline std::vector<KdForestMeasurement> KdForestParetoFront(
+    std::vector<KdForestMeasurement> measurements,
+    KdForestObjective objective) {
+  // Sorted by increasing cost. Equal costs are sorted by decreasing recall such
+  // that only the first of them can be part of the front.
+  std::sort(
+      measurements.begin(),
+      measurements.end(),
+      [objective](
+          KdForestMeasurement const& a, KdForestMeasurement const& b) {
+        double const ca = KdForestCost(a, objective);
+        double const cb = KdForestCost(b, objective);
+        return std::tie(ca, b.recall) < std::tie(cb, a.recall);
+      });
+
+  std::vector<KdForestMeasurement> front;
+  for (auto const& m : measurements) {
+    if (front.empty() || m.recall > front.back().recall) {
+      front.push_back(m);
+    }
+  }
+  return front;
+}
+
+}  // namespace internal
+
+//! \brief Searches for the KdForest parameters that meet a target recall at
+//! the lowest cost.
+//! \details The exact k nearest neighbors of each query are obtained using a
+//! KdTree. A KdForest is then built for each combination of forest size and
+//! leaf size of \p grid and its query time, recall@k and memory usage are
+//! measured for each of the leaf budgets of \p grid. The query time is
+//! measured as wall time on the calling thread. Tuning is most accurate when
+//! \p queries is a representative sample of the actual queries.
+//! \tparam Metric_ Type of metric of the forest.
+//! \tparam SplittingRule_ Splitting rule of the forest.
+//! \tparam Index_ Type of index of the forest.
+//! \param space The input point set. It is not copied.
+//! \param queries The query points.
+//! \param k The number of nearest neighbors searched for per query.
+//! \param target_recall Minimum recall@k of the best measurement.
+//! \param grid The candidate parameters.
+//! \param objective The cost that is minimized.
+template <
+    typename Metric_ = L2Squared,
+    SplittingRule SplittingRule_ = SplittingRule::kSlidingMidpoint,
+    typename Index_ = int,
+    typename Space_,
+    typename QuerySpace_>
+KdForestTuning TuneKdForest(
+    Space_ const& space,
+    QuerySpace_ const& queries,
+    Size k,
+    double target_recall,
+    KdForestTuningGrid const& grid = KdForestTuningGrid(),
+    KdForestObjective objective = KdForestObjective::kQueryTime) {
+  using SpaceType = std::reference_wrapper<Space_ const>;
+  using QuerySpaceTraitsType = SpaceTraits<QuerySpace_>;
+  using KdTreeType = KdTree<SpaceType, Metric_, SplittingRule_, Index_>;
+  using KdForestType = KdForest<SpaceType, Metric_, SplittingRule_, Index_>;
+  using NeighborType = typename KdForestType::NeighborType;
+  using ClockType = std::chrono::steady_clock;
+
+  Size const query_count = QuerySpaceTraitsType::size(queries);
+  k = std::min(k, internal::SpaceWrapper<Space_>(space).size());
+
+  // The maximum leaf size of 10 is a reasonable default for exact searches.
+  std::vector<NeighborType> knns_gt(query_count * k);
+  {
+    KdTreeType tree(space, 10);
+    for (Size i = 0; i < query_count; ++i) {
+      auto begin = knns_gt.begin() + i * k;
+      tree.SearchKnn(
+          QuerySpaceTraitsType::PointAt(queries, i), begin, begin + k);
+    }
+  }
+
+  KdForestTuning tuning;
+  std::vector<std::vector<NeighborType>> knns(query_count);
+
+  for (Size forest_size : grid.forest_sizes) {
+    for (Size max_leaf_size : grid.max_leaf_sizes) {
+      KdForestType forest(space, max_leaf_size, forest_size);
+      Size const memory = forest.MemoryUsage();
+
+      for (Size max_leaves_visited : grid.max_leaves_visited) {
+        auto const start = ClockType::now();
+        for (Size i = 0; i < query_count; ++i) {
+          forest.SearchKnn(
+              QuerySpaceTraitsType::PointAt(queries, i),
+              k,
+              max_leaves_visited,
+              knns[i]);
+        }
+        std::chrono::duration<double> const elapsed =
+            ClockType::now() - start;
+
+        Size found = 0;
+        for (Size i = 0; i < query_count; ++i) {
+          auto begin = knns_gt.begin() + i * k;
+          auto end = begin + k;
+          for (auto const& n : knns[i]) {
+            if (std::find_if(begin, end, [&n](NeighborType const& m) {
+                  return m.index == n.index;
+                }) != end) {
+              ++found;
+            }
+          }
+        }
+
+        Size const total = query_count * k;
+        tuning.measurements.push_back(
+            {{forest_size, max_leaf_size, max_leaves_visited},
+             total > 0 ? static_cast<double>(found) / static_cast<double>(total)
+                       : 1.0,
+             query_count > 0
+                 ? elapsed.count() / static_cast<double>(query_count)
+                 : 0.0,
+             memory});
+      }
+    }
+  }
+
+  tuning.pareto_front =
+      internal::KdForestParetoFront(tuning.measurements, objective);
+
+  auto it = std::find_if(
+      tuning.pareto_front.begin(),
+      tuning.pareto_front.end(),
+      [target_recall](KdForestMeasurement const& m) {
+        return m.recall >= target_recall;
+      });
+  if (it != tuning.pareto_front.end()) {
+    tuning.best = *it;
+  }
+
+  return tuning;
+}
+
+}  // namespace pico_tree
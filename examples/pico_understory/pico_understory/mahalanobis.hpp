@@ -0,0 +1,227 @@
+#pragma once
+
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "pico_tree/internal/point.hpp"
+#include "pico_tree/internal/point_wrapper.hpp"
+#include "pico_tree/internal/space_wrapper.hpp"
+#include "pico_tree/metric.hpp"
+#include "pico_understory/internal/matrix_space_traits.hpp"
+#include "pico_understory/internal/point_traits.hpp"
+
+namespace pico_tree {
+
+namespace internal {
+
+//! \brief Returns the lower triangular matrix L of the Cholesky decomposition
+//! A = L * L^T of the symmetric positive definite matrix \p a.
+//! \details Both matrices are stored in row-major order and have \p sdim rows
+//! and columns. Throws an std::invalid_argument in case \p a is not positive
+//! definite.
+template <typename Scalar_>
+std::vector<Scalar_> CholeskyFactor(std::vector<Scalar_> const& a, Size sdim) {
+  if (a.size() != sdim * sdim) {
+    throw std::invalid_argument("Matrix should have sdim * sdim elements.");
+  }
+
+  std::vector<Scalar_> l(sdim * sdim, Scalar_(0));
+  for (Size j = 0; j < sdim; ++j) {
+    Scalar_ d = a[j * sdim + j];
+    for (Size k = 0; k < j; ++k) {
+      d -= l[j * sdim + k] * l[j * sdim + k];
+    }
+    if (!(d > Scalar_(0))) {
+      throw std::invalid_argument("Matrix is not positive definite.");
+    }
+    l[j * sdim + j] = std::sqrt(d);
+
+    for (Size i = j + 1; i < sdim; ++i) {
+      Scalar_ s = a[i * sdim + j];
+      for (Size k = 0; k < j; ++k) {
+        s -= l[i * sdim + k] * l[j * sdim + k];
+      }
+      l[i * sdim + j] = s / l[j * sdim + j];
+    }
+  }
+  return l;
+}
+
+//! \brief Solves L * y = x for \p y, where \p l is a lower triangular matrix
+//! with \p sdim rows and columns that is stored in row-major order.
+template <typename Scalar_, typename InputIterator_, typename OutputIterator_>
+inline void ForwardSubstitute(
+    std::vector<Scalar_> const& l,
+    Size sdim,
+    InputIterator_ x,
+    OutputIterator_ y) {
+  for (Size i = 0; i < sdim; ++i) {
+    Scalar_ s = static_cast<Scalar_>(x[i]);
+    for (Size k = 0; k < i; ++k) {
+      s -= l[i * sdim + k] * y[k];
+    }
+    y[i] = s / l[i * sdim + i];
+  }
+}
+
+}  // namespace internal
+
+//! \brief Returns the sample covariance matrix of the points of \p space. The
+//! matrix is stored in row-major order.
+template <typename Space_>
+std::vector<typename internal::SpaceWrapper<Space_>::ScalarType>
+EstimateCovariance(Space_ const& space) {
+  using ScalarType = typename internal::SpaceWrapper<Space_>::ScalarType;
+
+  internal::SpaceWrapper<Space_> s(space);
+  Size const sdim = s.sdim();
+  Size const n = s.size();
+
+  std::vector<ScalarType> mean(sdim, ScalarType(0));
+  for (Size i = 0; i < n; ++i) {
+    for (Size j = 0; j < sdim; ++j) {
+      mean[j] += s[i][j];
+    }
+  }
+  for (auto& m : mean) {
+    m /= static_cast<ScalarType>(n);
+  }
+
+  std::vector<ScalarType> covariance(sdim * sdim, ScalarType(0));
+  for (Size i = 0; i < n; ++i) {
+    for (Size r = 0; r < sdim; ++r) {
+      for (Size c = 0; c <= r; ++c) {
+        covariance[r * sdim + c] += (s[i][r] - mean[r]) * (s[i][c] - mean[c]);
+      }
+    }
+  }
+
+  ScalarType const scale = ScalarType(1) / static_cast<ScalarType>(n - 1);
+  for (Size r = 0; r < sdim; ++r) {
+    for (Size c = 0; c <= r; ++c) {
+      covariance[r * sdim + c] *= scale;
+      covariance[c * sdim + r] = covariance[r * sdim + c];
+    }
+  }
+  return covariance;
+}
+
+//! \brief Type of the whitened copy of a space of type Space_ that is indexed
+//! by a MahalanobisSearch.
+template <typename Space_>
+using MahalanobisSpaceType = internal::MatrixSpace<
+    typename internal::SpaceWrapper<Space_>::ScalarType,
+    internal::SpaceWrapper<Space_>::Dim>;
+
+//! \brief Searches for the nearest neighbors of a query using the squared
+//! Mahalanobis distance: (x - y)^T * S^-1 * (x - y), where S is a covariance
+//! matrix.
+//! \details With the Cholesky decomposition S = L * L^T, the squared
+//! Mahalanobis distance equals the squared Euclidean distance between the
+//! whitened points L^-1 * x and L^-1 * y. The points are whitened once, when
+//! the search is created, and each query is whitened when it arrives. Tree_ is
+//! a KdTree or KdForest that uses the L2Squared metric to search the whitened
+//! copy of the space, e.g.:
+//! \code{.cpp}
+//! using Tree = KdTree<MahalanobisSpaceType<Space>, L2Squared>;
+//! MahalanobisSearch<Tree> search(points, EstimateCovariance(points), 8);
+//! \endcode
+//! Distances are squared Mahalanobis distances. When the covariance matrix is
+//! diagonal, the WeightedL2Squared metric avoids the copy.
+template <typename Tree_>
+class MahalanobisSearch {
+  static_assert(
+      std::is_same_v<typename Tree_::MetricType, L2Squared>,
+      "TREE_METRIC_SHOULD_BE_L2_SQUARED");
+
+ public:
+  using TreeType = Tree_;
+  using IndexType = typename Tree_::IndexType;
+  using ScalarType = typename Tree_::ScalarType;
+  using SpaceType = typename Tree_::SpaceType;
+  using NeighborType = typename Tree_::NeighborType;
+
+  //! \brief Creates a MahalanobisSearch for the points of \p space and
+  //! covariance matrix \p covariance, which is stored in row-major order. The
+  //! remaining arguments \p args are passed to the constructor of the tree.
+  //! \details Throws an std::invalid_argument in case \p covariance is not
+  //! positive definite.
+  template <typename Space_, typename... Args_>
+  MahalanobisSearch(
+      Space_ const& space,
+      std::vector<ScalarType> const& covariance,
+      Args_&&... args)
+      : factor_(internal::CholeskyFactor(
+            covariance, internal::SpaceWrapper<Space_>(space).sdim())),
+        tree_(
+            Whiten(internal::SpaceWrapper<Space_>(space), factor_),
+            std::forward<Args_>(args)...) {}
+
+  //! \brief Searches for the nearest neighbor of point \p x.
+  template <typename P>
+  inline void SearchNn(P const& x, NeighborType& nn) const {
+    tree_.SearchNn(Query(x), nn);
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x.
+  template <typename P>
+  inline void SearchKnn(
+      P const& x, Size const k, std::vector<NeighborType>& knn) const {
+    tree_.SearchKnn(Query(x), k, knn);
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x. Only
+  //! available when the tree is a KdForest.
+  template <typename P>
+  inline void SearchKnn(
+      P const& x,
+      Size const k,
+      Size const max_leaves_visited,
+      std::vector<NeighborType>& knn) const {
+    tree_.SearchKnn(Query(x), k, max_leaves_visited, knn);
+  }
+
+  //! \brief Searches for all the neighbors of point \p x that are within
+  //! squared Mahalanobis distance \p radius.
+  template <typename P>
+  inline void SearchRadius(
+      P const& x,
+      ScalarType const radius,
+      std::vector<NeighborType>& n,
+      bool const sort = false) const {
+    tree_.SearchRadius(Query(x), radius, n, sort);
+  }
+
+  //! \brief The tree that indexes the whitened points.
+  inline TreeType const& tree() const { return tree_; }
+
+ private:
+  using QueryType = internal::Point<ScalarType, SpaceType::Dim>;
+
+  template <typename SpaceWrapper_>
+  static SpaceType Whiten(
+      SpaceWrapper_ space, std::vector<ScalarType> const& factor) {
+    SpaceType s(space.size(), space.sdim());
+    for (Size i = 0; i < space.size(); ++i) {
+      internal::ForwardSubstitute(factor, space.sdim(), space[i], s.data(i));
+    }
+    return s;
+  }
+
+  template <typename P>
+  inline QueryType Query(P const& x) const {
+    internal::PointWrapper<P> p(x);
+    Size const sdim = static_cast<Size>(p.end() - p.begin());
+    QueryType q = QueryType::FromSize(sdim);
+    internal::ForwardSubstitute(factor_, sdim, p.begin(), q.data());
+    return q;
+  }
+
+  std::vector<ScalarType> factor_;
+  TreeType tree_;
+};
+
+}  // namespace pico_tree
@@ -1,9 +1,51 @@
 #pragma once
 
+#include <cmath>
+#include <cstdint>
+#include <iterator>
 #include <pico_tree/metric.hpp>
+#include <type_traits>
 
 namespace pico_tree {
 
+namespace internal {
+
+//! \brief The type of the distances that \p Metric_ returns for the points of
+//! \p SpaceWrapper_.
+//! \details It can differ from the coordinate type of the points, e.g., when
+//! the coordinates are words of packed bits.
+template <typename SpaceWrapper_, typename Metric_>
+using MetricDistanceType = std::decay_t<std::invoke_result_t<
+    Metric_ const&,
+    typename SpaceWrapper_::ScalarType const*,
+    typename SpaceWrapper_::ScalarType const*,
+    typename SpaceWrapper_::ScalarType const*>>;
+
+//! \brief Returns the number of bits that are set in word \p x.
+//! \details Compiles to a single instruction when the target supports it,
+//! e.g., when compiling with -mpopcnt or -march=native.
+template <typename Word_>
+inline int Popcount(Word_ x) {
+  static_assert(std::is_unsigned_v<Word_>, "WORD_NOT_AN_UNSIGNED_TYPE");
+  static_assert(sizeof(Word_) <= 8, "WORD_LARGER_THAN_64_BITS");
+
+#if defined(__GNUC__) || defined(__clang__)
+  if constexpr (sizeof(Word_) <= sizeof(unsigned int)) {
+    return __builtin_popcount(static_cast<unsigned int>(x));
+  } else {
+    return __builtin_popcountll(static_cast<unsigned long long>(x));
+  }
+#else
+  std::uint64_t v = static_cast<std::uint64_t>(x);
+  v = v - ((v >> 1) & 0x5555555555555555ULL);
+  v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+  v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return static_cast<int>((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+}  // namespace internal
+
 //! \brief L2 metric for measuring Euclidean distances between points.
 //! \details https://en.wikipedia.org/wiki/Euclidean_distance
 //! \see L1
@@ -34,4 +76,36 @@ class L2 {
   }
 };
 
+//! \brief The Hamming metric counts the number of bits that differ between two
+//! binary descriptors.
+//! \details Each coordinate of a point is a word of packed bits. A 256-bit ORB
+//! descriptor, for example, can be stored as a std::array<std::uint64_t, 4>.
+//! The words are compared one at a time using a scalar popcount of their
+//! exclusive or. The popcount is only a hardware instruction when compiling
+//! with -mpopcnt or -march=native. There is no vectorized kernel.
+//!
+//! The distance is returned as a float such that it can be used by the
+//! CoverTree, which stores fractional levels and distances. It is exact for
+//! descriptors of up to 2^24 bits.
+//!
+//! For more details:
+//! * https://en.wikipedia.org/wiki/Hamming_distance
+class Hamming {
+ public:
+  template <
+      typename InputIterator1,
+      typename InputSentinel1,
+      typename InputIterator2>
+  inline float operator()(
+      InputIterator1 begin1, InputSentinel1 end1, InputIterator2 begin2) const {
+    using WordType = typename std::iterator_traits<InputIterator1>::value_type;
+    int d = 0;
+    for (; begin1 != end1; ++begin1, ++begin2) {
+      // Words smaller than an int are promoted by the exclusive or.
+      d += internal::Popcount(static_cast<WordType>(*begin1 ^ *begin2));
+    }
+    return static_cast<float>(d);
+  }
+};
+
 }  // namespace pico_tree
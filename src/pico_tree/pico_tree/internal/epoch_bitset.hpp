@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "pico_tree/core.hpp"
+
+namespace pico_tree::internal {
+
+//! \brief A bitset that can be cleared in O(1) time.
+//! \details Each 64-bit word of the set is stamped with the epoch in which it
+//! was last written. A word with an outdated stamp is considered to be empty.
+//! Clearing the set only increments the current epoch. This makes the set
+//! suitable for tracking visited points across many queries without having to
+//! touch all of its memory per query.
+class EpochBitset {
+  using WordType = std::uint64_t;
+  using EpochType = std::uint32_t;
+
+  static Size constexpr kWordBits = 64;
+
+ public:
+  //! \brief Creates an empty EpochBitset.
+  EpochBitset() : epoch_(0) {}
+
+  //! \brief Removes all elements and makes sure the set can contain the indices
+  //! [0, size).
+  inline void Clear(Size size) {
+    Size const word_count = (size + kWordBits - 1) / kWordBits;
+    if (word_count > words_.size()) {
+      words_.resize(word_count);
+      epochs_.resize(word_count, EpochType(0));
+    }
+
+    ++epoch_;
+    // On wrap-around all stamps are reset so stale ones can't match by
+    // accident.
+    if (epoch_ == EpochType(0)) {
+      std::fill(epochs_.begin(), epochs_.end(), EpochType(0));
+      epoch_ = EpochType(1);
+    }
+  }
+
+  //! \brief Inserts index \p i and returns true if it was not yet contained.
+  template <typename Index_>
+  inline bool Insert(Index_ const i) {
+    Size const w = static_cast<Size>(i) / kWordBits;
+    WordType const mask = WordType(1) << (static_cast<Size>(i) % kWordBits);
+
+    if (epochs_[w] != epoch_) {
+      epochs_[w] = epoch_;
+      words_[w] = mask;
+      return true;
+    }
+
+    if ((words_[w] & mask) != WordType(0)) {
+      return false;
+    }
+
+    words_[w] |= mask;
+    return true;
+  }
+
+  //! \brief Returns true if index \p i is contained by the set.
+  template <typename Index_>
+  inline bool Contains(Index_ const i) const {
+    Size const w = static_cast<Size>(i) / kWordBits;
+    WordType const mask = WordType(1) << (static_cast<Size>(i) % kWordBits);
+    return epochs_[w] == epoch_ && (words_[w] & mask) != WordType(0);
+  }
+
+ private:
+  EpochType epoch_;
+  std::vector<WordType> words_;
+  std::vector<EpochType> epochs_;
+};
+
+}  // namespace pico_tree::internal
@@ -3,11 +3,14 @@
 #include <algorithm>
 #include <cassert>
 #include <numeric>
+#include <random>
+#include <type_traits>
 #include <vector>
 
 #include "pico_tree/internal/box.hpp"
 #include "pico_tree/internal/kd_tree_data.hpp"
 #include "pico_tree/internal/kd_tree_node.hpp"
+#include "pico_tree/internal/point.hpp"
 #include "pico_tree/metric.hpp"
 
 namespace pico_tree {
@@ -41,7 +44,23 @@ enum class SplittingRule {
   //! The tree is build in O(n log n) time and results in a tree that is both
   //! faster to build and generally faster to query as compared to
   //! kLongestMedian.
-  kSlidingMidpoint
+  kSlidingMidpoint,
+  //! \brief Splits a node on the mean of its points along a dimension that is
+  //! randomly selected from the dimensions having the largest variance. The
+  //! mean and variance are estimated from a random sample of the node's
+  //! points.
+  //! \details This rule builds a randomized KdTree. Multiple trees that are
+  //! build using this rule have a different structure while sharing the same
+  //! space. It is mostly useful for building a forest of trees:
+  //!
+  //! * C. Silpa-Anan and R. Hartley, Optimised KD-trees for fast image
+  //! descriptor matching, In CVPR, 2008.
+  //! * M. Muja and D. G. Lowe, Scalable Nearest Neighbor Algorithms for High
+  //! Dimensional Data, In PAMI, 2014.
+  //!
+  //! In case the split results in an empty sub-node, the split is adjusted to
+  //! include a single point into that sub-node.
+  kRandomTopVariance
 };
 
 namespace internal {
@@ -186,6 +205,139 @@ class SplitterSlidingMidpoint {
   SpaceWrapper_ space_;
 };
 
+//! \copydoc SplittingRule::kRandomTopVariance
+template <typename SpaceWrapper_>
+class SplitterRandomTopVariance {
+  using ScalarType = typename SpaceWrapper_::ScalarType;
+  using SizeType = Size;
+  using BoxType = Box<ScalarType, SpaceWrapper_::Dim>;
+  using PointType = Point<ScalarType, SpaceWrapper_::Dim>;
+
+  //! \brief Maximum number of points used to estimate the mean and variance.
+  static SizeType constexpr kSampleSize = 100;
+  //! \brief Number of dimensions with the largest variance from which the
+  //! split dimension is selected.
+  static SizeType constexpr kTopCount = 5;
+
+ public:
+  //! \brief Creates a splitter of which the random choices are determined by
+  //! \p seed.
+  SplitterRandomTopVariance(
+      SpaceWrapper_ space,
+      std::mt19937::result_type seed = std::mt19937::default_seed)
+      : space_{space},
+        random_engine_{seed},
+        mean_{PointType::FromSize(space_.sdim())} {}
+
+  template <typename RandomAccessIterator_>
+  inline void operator()(
+      typename std::iterator_traits<
+          RandomAccessIterator_>::value_type const,  // depth
+      RandomAccessIterator_ begin,
+      RandomAccessIterator_ end,
+      BoxType const&,
+      RandomAccessIterator_& split,
+      SizeType& split_dim,
+      ScalarType& split_val) const {
+    split_dim = SelectSplitDim(begin, end);
+    split_val = mean_[split_dim];
+
+    // Everything smaller than split_val goes left, the rest right.
+    auto const comp = [this, &split_dim, &split_val](auto const index) -> bool {
+      return space_[index][split_dim] < split_val;
+    };
+
+    split = std::partition(begin, end, comp);
+
+    // See SplitterSlidingMidpoint.
+    if (split == end) {
+      split--;
+    } else if (split == begin) {
+      split++;
+    } else {
+      return;
+    }
+
+    std::nth_element(
+        begin,
+        split,
+        end,
+        [this, &split_dim](auto const index_a, auto const index_b) -> bool {
+          return space_[index_a][split_dim] < space_[index_b][split_dim];
+        });
+    split_val = space_[*split][split_dim];
+  }
+
+ private:
+  //! \brief Estimates the mean and variance of each dimension and returns one
+  //! of the dimensions with the largest variance.
+  //! \details The sample is drawn using a partial Fisher-Yates shuffle that
+  //! moves it to the front of the range. Input that is sorted or ordered like
+  //! a scan would otherwise result in a spatially clustered sample.
+  template <typename RandomAccessIterator_>
+  inline SizeType SelectSplitDim(
+      RandomAccessIterator_ begin, RandomAccessIterator_ end) const {
+    SizeType const size = static_cast<SizeType>(end - begin);
+    SizeType const sample_size = std::min(size, kSampleSize);
+    RandomAccessIterator_ const sample_end =
+        begin + static_cast<std::ptrdiff_t>(sample_size);
+
+    if (sample_size < size) {
+      for (SizeType i = 0; i < sample_size; ++i) {
+        std::uniform_int_distribution<SizeType> distribution(i, size - 1);
+        std::iter_swap(
+            begin + static_cast<std::ptrdiff_t>(i),
+            begin + static_cast<std::ptrdiff_t>(distribution(random_engine_)));
+      }
+    }
+
+    mean_.Fill(ScalarType(0));
+    for (auto it = begin; it < sample_end; ++it) {
+      ScalarType const* p = space_[*it];
+      for (SizeType i = 0; i < mean_.size(); ++i) {
+        mean_[i] += p[i];
+      }
+    }
+    for (SizeType i = 0; i < mean_.size(); ++i) {
+      mean_[i] /= static_cast<ScalarType>(sample_size);
+    }
+
+    // The dimensions are kept sorted from largest to smallest variance.
+    std::array<SizeType, kTopCount> top_dims;
+    std::array<ScalarType, kTopCount> top_variances;
+    SizeType top_count = 0;
+
+    for (SizeType i = 0; i < mean_.size(); ++i) {
+      ScalarType variance = ScalarType(0);
+      for (auto it = begin; it < sample_end; ++it) {
+        ScalarType const d = space_[*it][i] - mean_[i];
+        variance += d * d;
+      }
+
+      if (top_count < kTopCount) {
+        ++top_count;
+      } else if (variance <= top_variances[kTopCount - 1]) {
+        continue;
+      }
+
+      SizeType j = top_count - 1;
+      for (; j > 0 && variance > top_variances[j - 1]; --j) {
+        top_dims[j] = top_dims[j - 1];
+        top_variances[j] = top_variances[j - 1];
+      }
+      top_dims[j] = i;
+      top_variances[j] = variance;
+    }
+
+    std::uniform_int_distribution<SizeType> distribution(0, top_count - 1);
+    return top_dims[distribution(random_engine_)];
+  }
+
+  SpaceWrapper_ space_;
+  mutable std::mt19937 random_engine_;
+  mutable PointType mean_;
+};
+
 template <SplittingRule Rule_>
 struct SplittingRuleTraits;
 
@@ -207,6 +359,12 @@ struct SplittingRuleTraits<SplittingRule::kSlidingMidpoint> {
   using SplitterType = SplitterSlidingMidpoint<SpaceWrapper_>;
 };
 
+template <>
+struct SplittingRuleTraits<SplittingRule::kRandomTopVariance> {
+  template <typename SpaceWrapper_>
+  using SplitterType = SplitterRandomTopVariance<SpaceWrapper_>;
+};
+
 //! \brief This class provides the build algorithm of the KdTree. How the
 //! KdTree will be build depends on the Splitter template argument.
 template <
@@ -230,12 +388,13 @@ class BuildKdTreeImpl {
       SpaceType const& space,
       SizeType const max_leaf_size,
       std::vector<IndexType>& indices,
-      NodeAllocatorType& allocator)
+      NodeAllocatorType& allocator,
+      std::mt19937::result_type const seed = std::mt19937::default_seed)
       : space_(space),
         max_leaf_size_(
             static_cast<typename std::vector<IndexType>::difference_type>(
                 max_leaf_size)),
-        splitter_(space_),
+        splitter_(MakeSplitter(space_, seed)),
         indices_(indices),
         allocator_(allocator) {}
 
@@ -300,6 +459,21 @@ class BuildKdTreeImpl {
     return node;
   }
 
+  //! \brief Creates the splitter. The seed is only used by randomized
+  //! splitters.
+  static SplitterType MakeSplitter(
+      SpaceType const& space, std::mt19937::result_type const seed) {
+    if constexpr (std::is_constructible_v<
+                      SplitterType,
+                      SpaceType,
+                      std::mt19937::result_type>) {
+      return SplitterType(space, seed);
+    } else {
+      static_cast<void>(seed);
+      return SplitterType(space);
+    }
+  }
+
   template <typename RandomAccessIterator_>
   inline void ComputeBoundingBox(
       RandomAccessIterator_ begin,
@@ -347,9 +521,13 @@ class BuildKdTree {
   using KdTreeDataType = KdTreeData<Node_, Dim_>;
 
   //! \brief Construct a KdTree given \p points , \p max_leaf_size and
-  //! SplitterType.
+  //! SplitterType. The \p seed determines the random choices of a randomized
+  //! splitting rule.
   template <typename SpaceWrapper_>
-  KdTreeDataType operator()(SpaceWrapper_ space, Size max_leaf_size) {
+  KdTreeDataType operator()(
+      SpaceWrapper_ space,
+      Size max_leaf_size,
+      std::mt19937::result_type seed = std::mt19937::default_seed) {
     static_assert(
         std::is_same_v<ScalarType, typename SpaceWrapper_::ScalarType>);
     static_assert(Dim_ == SpaceWrapper_::Dim);
@@ -365,8 +543,8 @@ class BuildKdTree {
     std::iota(indices.begin(), indices.end(), 0);
     BoxType root_box = space.ComputeBoundingBox();
     NodeAllocatorType allocator;
-    Node_* root_node =
-        BuildKdTreeImplType{space, max_leaf_size, indices, allocator}(root_box);
+    Node_* root_node = BuildKdTreeImplType{
+        space, max_leaf_size, indices, allocator, seed}(root_box);
 
     return KdTreeDataType{
         std::move(indices), root_box, std::move(allocator), root_node};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "pico_tree/core.hpp"
+
+namespace pico_tree::internal {
+
+//! \brief Search filter that accepts all points.
+//! \details A search filter accepts or rejects points by their index using
+//! operator()(idx). A filter that sets kFiltersNodes to true also accepts or
+//! rejects entire nodes using Accept(node_id). Nodes are identified by their
+//! position in a pre-order traversal of the tree. The id of the left child of
+//! a node equals the id of the node plus one. The id of the right child is
+//! returned by RightChild(node_id).
+struct NoFilter {
+  static bool constexpr kFiltersNodes = false;
+
+  template <typename Index_>
+  inline bool constexpr operator()(Index_ const) const {
+    return true;
+  }
+};
+
+//! \brief Search filter that accepts the points for which a predicate holds
+//! true.
+//! \details The predicate is either invocable with the index of a point or it
+//! is a bitset that is indexed by it, such as an std::vector<bool>.
+template <typename Predicate_>
+class PointFilter {
+ public:
+  static bool constexpr kFiltersNodes = false;
+
+  inline explicit PointFilter(Predicate_ const& predicate)
+      : predicate_(predicate) {}
+
+  template <typename Index_>
+  inline bool operator()(Index_ const idx) const {
+    if constexpr (std::is_invocable_r_v<bool, Predicate_ const&, Index_>) {
+      return predicate_(idx);
+    } else {
+      return static_cast<bool>(predicate_[static_cast<Size>(idx)]);
+    }
+  }
+
+ private:
+  Predicate_ const& predicate_;
+};
+
+//! \brief Masks of the points and nodes of a KdTree.
+//! \details The mask of a node is the bitwise or of the masks of all the
+//! points it contains. Any integer type or std::bitset can be used as a mask.
+//! Masks are only valid for the tree they were created with.
+template <typename Mask_>
+class KdTreeMasks {
+ public:
+  using MaskType = Mask_;
+
+  //! \brief Creates the masks of the tree starting at \p root_node given the
+  //! mask of each point \p point_masks.
+  template <typename Node_, typename Index_>
+  KdTreeMasks(
+      std::vector<MaskType> point_masks,
+      Node_ const* const root_node,
+      std::vector<Index_> const& indices)
+      : point_masks_(std::move(point_masks)) {
+    Build(root_node, indices);
+  }
+
+  //! \brief Returns the mask of the point with index \p idx.
+  template <typename Index_>
+  inline MaskType const& point(Index_ const idx) const {
+    return point_masks_[static_cast<Size>(idx)];
+  }
+
+  //! \brief Returns the mask of the node with id \p node_id.
+  inline MaskType const& node(Size const node_id) const {
+    return nodes_[node_id].mask;
+  }
+
+  //! \brief Returns the id of the right child of the node with id \p node_id.
+  inline Size right(Size const node_id) const { return nodes_[node_id].right; }
+
+ private:
+  struct Node {
+    MaskType mask;
+    Size right;
+  };
+
+  template <typename Node_, typename Index_>
+  MaskType Build(Node_ const* const node, std::vector<Index_> const& indices) {
+    Size const node_id = nodes_.size();
+    nodes_.push_back({MaskType(), 0});
+
+    MaskType mask = MaskType();
+    if (node->IsLeaf()) {
+      for (auto i = node->data.leaf.begin_idx; i < node->data.leaf.end_idx;
+           ++i) {
+        mask |= point(indices[static_cast<Size>(i)]);
+      }
+    } else {
+      mask |= Build(node->left, indices);
+      nodes_[node_id].right = nodes_.size();
+      mask |= Build(node->right, indices);
+    }
+
+    nodes_[node_id].mask = mask;
+    return mask;
+  }
+
+  std::vector<MaskType> point_masks_;
+  std::vector<Node> nodes_;
+};
+
+//! \brief Search filter that accepts the points of which the mask shares any
+//! bit with a query mask. Nodes that don't contain any such points are
+//! skipped.
+template <typename Mask_>
+class MaskFilter {
+ public:
+  static bool constexpr kFiltersNodes = true;
+
+  inline MaskFilter(KdTreeMasks<Mask_> const& masks, Mask_ const& query)
+      : masks_(masks), query_(query) {}
+
+  template <typename Index_>
+  inline bool operator()(Index_ const idx) const {
+    return Any(masks_.point(idx));
+  }
+
+  inline bool Accept(Size const node_id) const {
+    return Any(masks_.node(node_id));
+  }
+
+  inline Size RightChild(Size const node_id) const {
+    return masks_.right(node_id);
+  }
+
+ private:
+  inline bool Any(Mask_ const& mask) const {
+    return (mask & query_) != Mask_();
+  }
+
+  KdTreeMasks<Mask_> const& masks_;
+  Mask_ query_;
+};
+
+}  // namespace pico_tree::internal
@@ -1,26 +1,116 @@
 #pragma once
 
+#include <type_traits>
 #include <vector>
 
 #include "pico_tree/internal/box.hpp"
+#include "pico_tree/internal/epoch_bitset.hpp"
+#include "pico_tree/internal/kd_tree_filter.hpp"
 #include "pico_tree/internal/kd_tree_node.hpp"
 #include "pico_tree/internal/point.hpp"
+#include "pico_tree/internal/search_visitor.hpp"
 #include "pico_tree/metric.hpp"
 
 namespace pico_tree::internal {
 
+//! \brief Scratch memory of the nearest neighbor searches of a KdTree.
+//! \details Reusing a context for many queries avoids allocating the node box
+//! offsets per query when the spatial dimension is only known at run time.
+template <typename Scalar_, Size Dim_>
+class KdTreeSearchContext {
+  static Size constexpr kInitialSize = Dim_ != kDynamicSize ? Dim_ : Size(0);
+
+ public:
+  using ScalarType = Scalar_;
+  using PointType = Point<ScalarType, Dim_>;
+  using BoxType = Box<ScalarType, Dim_>;
+
+  KdTreeSearchContext()
+      : node_box_offset_(PointType::FromSize(kInitialSize)),
+        node_box_far_offset_(PointType::FromSize(kInitialSize)),
+        node_box_(kInitialSize) {}
+
+  //! \brief Returns the node box offsets for a space with spatial dimension
+  //! \p sdim.
+  inline PointType& node_box_offset(Size sdim) {
+    return Resize(sdim, node_box_offset_);
+  }
+
+  //! \brief Returns the offsets to the far side of a node box for a space with
+  //! spatial dimension \p sdim.
+  inline PointType& node_box_far_offset(Size sdim) {
+    return Resize(sdim, node_box_far_offset_);
+  }
+
+  //! \brief Returns a node box that is initialized to \p root_box.
+  inline BoxType& node_box(BoxType const& root_box) {
+    node_box_ = root_box;
+    return node_box_;
+  }
+
+  //! \brief Returns an empty set that can contain the indices of a tree with
+  //! \p size points.
+  inline EpochBitset& indices(Size size) {
+    indices_.Clear(size);
+    return indices_;
+  }
+
+ private:
+  static inline PointType& Resize([[maybe_unused]] Size sdim, PointType& p) {
+    if constexpr (Dim_ == kDynamicSize) {
+      if (p.size() != sdim) {
+        p = PointType::FromSize(sdim);
+      }
+    }
+    return p;
+  }
+
+  PointType node_box_offset_;
+  PointType node_box_far_offset_;
+  BoxType node_box_;
+  EpochBitset indices_;
+};
+
+//! \brief Returns the index of the first point contained by \p node.
+//! \details Nodes and index pointers (begin_idx and end_idx) are ordered left
+//! to right. This means that for any node, its left-most and right-most leaf
+//! node descendants will respectively store the begin index and end index of
+//! the entire range of points contained by that node.
+template <typename Node_>
+inline auto NodeBeginIndex(Node_ const* node) {
+  while (!node->IsLeaf()) {
+    node = node->left;
+  }
+  return node->data.leaf.begin_idx;
+}
+
+//! \brief Returns the index one past the last point contained by \p node.
+//! \see NodeBeginIndex
+template <typename Node_>
+inline auto NodeEndIndex(Node_ const* node) {
+  while (!node->IsLeaf()) {
+    node = node->right;
+  }
+  return node->data.leaf.end_idx;
+}
+
 //! \brief This class provides a search nearest function for Euclidean spaces.
 //! \details S. Arya and D. M. Mount, Algorithms for fast vector quantization,
 //! In IEEE Data Compression Conference, pp. 381–390, March 1993.
 //! https://www.cs.umd.edu/~mount/Papers/DCC.pdf
 //! This paper describes the "Incremental Distance Calculation" technique  to
 //! speed up nearest neighbor queries.
+//!
+//! Points rejected by filter Filter_ are never visited and their distances are
+//! not computed. Filters that support it also skip entire nodes.
+//! \see NoFilter
 template <
     typename SpaceWrapper_,
     typename Metric_,
     typename PointWrapper_,
     typename Visitor_,
-    typename Index_>
+    typename Index_,
+    typename Filter_ = NoFilter>
 class SearchNearestEuclidean {
  public:
   using IndexType = Index_;
@@ -29,22 +119,34 @@ class SearchNearestEuclidean {
   //! \brief Node type supported by this SearchNearestEuclidean.
   using NodeType = KdTreeNodeEuclidean<IndexType, ScalarType>;
 
+  //! \brief Creates a search that uses \p node_box_offset as scratch memory.
+  //! Its size should equal the spatial dimension of the space.
   inline SearchNearestEuclidean(
       SpaceWrapper_ space,
       Metric_ metric,
       std::vector<IndexType> const& indices,
       PointWrapper_ query,
-      Visitor_& visitor)
+      PointType& node_box_offset,
+      Visitor_& visitor,
+      Filter_ filter = Filter_())
       : space_(space),
         metric_(metric),
         indices_(indices),
         query_(query),
-        node_box_offset_(PointType::FromSize(space_.sdim())),
-        visitor_(visitor) {}
+        node_box_offset_(node_box_offset),
+        visitor_(visitor),
+        filter_(filter),
+        node_id_(0) {}
 
   //! \brief Search nearest neighbors starting from \p node.
   inline void operator()(NodeType const* const node) {
     node_box_offset_.Fill(ScalarType(0.0));
+    if constexpr (Filter_::kFiltersNodes) {
+      node_id_ = 0;
+      if (!filter_.Accept(node_id_)) {
+        return;
+      }
+    }
     SearchNearest(node, ScalarType(0.0));
   }
 
@@ -54,9 +156,11 @@ class SearchNearestEuclidean {
     if (node->IsLeaf()) {
       for (IndexType i = node->data.leaf.begin_idx; i < node->data.leaf.end_idx;
            ++i) {
-        visitor_(
-            indices_[i],
-            metric_(query_.begin(), query_.end(), space_[indices_[i]]));
+        if (filter_(indices_[i])) {
+          visitor_(
+              indices_[i],
+              metric_(query_.begin(), query_.end(), space_[indices_[i]]));
+        }
       }
     } else {
       // Go left or right and then check if we should still go down the other
@@ -77,15 +181,31 @@ class SearchNearestEuclidean {
           0) {
         node_1st = node->left;
         node_2nd = node->right;
-        new_offset = metric_(node->data.branch.right_min, v);
+        new_offset = SplitDistance(
+            metric_,
+            node->data.branch.right_min,
+            v,
+            node->data.branch.split_dim);
       } else {
         node_1st = node->right;
         node_2nd = node->left;
-        new_offset = metric_(node->data.branch.left_max, v);
+        new_offset = SplitDistance(
+            metric_,
+            node->data.branch.left_max,
+            v,
+            node->data.branch.split_dim);
       }
 
+      [[maybe_unused]] Size const node_id = node_id_;
+
       // The distance and offset for node_1st is the same as that of its parent.
-      SearchNearest(node_1st, node_box_distance);
+      if (AcceptChild(node, node_1st, node_id)) {
+        SearchNearest(node_1st, node_box_distance);
+      }
+
+      if (IsDone(visitor_)) {
+        return;
+      }
 
       // Calculate the distance to node_2nd.
       // NOTE: This method only works with Lp norms to which the exponent is not
@@ -97,7 +217,8 @@ class SearchNearestEuclidean {
       // The value visitor->max() contains the current nearest neighbor distance
       // or otherwise current maximum search distance. When testing against the
       // split value we determine if we should go into the neighboring node.
-      if (visitor_.max() >= node_box_distance) {
+      if (visitor_.max() >= node_box_distance &&
+          AcceptChild(node, node_2nd, node_id)) {
         node_box_offset_[node->data.branch.split_dim] = new_offset;
         SearchNearest(node_2nd, node_box_distance);
         node_box_offset_[node->data.branch.split_dim] = old_offset;
@@ -105,12 +226,32 @@ class SearchNearestEuclidean {
     }
   }
 
+  //! \brief Returns true if the filter accepts \p child of \p node, which has
+  //! id \p node_id. Before returning, the current node id is set to that of
+  //! \p child.
+  inline bool AcceptChild(
+      [[maybe_unused]] NodeType const* const node,
+      [[maybe_unused]] NodeType const* const child,
+      [[maybe_unused]] Size const node_id) {
+    if constexpr (Filter_::kFiltersNodes) {
+      node_id_ =
+          child == node->left ? node_id + 1 : filter_.RightChild(node_id);
+      return filter_.Accept(node_id_);
+    } else {
+      return true;
+    }
+  }
+
   SpaceWrapper_ space_;
   Metric_ metric_;
   std::vector<IndexType> const& indices_;
   PointWrapper_ query_;
-  PointType node_box_offset_;
+  PointType& node_box_offset_;
   Visitor_& visitor_;
+  Filter_ filter_;
+  //! \brief Pre-order id of the current node. Only used by filters that skip
+  //! nodes.
+  Size node_id_;
 };
 
 //! \brief This class provides a search nearest function for topological spaces.
@@ -128,17 +269,20 @@ class SearchNearestTopological {
   //! \brief Node type supported by this SearchNearestTopological.
   using NodeType = KdTreeNodeTopological<IndexType, ScalarType>;
 
+  //! \brief Creates a search that uses \p node_box_offset as scratch memory.
+  //! Its size should equal the spatial dimension of the space.
   inline SearchNearestTopological(
       SpaceWrapper_ space,
       Metric_ metric,
       std::vector<IndexType> const& indices,
       PointWrapper_ query,
+      PointType& node_box_offset,
       Visitor_& visitor)
       : space_(space),
         metric_(metric),
         indices_(indices),
         query_(query),
-        node_box_offset_(PointType::FromSize(space_.sdim())),
+        node_box_offset_(node_box_offset),
         visitor_(visitor) {}
 
   //! \brief Search nearest neighbors starting from \p node.
@@ -160,15 +304,12 @@ class SearchNearestTopological {
     } else {
       // Go left or right and then check if we should still go down the other
       // side based on the current minimum distance.
-      ScalarType const v = query_[node->data.branch.split_dim];
       // Determine the distance to the boxes of the children of this node.
-      ScalarType const d1 = metric_(
-          v,
+      ScalarType const d1 = BoxDistance(
           node->data.branch.left_min,
           node->data.branch.left_max,
           node->data.branch.split_dim);
-      ScalarType const d2 = metric_(
-          v,
+      ScalarType const d2 = BoxDistance(
           node->data.branch.right_min,
           node->data.branch.right_max,
           node->data.branch.split_dim);
@@ -189,6 +330,10 @@ class SearchNearestTopological {
 
       SearchNearest(node_1st, node_box_distance);
 
+      if (IsDone(visitor_)) {
+        return;
+      }
+
       ScalarType const old_offset =
           node_box_offset_[node->data.branch.split_dim];
       node_box_distance = node_box_distance - old_offset + new_offset;
@@ -204,11 +349,215 @@ class SearchNearestTopological {
     }
   }
 
+  //! \brief Returns the distance between the query and the box defined by
+  //! [ \p min, \p max ] along dimension \p dim.
+  //! \details The entire query is passed to the metric if it supports it.
+  inline ScalarType BoxDistance(
+      ScalarType const min, ScalarType const max, int const dim) const {
+    if constexpr (std::is_invocable_v<
+                      Metric_ const&,
+                      decltype(query_.begin()),
+                      decltype(query_.end()),
+                      ScalarType,
+                      ScalarType,
+                      int>) {
+      return metric_(query_.begin(), query_.end(), min, max, dim);
+    } else {
+      return metric_(query_[static_cast<Size>(dim)], min, max, dim);
+    }
+  }
+
   SpaceWrapper_ space_;
   Metric_ metric_;
   std::vector<IndexType> const& indices_;
   PointWrapper_ query_;
-  PointType node_box_offset_;
+  PointType& node_box_offset_;
+  Visitor_& visitor_;
+};
+
+//! \brief This class provides a radius search function for Euclidean spaces
+//! that supports counting neighbors without visiting them.
+//! \details Besides the distance between the query and the box of a node, the
+//! search maintains the distance between the query and the farthest corner of
+//! that box. When the farthest corner lies within the radius, all points of
+//! the node are neighbors. A visitor that only counts neighbors then adds the
+//! size of the node and doesn't visit any of its points. Other visitors
+//! receive all points of the node, without testing their distances. This
+//! guarantees that counting and visiting result in the same number of
+//! neighbors.
+//!
+//! The distance to the farthest corner is the sum of the distances to the
+//! farthest side of the box for each dimension. This is exact for the L1 and
+//! L2Squared metrics and an upper bound for the LInf metric.
+template <
+    typename SpaceWrapper_,
+    typename Metric_,
+    typename PointWrapper_,
+    typename Visitor_,
+    typename Index_>
+class SearchRadiusEuclidean {
+ public:
+  static_assert(
+      std::is_same_v<typename Metric_::SpaceTag, EuclideanSpaceTag>,
+      "SEARCH_RADIUS_COUNT_ONLY_SUPPORTED_FOR_EUCLIDEAN_SPACES");
+
+  using IndexType = Index_;
+  using ScalarType = typename SpaceWrapper_::ScalarType;
+  static Size constexpr Dim = SpaceWrapper_::Dim;
+  using PointType = Point<ScalarType, Dim>;
+  using BoxType = Box<ScalarType, Dim>;
+  //! \brief Node type supported by this SearchRadiusEuclidean.
+  using NodeType = KdTreeNodeEuclidean<IndexType, ScalarType>;
+
+  //! \brief Creates a search that uses \p node_box, \p node_box_offset and
+  //! \p node_box_far_offset as scratch memory. The box should equal the box of
+  //! the root node and the size of both offsets should equal the spatial
+  //! dimension of the space.
+  inline SearchRadiusEuclidean(
+      SpaceWrapper_ space,
+      Metric_ metric,
+      std::vector<IndexType> const& indices,
+      PointWrapper_ query,
+      BoxType& node_box,
+      PointType& node_box_offset,
+      PointType& node_box_far_offset,
+      Visitor_& visitor)
+      : space_(space),
+        metric_(metric),
+        indices_(indices),
+        query_(query),
+        node_box_(node_box),
+        node_box_offset_(node_box_offset),
+        node_box_far_offset_(node_box_far_offset),
+        visitor_(visitor) {}
+
+  //! \brief Radius search starting from the root node \p node.
+  inline void operator()(NodeType const* const node) {
+    ScalarType node_box_distance = ScalarType(0.0);
+    ScalarType node_box_far_distance = ScalarType(0.0);
+    for (Size i = 0; i < space_.sdim(); ++i) {
+      node_box_offset_[i] = Offset(i);
+      node_box_far_offset_[i] = FarOffset(i);
+      node_box_distance += node_box_offset_[i];
+      node_box_far_distance += node_box_far_offset_[i];
+    }
+
+    if (visitor_.max() < node_box_distance) {
+      return;
+    }
+
+    if (visitor_.max() > node_box_far_distance) {
+      ReportNode(node);
+    } else {
+      SearchRadius(node, node_box_distance, node_box_far_distance);
+    }
+  }
+
+ private:
+  inline void SearchRadius(
+      NodeType const* const node,
+      ScalarType const node_box_distance,
+      ScalarType const node_box_far_distance) {
+    if (node->IsLeaf()) {
+      for (IndexType i = node->data.leaf.begin_idx; i < node->data.leaf.end_idx;
+           ++i) {
+        visitor_(
+            indices_[i],
+            metric_(query_.begin(), query_.end(), space_[indices_[i]]));
+      }
+    } else {
+      Size const dim = static_cast<Size>(node->data.branch.split_dim);
+
+      ScalarType old_value = node_box_.max(dim);
+      node_box_.max(dim) = node->data.branch.left_max;
+      SearchChild(node->left, dim, node_box_distance, node_box_far_distance);
+      node_box_.max(dim) = old_value;
+
+      old_value = node_box_.min(dim);
+      node_box_.min(dim) = node->data.branch.right_min;
+      SearchChild(node->right, dim, node_box_distance, node_box_far_distance);
+      node_box_.min(dim) = old_value;
+    }
+  }
+
+  //! \brief Searches \p node after the box of its parent has been shrunk to
+  //! its own box along dimension \p dim.
+  inline void SearchChild(
+      NodeType const* const node,
+      Size const dim,
+      ScalarType node_box_distance,
+      ScalarType node_box_far_distance) {
+    ScalarType const new_offset = Offset(dim);
+    node_box_distance = node_box_distance - node_box_offset_[dim] + new_offset;
+
+    if (visitor_.max() < node_box_distance) {
+      return;
+    }
+
+    ScalarType const new_far_offset = FarOffset(dim);
+    node_box_far_distance =
+        node_box_far_distance - node_box_far_offset_[dim] + new_far_offset;
+
+    if (visitor_.max() > node_box_far_distance) {
+      ReportNode(node);
+      return;
+    }
+
+    ScalarType const old_offset = node_box_offset_[dim];
+    ScalarType const old_far_offset = node_box_far_offset_[dim];
+    node_box_offset_[dim] = new_offset;
+    node_box_far_offset_[dim] = new_far_offset;
+    SearchRadius(node, node_box_distance, node_box_far_distance);
+    node_box_offset_[dim] = old_offset;
+    node_box_far_offset_[dim] = old_far_offset;
+  }
+
+  //! \brief Reports all points contained by \p node.
+  inline void ReportNode(NodeType const* const node) {
+    IndexType const begin = NodeBeginIndex(node);
+    IndexType const end = NodeEndIndex(node);
+
+    if constexpr (Visitor_::kCountOnly) {
+      visitor_.Count(static_cast<Size>(end - begin));
+    } else {
+      for (IndexType i = begin; i < end; ++i) {
+        visitor_.Insert(
+            indices_[i],
+            metric_(query_.begin(), query_.end(), space_[indices_[i]]));
+      }
+    }
+  }
+
+  //! \brief Returns the distance between the query and the current node box
+  //! along dimension \p dim.
+  inline ScalarType Offset(Size const dim) const {
+    ScalarType const v = query_[dim];
+    int const split_dim = static_cast<int>(dim);
+    if (v < node_box_.min(dim)) {
+      return SplitDistance(metric_, node_box_.min(dim), v, split_dim);
+    } else if (v > node_box_.max(dim)) {
+      return SplitDistance(metric_, node_box_.max(dim), v, split_dim);
+    }
+    return ScalarType(0.0);
+  }
+
+  //! \brief Returns the distance between the query and the farthest side of
+  //! the current node box along dimension \p dim.
+  inline ScalarType FarOffset(Size const dim) const {
+    ScalarType const v = query_[dim];
+    ScalarType const far = (v - node_box_.min(dim)) > (node_box_.max(dim) - v)
+                               ? node_box_.min(dim)
+                               : node_box_.max(dim);
+    return SplitDistance(metric_, far, v, static_cast<int>(dim));
+  }
+
+  SpaceWrapper_ space_;
+  Metric_ metric_;
+  std::vector<IndexType> const& indices_;
+  PointWrapper_ query_;
+  BoxType& node_box_;
+  PointType& node_box_offset_;
+  PointType& node_box_far_offset_;
   Visitor_& visitor_;
 };
 
@@ -292,45 +641,12 @@ class SearchBoxEuclidean {
   //! \brief Reports all indices contained by \p node.
   template <typename Node>
   inline void ReportNode(Node const* const node) const {
-    IndexType begin;
-    IndexType end;
-
-    if (node->IsLeaf()) {
-      begin = node->data.leaf.begin_idx;
-      end = node->data.leaf.end_idx;
-    } else {
-      // Nodes and index pointers (begin_idx and end_idx) are ordered left to
-      // right. This means that for any node, its left-most and right-most leaf
-      // node descendants will respectively store the begin index and end index
-      // of the entire range of points contained by that node.
-      begin = ReportLeft(node->left);
-      end = ReportRight(node->right);
-    }
-
     std::copy(
-        indices_.cbegin() + begin,
-        indices_.cbegin() + end,
+        indices_.cbegin() + NodeBeginIndex(node),
+        indices_.cbegin() + NodeEndIndex(node),
         std::back_inserter(idxs_));
   }
 
-  template <typename Node>
-  inline IndexType ReportLeft(Node const* const node) const {
-    if (node->IsLeaf()) {
-      return node->data.leaf.begin_idx;
-    } else {
-      return ReportLeft(node->left);
-    }
-  }
-
-  template <typename Node>
-  inline IndexType ReportRight(Node const* const node) const {
-    if (node->IsLeaf()) {
-      return node->data.leaf.end_idx;
-    } else {
-      return ReportRight(node->right);
-    }
-  }
-
   SpaceWrapper_ space_;
   Metric_ metric_;
   std::vector<IndexType> const& indices_;
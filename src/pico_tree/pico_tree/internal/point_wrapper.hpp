@@ -46,4 +46,30 @@ class PointWrapper {
   PointType const& point_;
 };
 
+//! \brief The StaticDimPointWrapper class wraps the coordinates of a point of
+//! which the spatial dimension is only known at run time, but for which it is
+//! known to equal Dim_.
+//! \details The range [begin(), end()) has a compile time size and, as a
+//! result, metrics can unroll the loops over its coordinates.
+template <typename Scalar_, Size Dim_>
+class StaticDimPointWrapper {
+ public:
+  using ScalarType = Scalar_;
+  static Size constexpr Dim = Dim_;
+
+  inline explicit StaticDimPointWrapper(ScalarType const* data)
+      : data_(data) {}
+
+  inline ScalarType const& operator[](std::size_t index) const {
+    return data_[index];
+  }
+
+  inline ScalarType const* begin() const { return data_; }
+
+  inline ScalarType const* end() const { return data_ + Dim; }
+
+ private:
+  ScalarType const* data_;
+};
+
 }  // namespace pico_tree::internal
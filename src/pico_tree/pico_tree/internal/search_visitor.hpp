@@ -2,11 +2,42 @@
 
 #include <algorithm>
 #include <iterator>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "pico_tree/core.hpp"
+#include "pico_tree/internal/epoch_bitset.hpp"
 
 namespace pico_tree::internal {
 
+//! \brief Checks if Visitor_ provides the optional member function done().
+template <typename Visitor_, typename = void>
+struct HasDone : std::false_type {};
+
+//! \private
+template <typename Visitor_>
+struct HasDone<
+    Visitor_,
+    std::void_t<decltype(std::declval<Visitor_ const&>().done())>>
+    : std::true_type {};
+
+//! \brief Returns true if visitor \p visitor wants to end the search.
+//! \details A visitor may provide a member function done() that returns true
+//! once the search can be ended, e.g., after finding any point within a radius.
+//! Search engines check it after visiting each leaf and stop without computing
+//! any further node distances. For visitors without done(), this function is a
+//! constant false and the checks are removed at compile time.
+template <typename Visitor_>
+inline bool constexpr IsDone([[maybe_unused]] Visitor_ const& visitor) {
+  if constexpr (HasDone<Visitor_>::value) {
+    return visitor.done();
+  } else {
+    return false;
+  }
+}
+
 //! \brief Inserts \p item in O(n) time at the index for which \p comp first
 //! holds true. The sequence must be sorted and remains sorted after insertion.
 //! The last item in the sequence is overwritten / "pushed out".
@@ -37,6 +68,42 @@ inline void InsertSorted(
   *end = std::move(item);
 }
 
+//! \brief Replaces the front of the max-heap [ \p begin, \p end ) by \p item
+//! in O(log n) time and restores the heap property.
+//! \details Equivalent to a std::pop_heap followed by a std::push_heap, but
+//! \p item is sifted down only once.
+template <
+    typename RandomAccessIterator_,
+    typename Compare_ = std::less<
+        typename std::iterator_traits<RandomAccessIterator_>::value_type>>
+inline void ReplaceFrontHeap(
+    RandomAccessIterator_ begin,
+    RandomAccessIterator_ end,
+    typename std::iterator_traits<RandomAccessIterator_>::value_type item,
+    Compare_ comp = Compare_()) {
+  using DifferenceType =
+      typename std::iterator_traits<RandomAccessIterator_>::difference_type;
+
+  DifferenceType const size = std::distance(begin, end);
+  DifferenceType parent = 0;
+  DifferenceType child = 1;
+
+  // Move the largest child up until item is not smaller than either child.
+  while (child < size) {
+    if (child + 1 < size && comp(begin[child], begin[child + 1])) {
+      ++child;
+    }
+    if (!comp(item, begin[child])) {
+      break;
+    }
+    begin[parent] = std::move(begin[child]);
+    parent = child;
+    child = 2 * parent + 1;
+  }
+
+  begin[parent] = std::move(item);
+}
+
 //! \brief KdTree search visitor for finding a single nearest neighbor.
 template <typename Neighbor_>
 class SearchNn {
@@ -79,6 +146,10 @@ class SearchNn {
 //!  sorted sequence. Unsorted it does come close to the insertion sort.
 //!  * Binary heap plus a heap sort seemed a lot faster than the Leonardo heap
 //!  with smooth sort.
+//!
+//! The above holds for small values of k. From kSearchKnnHeapMinK neighbors
+//! onward, the O(k) cost of each insertion dominates and SearchKnnHeap is
+//! faster.
 template <typename RandomAccessIterator_>
 class SearchKnn {
  public:
@@ -122,6 +193,72 @@ class SearchKnn {
   RandomAccessIterator_ active_end_;
 };
 
+//! \brief KdTree search visitor for finding k nearest neighbors using a
+//! bounded max-heap.
+//! \details Each accepted neighbor costs O(log k) instead of the O(k) of the
+//! insertion sort of SearchKnn. The neighbors are only sorted when calling
+//! Sort(), which should be done after the search has ended.
+//! \see SearchKnn
+template <typename RandomAccessIterator_>
+class SearchKnnHeap {
+ public:
+  static_assert(
+      std::is_base_of_v<
+          std::random_access_iterator_tag,
+          typename std::iterator_traits<
+              RandomAccessIterator_>::iterator_category>,
+      "EXPECTED_RANDOM_ACCESS_ITERATOR");
+
+  using NeighborType =
+      typename std::iterator_traits<RandomAccessIterator_>::value_type;
+  using IndexType = typename NeighborType::IndexType;
+  using ScalarType = typename NeighborType::ScalarType;
+
+  //! \private
+  inline SearchKnnHeap(RandomAccessIterator_ begin, RandomAccessIterator_ end)
+      : begin_{begin},
+        end_{end},
+        active_end_{begin},
+        max_{std::numeric_limits<ScalarType>::max()} {}
+
+  //! \brief Visit current point.
+  inline void operator()(IndexType const idx, ScalarType const dst) {
+    if (max() > dst) {
+      if (active_end_ < end_) {
+        *active_end_ = NeighborType{idx, dst};
+        ++active_end_;
+        std::push_heap(begin_, active_end_);
+        // The search distance shrinks once k neighbors have been found.
+        if (active_end_ == end_) {
+          max_ = begin_->distance;
+        }
+      } else {
+        ReplaceFrontHeap(begin_, end_, NeighborType{idx, dst});
+        max_ = begin_->distance;
+      }
+    }
+  }
+
+  //! \brief Sort the neighbors by distance from the query point. Should be
+  //! called after the search has ended.
+  inline void Sort() const { std::sort_heap(begin_, active_end_); }
+
+  //! \brief Maximum search distance with respect to the query point.
+  inline ScalarType max() const { return max_; }
+
+ private:
+  RandomAccessIterator_ begin_;
+  RandomAccessIterator_ end_;
+  RandomAccessIterator_ active_end_;
+  ScalarType max_;
+};
+
+//! \brief The number of neighbors from which a bounded max-heap is faster
+//! than an insertion sort for finding k nearest neighbors.
+//! \see SearchKnn
+//! \see SearchKnnHeap
+inline Size constexpr kSearchKnnHeapMinK = 64;
+
 //! \brief KdTree search visitor for finding all neighbors within a radius.
 template <typename Neighbor_>
 class SearchRadius {
@@ -155,6 +292,91 @@ class SearchRadius {
   std::vector<NeighborType>& n_;
 };
 
+//! \brief SearchRadiusEuclidean visitor for counting all neighbors within a
+//! radius.
+//! \details Nodes that lie entirely within the radius are counted at once.
+template <typename Neighbor_>
+class SearchRadiusCount {
+ public:
+  static bool constexpr kCountOnly = true;
+
+  using NeighborType = Neighbor_;
+  using IndexType = typename Neighbor_::IndexType;
+  using ScalarType = typename Neighbor_::ScalarType;
+
+  //! \private
+  inline SearchRadiusCount(ScalarType const radius, Size& count)
+      : radius_{radius}, count_{count} {
+    count_ = 0;
+  }
+
+  //! \brief Visit current point.
+  inline void operator()(IndexType const, ScalarType const dst) const {
+    if (max() > dst) {
+      ++count_;
+    }
+  }
+
+  //! \brief Count \p n points that are all within the radius.
+  inline void Count(Size const n) const { count_ += n; }
+
+  //! \brief Maximum search distance with respect to the query point.
+  inline ScalarType max() const { return radius_; }
+
+ private:
+  ScalarType radius_;
+  Size& count_;
+};
+
+//! \brief SearchRadiusEuclidean visitor for storing all neighbors within a
+//! radius in a preallocated range.
+//! \details The range should be large enough to store all neighbors, which
+//! can be determined using the SearchRadiusCount visitor. Neighbors that
+//! don't fit are ignored.
+template <typename RandomAccessIterator_>
+class SearchRadiusRange {
+ public:
+  static bool constexpr kCountOnly = false;
+
+  using NeighborType =
+      typename std::iterator_traits<RandomAccessIterator_>::value_type;
+  using IndexType = typename NeighborType::IndexType;
+  using ScalarType = typename NeighborType::ScalarType;
+
+  //! \private
+  inline SearchRadiusRange(
+      ScalarType const radius,
+      RandomAccessIterator_ begin,
+      RandomAccessIterator_ end)
+      : radius_{radius}, it_{begin}, end_{end} {}
+
+  //! \brief Visit current point.
+  inline void operator()(IndexType const idx, ScalarType const dst) {
+    if (max() > dst) {
+      Insert(idx, dst);
+    }
+  }
+
+  //! \brief Insert a point that is known to be within the radius.
+  inline void Insert(IndexType const idx, ScalarType const dst) {
+    if (it_ != end_) {
+      *it_ = {idx, dst};
+      ++it_;
+    }
+  }
+
+  //! \brief Returns the end of the neighbors that were stored.
+  inline RandomAccessIterator_ active_end() const { return it_; }
+
+  //! \brief Maximum search distance with respect to the query point.
+  inline ScalarType max() const { return radius_; }
+
+ private:
+  ScalarType radius_;
+  RandomAccessIterator_ it_;
+  RandomAccessIterator_ end_;
+};
+
 //! \brief Search visitor for finding an approximate nearest neighbor.
 //! \details Tree nodes are skipped by scaling down the search distance,
 //! possibly not visiting the true nearest neighbor. An approximate nearest
@@ -285,4 +507,94 @@ class SearchApproximateRadius {
   std::vector<NeighborType>& n_;
 };
 
+//! \brief Excludes the point with a single index from a search.
+template <typename Index_>
+class ExcludeIndex {
+ public:
+  inline explicit ExcludeIndex(Index_ const idx) : idx_{idx} {}
+
+  inline bool operator()(Index_ const idx) const { return idx == idx_; }
+
+ private:
+  Index_ idx_;
+};
+
+//! \brief Excludes the points of a small set of indices from a search.
+//! \details Each visited point is compared with all indices of the set.
+template <typename Index_>
+class ExcludeIndices {
+ public:
+  inline explicit ExcludeIndices(std::vector<Index_> const& idxs)
+      : idxs_{idxs} {}
+
+  inline bool operator()(Index_ const idx) const {
+    return std::find(idxs_.begin(), idxs_.end(), idx) != idxs_.end();
+  }
+
+ private:
+  std::vector<Index_> const& idxs_;
+};
+
+//! \brief Search visitor that passes all points to visitor \p visitor, except
+//! those that are excluded by \p exclude.
+//! \details Excluded points are dropped before they reach the wrapped visitor.
+//! They never occupy one of its results, nor do they shrink its search
+//! distance.
+template <typename Visitor_, typename Exclude_>
+class SearchExcluding {
+ public:
+  //! \private
+  inline SearchExcluding(Visitor_& visitor, Exclude_ exclude)
+      : visitor_{visitor}, exclude_{exclude} {}
+
+  //! \brief Visit current point.
+  template <typename Index_, typename Scalar_>
+  inline void operator()(Index_ const idx, Scalar_ const dst) {
+    if (!exclude_(idx)) {
+      visitor_(idx, dst);
+    }
+  }
+
+  //! \brief Maximum search distance with respect to the query point.
+  inline auto max() const { return visitor_.max(); }
+
+  //! \brief Returns true if the wrapped visitor wants to end the search.
+  inline bool done() const { return IsDone(visitor_); }
+
+ private:
+  Visitor_& visitor_;
+  Exclude_ exclude_;
+};
+
+//! \brief Knn search visitor that skips the candidate points with which
+//! visitor \p visitor was already seeded.
+//! \details Only points that would be accepted by the wrapped visitor, i.e.,
+//! those that are closer than its current search distance, are looked up in
+//! the set of candidates.
+template <typename Visitor_, typename Index_>
+class SearchSkipCandidates {
+ public:
+  //! \private
+  inline SearchSkipCandidates(Visitor_& visitor, EpochBitset const& candidates)
+      : visitor_{visitor}, candidates_{candidates} {}
+
+  //! \brief Visit current point.
+  template <typename Scalar_>
+  inline void operator()(Index_ const idx, Scalar_ const dst) {
+    if (visitor_.max() > dst && !candidates_.Contains(idx)) {
+      visitor_(idx, dst);
+    }
+  }
+
+  //! \brief Maximum search distance with respect to the query point.
+  inline auto max() const { return visitor_.max(); }
+
+  //! \brief Returns true if the wrapped visitor wants to end the search.
+  inline bool done() const { return IsDone(visitor_); }
+
+ private:
+  Visitor_& visitor_;
+  EpochBitset const& candidates_;
+};
+
 }  // namespace pico_tree::internal
@@ -54,4 +54,31 @@ class SpaceWrapper {
   SpaceType const& space_;
 };
 
+//! \brief The StaticDimSpaceWrapper class wraps a SpaceWrapper of which the
+//! spatial dimension is only known at run time, but for which it is known to
+//! equal Dim_.
+//! \see DispatchStaticDim
+template <typename SpaceWrapper_, Size Dim_>
+class StaticDimSpaceWrapper {
+  using SizeType = Size;
+
+ public:
+  using ScalarType = typename SpaceWrapper_::ScalarType;
+  static SizeType constexpr Dim = Dim_;
+
+  explicit StaticDimSpaceWrapper(SpaceWrapper_ space) : space_(space) {}
+
+  template <typename Index_>
+  inline ScalarType const* operator[](Index_ const index) const {
+    return space_[index];
+  }
+
+  inline SizeType size() const { return space_.size(); }
+
+  constexpr SizeType sdim() const { return Dim; }
+
+ private:
+  SpaceWrapper_ space_;
+};
+
 }  // namespace pico_tree::internal
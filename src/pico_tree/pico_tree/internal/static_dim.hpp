@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <type_traits>
+#include <utility>
+
+#include "pico_tree/core.hpp"
+
+namespace pico_tree::internal {
+
+//! \brief Smallest run time spatial dimension for which DispatchStaticDim
+//! provides a compile time spatial dimension.
+inline Size constexpr kMinStaticDim = 2;
+//! \brief Largest run time spatial dimension for which DispatchStaticDim
+//! provides a compile time spatial dimension.
+inline Size constexpr kMaxStaticDim = 16;
+
+//! \brief Calls \p f with the compile time spatial dimension Dim_.
+template <Size Dim_, typename Function_>
+inline void InvokeStaticDim(Function_& f) {
+  f(std::integral_constant<Size, Dim_>());
+}
+
+//! \brief Returns a table that maps each spatial dimension within
+//! [kMinStaticDim, kMaxStaticDim] to an InvokeStaticDim instantiation.
+template <typename Function_, Size... Offsets_>
+constexpr auto MakeStaticDimTable(std::index_sequence<Offsets_...>) {
+  return std::array<void (*)(Function_&), sizeof...(Offsets_)>{
+      &InvokeStaticDim<kMinStaticDim + Offsets_, Function_>...};
+}
+
+//! \brief Calls \p f with an std::integral_constant<Size, sdim> and returns
+//! true if \p sdim is within [kMinStaticDim, kMaxStaticDim]. Returns false
+//! otherwise.
+//! \details This allows code for a spatial dimension that is only known at run
+//! time to be compiled for each of the most common spatial dimensions. Loops
+//! with a compile time number of iterations can be fully unrolled and storage
+//! can be fixed size.
+template <typename Function_>
+inline bool DispatchStaticDim(Size sdim, Function_&& f) {
+  using FunctionType = std::remove_reference_t<Function_>;
+  static constexpr auto kTable = MakeStaticDimTable<FunctionType>(
+      std::make_index_sequence<kMaxStaticDim - kMinStaticDim + 1>());
+
+  if (sdim < kMinStaticDim || sdim > kMaxStaticDim) {
+    return false;
+  }
+
+  kTable[sdim - kMinStaticDim](f);
+  return true;
+}
+
+}  // namespace pico_tree::internal
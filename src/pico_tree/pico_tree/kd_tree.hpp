@@ -1,11 +1,17 @@
 #pragma once
 
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
 #include "pico_tree/internal/box.hpp"
 #include "pico_tree/internal/kd_tree_builder.hpp"
 #include "pico_tree/internal/kd_tree_search.hpp"
 #include "pico_tree/internal/point_wrapper.hpp"
 #include "pico_tree/internal/search_visitor.hpp"
 #include "pico_tree/internal/space_wrapper.hpp"
+#include "pico_tree/internal/static_dim.hpp"
+#include "pico_tree/map_traits.hpp"
 
 namespace pico_tree {
 
@@ -46,6 +52,12 @@ class KdTree {
   using MetricType = Metric_;
   //! \brief Neighbor type of various search resuls.
   using NeighborType = Neighbor<IndexType, ScalarType>;
+  //! \brief Scratch memory that can be reused by the searches of the KdTree.
+  using SearchContextType = internal::KdTreeSearchContext<ScalarType, Dim>;
+  //! \brief Masks of the points and nodes of the KdTree that are used by
+  //! filtered searches.
+  template <typename Mask_>
+  using MasksType = internal::KdTreeMasks<Mask_>;
 
   //! \brief Creates a KdTree given \p space and \p max_leaf_size.
   //! \details The KdTree takes \p space by value. This allows it to take
@@ -65,6 +77,15 @@ class KdTree {
         metric_(),
         data_(BuildKdTreeType()(SpaceWrapperType(space_), max_leaf_size)) {}
 
+  //! \brief Creates a KdTree given \p space, \p max_leaf_size and \p metric.
+  //! \details This constructor allows using a metric that has a state, such as
+  //! the PeriodicL2Squared metric.
+  //! \see KdTree(SpaceType, SizeType)
+  KdTree(SpaceType space, SizeType max_leaf_size, MetricType metric)
+      : space_(std::move(space)),
+        metric_(std::move(metric)),
+        data_(BuildKdTreeType()(SpaceWrapperType(space_), max_leaf_size)) {}
+
   //! \brief The KdTree cannot be copied.
   //! \details The KdTree uses pointers to nodes and copying pointers is not
   //! the same as creating a deep copy.
@@ -81,10 +102,26 @@ class KdTree {
 
   //! \brief Returns the nearest neighbor (or neighbors) of point \p x depending
   //! on their selection by visitor \p visitor .
+  //! \details The scratch memory of the search is reused by all queries of the
+  //! current thread. A visitor should therefore not start another search with
+  //! a tree of the same type.
   template <typename P, typename V>
   inline void SearchNearest(P const& x, V& visitor) const {
-    internal::PointWrapper<P> p(x);
-    SearchNearest(p, visitor, typename Metric_::SpaceTag());
+    WithSearchContext([&](SearchContextType& context) {
+      SearchNearest(x, visitor, context);
+    });
+  }
+
+  //! \brief Returns the nearest neighbor (or neighbors) of point \p x depending
+  //! on their selection by visitor \p visitor . The search uses the scratch
+  //! memory of \p context .
+  //! \details When the spatial dimension is only known at run time, but it is
+  //! small, the search is performed by an instantiation for that dimension.
+  //! This allows the compiler to unroll the distance calculations.
+  template <typename P, typename V>
+  inline void SearchNearest(
+      P const& x, V& visitor, SearchContextType& context) const {
+    SearchNearest(x, visitor, context, internal::NoFilter());
   }
 
   //! \brief Searches for the nearest neighbor of point \p x.
@@ -96,6 +133,15 @@ class KdTree {
     SearchNearest(x, v);
   }
 
+  //! \brief Searches for the nearest neighbor of point \p x using the scratch
+  //! memory of \p context .
+  template <typename P>
+  inline void SearchNn(
+      P const& x, NeighborType& nn, SearchContextType& context) const {
+    internal::SearchNn<NeighborType> v(nn);
+    SearchNearest(x, v, context);
+  }
+
   //! \brief Searches for the approximate nearest neighbor of point \p x.
   //! \details Nodes in the tree are skipped by scaling down the search
   //! distance and as a result the true nearest neighbor may not be found. An
@@ -125,24 +171,61 @@ class KdTree {
     SearchNearest(x, v);
   }
 
+  //! \brief Searches for the approximate nearest neighbor of point \p x using
+  //! the scratch memory of \p context .
+  //! \see template <typename P> void SearchNn(P const&, ScalarType,
+  //! NeighborType&) const
+  template <typename P>
+  inline void SearchNn(
+      P const& x,
+      ScalarType const e,
+      NeighborType& nn,
+      SearchContextType& context) const {
+    internal::SearchApproximateNn<NeighborType> v(e, nn);
+    SearchNearest(x, v, context);
+  }
+
   //! \brief Searches for the k nearest neighbors of point \p x, where k equals
   //! std::distance(begin, end). It is expected that the value type of the
   //! iterator equals Neighbor<IndexType, ScalarType>.
   //! \details Interpretation of the output distances depend on the Metric. The
-  //! default L2Squared results in squared distances.
+  //! default L2Squared results in squared distances. Large values of k use a
+  //! bounded max-heap to maintain the neighbors.
   //! \tparam P Point type.
   //! \tparam RandomAccessIterator Iterator type.
   template <typename P, typename RandomAccessIterator>
   inline void SearchKnn(
       P const& x, RandomAccessIterator begin, RandomAccessIterator end) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchKnn(x, begin, end, context);
+    });
+  }
+
+  //! \brief Searches for the k nearest neighbors of point \p x using the
+  //! scratch memory of \p context .
+  //! \see template <typename P, typename RandomAccessIterator> void SearchKnn(P
+  //! const&, RandomAccessIterator, RandomAccessIterator) const
+  template <typename P, typename RandomAccessIterator>
+  inline void SearchKnn(
+      P const& x,
+      RandomAccessIterator begin,
+      RandomAccessIterator end,
+      SearchContextType& context) const {
     static_assert(
         std::is_same_v<
             typename std::iterator_traits<RandomAccessIterator>::value_type,
             NeighborType>,
         "ITERATOR_VALUE_TYPE_DOES_NOT_EQUAL_NEIGHBOR_TYPE");
 
-    internal::SearchKnn<RandomAccessIterator> v(begin, end);
-    SearchNearest(x, v);
+    if (static_cast<SizeType>(std::distance(begin, end)) <
+        internal::kSearchKnnHeapMinK) {
+      internal::SearchKnn<RandomAccessIterator> v(begin, end);
+      SearchNearest(x, v, context);
+    } else {
+      internal::SearchKnnHeap<RandomAccessIterator> v(begin, end);
+      SearchNearest(x, v, context);
+      v.Sort();
+    }
   }
 
   //! \brief Searches for the \p k nearest neighbors of point \p x and stores
@@ -159,6 +242,19 @@ class KdTree {
     SearchKnn(x, knn.begin(), knn.end());
   }
 
+  //! \brief Searches for the \p k nearest neighbors of point \p x and stores
+  //! the results in output vector \p knn. The search uses the scratch memory
+  //! of \p context .
+  template <typename P>
+  inline void SearchKnn(
+      P const& x,
+      SizeType const k,
+      std::vector<NeighborType>& knn,
+      SearchContextType& context) const {
+    knn.resize(std::min(k, SpaceWrapperType(space_).size()));
+    SearchKnn(x, knn.begin(), knn.end(), context);
+  }
+
   //! \brief Searches for the k approximate nearest neighbors of point \p x,
   //! where k equals std::distance(begin, end). It is expected that the value
   //! type of the iterator equals Neighbor<IndexType, ScalarType>.
@@ -172,6 +268,23 @@ class KdTree {
       ScalarType const e,
       RandomAccessIterator begin,
       RandomAccessIterator end) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchKnn(x, e, begin, end, context);
+    });
+  }
+
+  //! \brief Searches for the k approximate nearest neighbors of point \p x
+  //! using the scratch memory of \p context .
+  //! \see template <typename P, typename RandomAccessIterator> void
+  //! SearchKnn(P const&, ScalarType, RandomAccessIterator,
+  //! RandomAccessIterator) const
+  template <typename P, typename RandomAccessIterator>
+  inline void SearchKnn(
+      P const& x,
+      ScalarType const e,
+      RandomAccessIterator begin,
+      RandomAccessIterator end,
+      SearchContextType& context) const {
     static_assert(
         std::is_same_v<
             typename std::iterator_traits<RandomAccessIterator>::value_type,
@@ -179,7 +292,7 @@ class KdTree {
         "ITERATOR_VALUE_TYPE_DOES_NOT_EQUAL_NEIGHBOR_TYPE");
 
     internal::SearchApproximateKnn<RandomAccessIterator> v(e, begin, end);
-    SearchNearest(x, v);
+    SearchNearest(x, v, context);
   }
 
   //! \brief Searches for the \p k approximate nearest neighbors of point \p x
@@ -201,6 +314,440 @@ class KdTree {
     SearchKnn(x, e, knn.begin(), knn.end());
   }
 
+  //! \brief Searches for the \p k approximate nearest neighbors of point \p x
+  //! and stores the results in output vector \p knn. The search uses the
+  //! scratch memory of \p context .
+  template <typename P>
+  inline void SearchKnn(
+      P const& x,
+      SizeType const k,
+      ScalarType const e,
+      std::vector<NeighborType>& knn,
+      SearchContextType& context) const {
+    knn.resize(std::min(k, SpaceWrapperType(space_).size()));
+    SearchKnn(x, e, knn.begin(), knn.end(), context);
+  }
+
+  //! \brief Searches for the nearest neighbors of point \p x, starting from
+  //! the points with indices \p candidates , and stores the results in the
+  //! range [begin, end).
+  //! \details The distances of the candidates are computed before traversing
+  //! the tree. They bound the search from the first node onward, which prunes
+  //! many more nodes when the candidates are close to the true neighbors.
+  //! This is the case for a sequence of nearby queries, where the candidates
+  //! are the neighbors of the previous query:
+  //! \code{.cpp}
+  //! tree.SearchKnn(queries[0], k, knn);
+  //! for (std::size_t i = 1; i < queries.size(); ++i) {
+  //!   for (std::size_t j = 0; j < knn.size(); ++j) {
+  //!     candidates[j] = knn[j].index;
+  //!   }
+  //!   tree.SearchKnnWarm(queries[i], k, candidates, knn);
+  //! }
+  //! \endcode
+  //! The results equal those of SearchKnn(). Candidates should be indices of
+  //! points of the tree. Duplicates are ignored. The traversal skips the
+  //! candidates using a set of indices that is sized to the number of points of
+  //! the tree. The scratch memory of the search, including this set, is
+  //! therefore always reused by all queries of the current thread.
+  //! \tparam P Point type.
+  //! \tparam RandomAccessIterator Iterator type.
+  template <typename P, typename RandomAccessIterator>
+  inline void SearchKnnWarm(
+      P const& x,
+      std::vector<IndexType> const& candidates,
+      RandomAccessIterator begin,
+      RandomAccessIterator end) const {
+    SearchKnnWarm(x, candidates, begin, end, ThreadSearchContext());
+  }
+
+  //! \brief Searches for the nearest neighbors of point \p x, starting from
+  //! the points with indices \p candidates , and stores the results in the
+  //! range [begin, end). The search uses the scratch memory of \p context .
+  //! \see template <typename P, typename RandomAccessIterator> void
+  //! SearchKnnWarm(P const&, std::vector<IndexType> const&,
+  //! RandomAccessIterator, RandomAccessIterator) const
+  template <typename P, typename RandomAccessIterator>
+  inline void SearchKnnWarm(
+      P const& x,
+      std::vector<IndexType> const& candidates,
+      RandomAccessIterator begin,
+      RandomAccessIterator end,
+      SearchContextType& context) const {
+    static_assert(
+        std::is_same_v<
+            typename std::iterator_traits<RandomAccessIterator>::value_type,
+            NeighborType>,
+        "ITERATOR_VALUE_TYPE_DOES_NOT_EQUAL_NEIGHBOR_TYPE");
+
+    VisitKnn(begin, end, [&](auto& v) {
+      SearchNearestWarm(x, candidates, v, context);
+    });
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x, starting
+  //! from the points with indices \p candidates , and stores the results in
+  //! output vector \p knn.
+  //! \see template <typename P, typename RandomAccessIterator> void
+  //! SearchKnnWarm(P const&, std::vector<IndexType> const&,
+  //! RandomAccessIterator, RandomAccessIterator) const
+  template <typename P>
+  inline void SearchKnnWarm(
+      P const& x,
+      SizeType const k,
+      std::vector<IndexType> const& candidates,
+      std::vector<NeighborType>& knn) const {
+    knn.resize(std::min(k, SpaceWrapperType(space_).size()));
+    SearchKnnWarm(x, candidates, knn.begin(), knn.end());
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x, starting
+  //! from the points with indices \p candidates , and stores the results in
+  //! output vector \p knn. The search uses the scratch memory of \p context .
+  template <typename P>
+  inline void SearchKnnWarm(
+      P const& x,
+      SizeType const k,
+      std::vector<IndexType> const& candidates,
+      std::vector<NeighborType>& knn,
+      SearchContextType& context) const {
+    knn.resize(std::min(k, SpaceWrapperType(space_).size()));
+    SearchKnnWarm(x, candidates, knn.begin(), knn.end(), context);
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x, excluding
+  //! the point with index \p excluded , and stores the results in output
+  //! vector \p knn.
+  //! \details The excluded point never occupies one of the \p k results. This
+  //! makes it unnecessary to search for k + 1 neighbors and remove the query
+  //! point afterwards, which is unreliable in case of duplicate points.
+  //! \tparam P Point type.
+  template <typename P>
+  inline void SearchKnnExcept(
+      P const& x,
+      SizeType const k,
+      IndexType const excluded,
+      std::vector<NeighborType>& knn) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchKnnExcept(x, k, excluded, knn, context);
+    });
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x, excluding
+  //! the point with index \p excluded , and stores the results in output
+  //! vector \p knn. The search uses the scratch memory of \p context .
+  template <typename P>
+  inline void SearchKnnExcept(
+      P const& x,
+      SizeType const k,
+      IndexType const excluded,
+      std::vector<NeighborType>& knn,
+      SearchContextType& context) const {
+    SearchKnnPartial(k, knn, [&](auto& v) {
+      SearchNearestExcept(
+          x, internal::ExcludeIndex<IndexType>(excluded), v, context);
+    });
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x, excluding
+  //! the points of which the index is contained by \p excluded , and stores
+  //! the results in output vector \p knn.
+  //! \details Each point within the search distance is compared against all
+  //! excluded indices. The set of indices is expected to be small.
+  //! \tparam P Point type.
+  template <typename P>
+  inline void SearchKnnExcept(
+      P const& x,
+      SizeType const k,
+      std::vector<IndexType> const& excluded,
+      std::vector<NeighborType>& knn) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchKnnExcept(x, k, excluded, knn, context);
+    });
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x, excluding
+  //! the points of which the index is contained by \p excluded , and stores
+  //! the results in output vector \p knn. The search uses the scratch memory
+  //! of \p context .
+  template <typename P>
+  inline void SearchKnnExcept(
+      P const& x,
+      SizeType const k,
+      std::vector<IndexType> const& excluded,
+      std::vector<NeighborType>& knn,
+      SearchContextType& context) const {
+    SearchKnnPartial(k, knn, [&](auto& v) {
+      SearchNearestExcept(
+          x, internal::ExcludeIndices<IndexType>(excluded), v, context);
+    });
+  }
+
+  //! \brief Searches for all the neighbors of point \p x that are within radius
+  //! \p radius , excluding the point with index \p excluded , and stores the
+  //! results in output vector \p n.
+  //! \tparam P Point type.
+  template <typename P>
+  inline void SearchRadiusExcept(
+      P const& x,
+      ScalarType const radius,
+      IndexType const excluded,
+      std::vector<NeighborType>& n,
+      bool const sort = false) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchRadiusExcept(x, radius, excluded, n, sort, context);
+    });
+  }
+
+  //! \brief Searches for all the neighbors of point \p x that are within radius
+  //! \p radius , excluding the point with index \p excluded , and stores the
+  //! results in output vector \p n. The search uses the scratch memory of
+  //! \p context .
+  template <typename P>
+  inline void SearchRadiusExcept(
+      P const& x,
+      ScalarType const radius,
+      IndexType const excluded,
+      std::vector<NeighborType>& n,
+      bool const sort,
+      SearchContextType& context) const {
+    internal::SearchRadius<NeighborType> v(radius, n);
+    SearchNearestExcept(
+        x, internal::ExcludeIndex<IndexType>(excluded), v, context);
+
+    if (sort) {
+      v.Sort();
+    }
+  }
+
+  //! \brief Searches for all the neighbors of point \p x that are within radius
+  //! \p radius , excluding the points of which the index is contained by
+  //! \p excluded , and stores the results in output vector \p n.
+  //! \tparam P Point type.
+  template <typename P>
+  inline void SearchRadiusExcept(
+      P const& x,
+      ScalarType const radius,
+      std::vector<IndexType> const& excluded,
+      std::vector<NeighborType>& n,
+      bool const sort = false) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchRadiusExcept(x, radius, excluded, n, sort, context);
+    });
+  }
+
+  //! \brief Searches for all the neighbors of point \p x that are within radius
+  //! \p radius , excluding the points of which the index is contained by
+  //! \p excluded , and stores the results in output vector \p n. The search
+  //! uses the scratch memory of \p context .
+  template <typename P>
+  inline void SearchRadiusExcept(
+      P const& x,
+      ScalarType const radius,
+      std::vector<IndexType> const& excluded,
+      std::vector<NeighborType>& n,
+      bool const sort,
+      SearchContextType& context) const {
+    internal::SearchRadius<NeighborType> v(radius, n);
+    SearchNearestExcept(
+        x, internal::ExcludeIndices<IndexType>(excluded), v, context);
+
+    if (sort) {
+      v.Sort();
+    }
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of each point of the tree,
+  //! excluding the point itself, and stores the results in output vector
+  //! \p knns.
+  //! \details The neighbors of the point with index i are stored in the range
+  //! [i * k, (i + 1) * k) of \p knns. Points are excluded by index, such that
+  //! any duplicates of a point are reported as neighbors at distance zero.
+  //! When the tree contains k points or less, k is lowered to the number of
+  //! points minus one.
+  inline void SearchKnnSelf(SizeType k, std::vector<NeighborType>& knns) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchKnnSelf(k, knns, context);
+    });
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of each point of the tree,
+  //! excluding the point itself, and stores the results in output vector
+  //! \p knns. The searches use the scratch memory of \p context .
+  inline void SearchKnnSelf(
+      SizeType k,
+      std::vector<NeighborType>& knns,
+      SearchContextType& context) const {
+    SpaceWrapperType space(space_);
+    SizeType const npts = space.size();
+    k = npts > 0 ? std::min(k, npts - 1) : 0;
+    knns.resize(npts * k);
+
+    for (SizeType i = 0; i < npts && k > 0; ++i) {
+      auto begin = knns.begin() + static_cast<std::ptrdiff_t>(i * k);
+      auto end = begin + static_cast<std::ptrdiff_t>(k);
+      PointMap<ScalarType const, Dim> p(space[i], space.sdim());
+      VisitKnn(begin, end, [&](auto& v) {
+        SearchNearestExcept(
+            p,
+            internal::ExcludeIndex<IndexType>(static_cast<IndexType>(i)),
+            v,
+            context);
+      });
+    }
+  }
+
+  //! \brief Searches for the nearest neighbor of point \p x among the points
+  //! accepted by \p filter.
+  //! \details The filter is either a predicate that is invocable with the index
+  //! of a point or a bitset that is indexed by it, e.g.:
+  //! \code{.cpp}
+  //! std::vector<bool> unassigned(points.size(), true);
+  //! tree.SearchNnIf(p, unassigned, nn);
+  //! \endcode
+  //! Rejected points are skipped before computing their distances. When no
+  //! point is accepted, the distance of \p nn equals the maximum value of
+  //! ScalarType. Only supported for Euclidean spaces.
+  //! \tparam P Point type.
+  //! \tparam F Predicate or bitset type.
+  template <typename P, typename F>
+  inline void SearchNnIf(P const& x, F const& filter, NeighborType& nn) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchNnIf(x, filter, nn, context);
+    });
+  }
+
+  //! \brief Searches for the nearest neighbor of point \p x among the points
+  //! accepted by \p filter. The search uses the scratch memory of
+  //! \p context .
+  template <typename P, typename F>
+  inline void SearchNnIf(
+      P const& x,
+      F const& filter,
+      NeighborType& nn,
+      SearchContextType& context) const {
+    internal::SearchNn<NeighborType> v(nn);
+    SearchNearestIf(x, internal::PointFilter<F>(filter), v, context);
+  }
+
+  //! \brief Searches for the nearest neighbor of point \p x among the points
+  //! of which the mask shares any bit with \p query_mask .
+  //! \details Nodes that don't contain any such points are skipped using the
+  //! node masks of \p masks .
+  //! \see MakeMasks()
+  template <typename P, typename Mask_>
+  inline void SearchNnIf(
+      P const& x,
+      MasksType<Mask_> const& masks,
+      Mask_ const& query_mask,
+      NeighborType& nn) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchNnIf(x, masks, query_mask, nn, context);
+    });
+  }
+
+  //! \brief Searches for the nearest neighbor of point \p x among the points
+  //! of which the mask shares any bit with \p query_mask . The search uses the
+  //! scratch memory of \p context .
+  template <typename P, typename Mask_>
+  inline void SearchNnIf(
+      P const& x,
+      MasksType<Mask_> const& masks,
+      Mask_ const& query_mask,
+      NeighborType& nn,
+      SearchContextType& context) const {
+    internal::SearchNn<NeighborType> v(nn);
+    SearchNearestIf(
+        x, internal::MaskFilter<Mask_>(masks, query_mask), v, context);
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x among the
+  //! points accepted by \p filter and stores the results in output vector
+  //! \p knn.
+  //! \details When less than \p k points are accepted, \p knn contains all of
+  //! them.
+  //! \see template <typename P, typename F> void SearchNnIf(P const&, F const&,
+  //! NeighborType&) const
+  template <typename P, typename F>
+  inline void SearchKnnIf(
+      P const& x,
+      SizeType const k,
+      F const& filter,
+      std::vector<NeighborType>& knn) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchKnnIf(x, k, filter, knn, context);
+    });
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x among the
+  //! points accepted by \p filter and stores the results in output vector
+  //! \p knn. The search uses the scratch memory of \p context .
+  template <typename P, typename F>
+  inline void SearchKnnIf(
+      P const& x,
+      SizeType const k,
+      F const& filter,
+      std::vector<NeighborType>& knn,
+      SearchContextType& context) const {
+    SearchKnnPartial(k, knn, [&](auto& v) {
+      SearchNearestIf(x, internal::PointFilter<F>(filter), v, context);
+    });
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x among the
+  //! points of which the mask shares any bit with \p query_mask and stores
+  //! the results in output vector \p knn.
+  //! \see template <typename P, typename Mask_> void SearchNnIf(P const&,
+  //! MasksType<Mask_> const&, Mask_ const&, NeighborType&) const
+  template <typename P, typename Mask_>
+  inline void SearchKnnIf(
+      P const& x,
+      SizeType const k,
+      MasksType<Mask_> const& masks,
+      Mask_ const& query_mask,
+      std::vector<NeighborType>& knn) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchKnnIf(x, k, masks, query_mask, knn, context);
+    });
+  }
+
+  //! \brief Searches for the \p k nearest neighbors of point \p x among the
+  //! points of which the mask shares any bit with \p query_mask and stores
+  //! the results in output vector \p knn. The search uses the scratch memory
+  //! of \p context .
+  template <typename P, typename Mask_>
+  inline void SearchKnnIf(
+      P const& x,
+      SizeType const k,
+      MasksType<Mask_> const& masks,
+      Mask_ const& query_mask,
+      std::vector<NeighborType>& knn,
+      SearchContextType& context) const {
+    SearchKnnPartial(k, knn, [&](auto& v) {
+      SearchNearestIf(
+          x, internal::MaskFilter<Mask_>(masks, query_mask), v, context);
+    });
+  }
+
+  //! \brief Creates the masks of the points and nodes of the tree given the
+  //! mask of each point \p point_masks , which is indexed by point index.
+  //! \details The mask of a node is the bitwise or of the masks of all its
+  //! points. It allows filtered searches to skip nodes that don't contain any
+  //! matching points. Any integer type or std::bitset can be used as a mask,
+  //! e.g., one bit per label:
+  //! \code{.cpp}
+  //! std::vector<std::uint32_t> labels(points.size());
+  //! // ... labels[i] = std::uint32_t(1) << label_of_point_i;
+  //! auto masks = tree.MakeMasks(labels);
+  //! tree.SearchNnIf(p, masks, std::uint32_t(1) << 3, nn);
+  //! \endcode
+  //! The masks are only valid for this tree.
+  template <typename Mask_>
+  inline MasksType<Mask_> MakeMasks(std::vector<Mask_> point_masks) const {
+    return MasksType<Mask_>(
+        std::move(point_masks), data_.root_node, data_.indices);
+  }
+
   //! \brief Searches for all the neighbors of point \p x that are within radius
   //! \p radius and stores the results in output vector \p n.
   //! \details Interpretation of the in and output distances depend on the
@@ -224,8 +771,25 @@ class KdTree {
       ScalarType const radius,
       std::vector<NeighborType>& n,
       bool const sort = false) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchRadius(x, radius, n, sort, context);
+    });
+  }
+
+  //! \brief Searches for all the neighbors of point \p x that are within radius
+  //! \p radius and stores the results in output vector \p n. The search uses
+  //! the scratch memory of \p context .
+  //! \see template <typename P> void SearchRadius(P const&, ScalarType,
+  //! std::vector<NeighborType>&, bool) const
+  template <typename P>
+  inline void SearchRadius(
+      P const& x,
+      ScalarType const radius,
+      std::vector<NeighborType>& n,
+      bool const sort,
+      SearchContextType& context) const {
     internal::SearchRadius<NeighborType> v(radius, n);
-    SearchNearest(x, v);
+    SearchNearest(x, v, context);
 
     if (sort) {
       v.Sort();
@@ -245,14 +809,159 @@ class KdTree {
       ScalarType const e,
       std::vector<NeighborType>& n,
       bool const sort = false) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchRadius(x, radius, e, n, sort, context);
+    });
+  }
+
+  //! \brief Searches for all approximate neighbors of point \p x that are
+  //! within radius \p radius and stores the results in output vector \p n. The
+  //! search uses the scratch memory of \p context .
+  template <typename P>
+  inline void SearchRadius(
+      P const& x,
+      ScalarType const radius,
+      ScalarType const e,
+      std::vector<NeighborType>& n,
+      bool const sort,
+      SearchContextType& context) const {
     internal::SearchApproximateRadius<NeighborType> v(e, radius, n);
-    SearchNearest(x, v);
+    SearchNearest(x, v, context);
 
     if (sort) {
       v.Sort();
     }
   }
 
+  //! \brief Returns the number of neighbors of point \p x that are within
+  //! radius \p radius.
+  //! \details Nodes that lie entirely within the radius are counted without
+  //! visiting their points. The result equals the number of neighbors that is
+  //! stored by SearchRadius(P const&, ScalarType, RandomAccessIterator,
+  //! RandomAccessIterator) const. Only supported for Euclidean spaces.
+  template <typename P>
+  inline SizeType SearchRadiusCount(
+      P const& x, ScalarType const radius) const {
+    SizeType count;
+    WithSearchContext([&](SearchContextType& context) {
+      count = SearchRadiusCount(x, radius, context);
+    });
+    return count;
+  }
+
+  //! \brief Returns the number of neighbors of point \p x that are within
+  //! radius \p radius. The search uses the scratch memory of \p context .
+  template <typename P>
+  inline SizeType SearchRadiusCount(
+      P const& x, ScalarType const radius, SearchContextType& context) const {
+    SizeType count;
+    internal::SearchRadiusCount<NeighborType> v(radius, count);
+    SearchRadiusEuclidean(x, v, context);
+    return count;
+  }
+
+  //! \brief Searches for all the neighbors of point \p x that are within radius
+  //! \p radius and stores the results in the range [begin, end).
+  //! \details The size of the range should equal the number of neighbors
+  //! returned by SearchRadiusCount(). Together, they allow the neighbors of
+  //! many queries to be stored in a single preallocated array, as done by
+  //! SearchRadiusCsr(). The neighbors are not sorted. Only supported for
+  //! Euclidean spaces.
+  //! \tparam P Point type.
+  //! \tparam RandomAccessIterator Iterator type.
+  template <typename P, typename RandomAccessIterator>
+  inline void SearchRadius(
+      P const& x,
+      ScalarType const radius,
+      RandomAccessIterator begin,
+      RandomAccessIterator end) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchRadius(x, radius, begin, end, context);
+    });
+  }
+
+  //! \brief Searches for all the neighbors of point \p x that are within radius
+  //! \p radius and stores the results in the range [begin, end). The search
+  //! uses the scratch memory of \p context .
+  template <typename P, typename RandomAccessIterator>
+  inline void SearchRadius(
+      P const& x,
+      ScalarType const radius,
+      RandomAccessIterator begin,
+      RandomAccessIterator end,
+      SearchContextType& context) const {
+    static_assert(
+        std::is_same_v<
+            typename std::iterator_traits<RandomAccessIterator>::value_type,
+            NeighborType>,
+        "ITERATOR_VALUE_TYPE_DOES_NOT_EQUAL_NEIGHBOR_TYPE_INDEX_SCALAR");
+
+    internal::SearchRadiusRange<RandomAccessIterator> v(radius, begin, end);
+    SearchRadiusEuclidean(x, v, context);
+  }
+
+  //! \brief Searches for the neighbors within radius \p radius of each point
+  //! of \p queries and stores them in compressed sparse row (CSR) format.
+  //! \details The neighbors of query i are stored in the range [offsets[i],
+  //! offsets[i + 1]) of \p neighbors. A first pass counts the neighbors of
+  //! each query using SearchRadiusCount(), a second pass stores them using
+  //! SearchRadius(P const&, ScalarType, RandomAccessIterator,
+  //! RandomAccessIterator) const. This avoids a separate vector per query.
+  //! Only supported for Euclidean spaces.
+  //!
+  //! Both passes run sequentially. The queries of each pass are independent,
+  //! such that a caller may run them in parallel by calling SearchRadiusCount()
+  //! and SearchRadius() directly, using a SearchContextType per thread.
+  //! \tparam Queries_ Type of space of the queries.
+  //! \param sort If true, the neighbors of each query are sorted from closest
+  //! to farthest distance with respect to that query.
+  template <typename Queries_>
+  inline void SearchRadiusCsr(
+      Queries_ const& queries,
+      ScalarType const radius,
+      std::vector<SizeType>& offsets,
+      std::vector<NeighborType>& neighbors,
+      bool const sort = false) const {
+    WithSearchContext([&](SearchContextType& context) {
+      SearchRadiusCsr(queries, radius, offsets, neighbors, sort, context);
+    });
+  }
+
+  //! \brief Searches for the neighbors within radius \p radius of each point
+  //! of \p queries and stores them in compressed sparse row (CSR) format. The
+  //! search uses the scratch memory of \p context .
+  template <typename Queries_>
+  inline void SearchRadiusCsr(
+      Queries_ const& queries,
+      ScalarType const radius,
+      std::vector<SizeType>& offsets,
+      std::vector<NeighborType>& neighbors,
+      bool const sort,
+      SearchContextType& context) const {
+    using QueriesTraitsType = SpaceTraits<Queries_>;
+
+    SizeType const count = QueriesTraitsType::size(queries);
+    offsets.resize(count + 1);
+    offsets[0] = 0;
+    for (SizeType i = 0; i < count; ++i) {
+      offsets[i + 1] = SearchRadiusCount(
+          QueriesTraitsType::PointAt(queries, i), radius, context);
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    neighbors.resize(offsets.back());
+    for (SizeType i = 0; i < count; ++i) {
+      auto begin = neighbors.begin() + static_cast<std::ptrdiff_t>(offsets[i]);
+      auto end =
+          neighbors.begin() + static_cast<std::ptrdiff_t>(offsets[i + 1]);
+      SearchRadius(
+          QueriesTraitsType::PointAt(queries, i), radius, begin, end, context);
+      if (sort) {
+        std::sort(begin, end);
+      }
+    }
+  }
+
   //! \brief Returns all points within the box defined by \p min and \p max.
   //! Query time is bounded by O(n^(1-1/Dim)+k).
   //! \tparam P Point type.
@@ -284,10 +993,14 @@ class KdTree {
   inline MetricType const& metric() const { return metric_; }
 
   //! \brief Loads the tree in binary from file.
-  static KdTree Load(SpaceType points, std::string const& filename) {
+  //! \details The metric is not stored and can be provided using \p metric .
+  static KdTree Load(
+      SpaceType points,
+      std::string const& filename,
+      MetricType metric = MetricType()) {
     std::fstream stream =
         internal::OpenStream(filename, std::ios::in | std::ios::binary);
-    return Load(std::move(points), stream);
+    return Load(std::move(points), stream, std::move(metric));
   }
 
   //! \brief Loads the tree in binary from \p stream .
@@ -298,9 +1011,12 @@ class KdTree {
   //! point set.
   //! \li Does not check if the stored tree structure is valid for the given
   //! template arguments.
-  static KdTree Load(SpaceType points, std::iostream& stream) {
+  static KdTree Load(
+      SpaceType points,
+      std::iostream& stream,
+      MetricType metric = MetricType()) {
     internal::Stream s(stream);
-    return KdTree(std::move(points), s);
+    return KdTree(std::move(points), s, std::move(metric));
   }
 
   //! \brief Saves the tree in binary to file.
@@ -323,41 +1039,245 @@ class KdTree {
  private:
   //! \brief Constructs a KdTree by reading its indexing and leaf information
   //! from a Stream.
-  KdTree(SpaceType space, internal::Stream& stream)
+  KdTree(SpaceType space, internal::Stream& stream, MetricType metric)
       : space_(std::move(space)),
-        metric_(),
+        metric_(std::move(metric)),
         data_(KdTreeDataType::Load(stream)) {}
 
+  //! \brief Returns the nearest neighbor (or neighbors) of point \p x depending
+  //! on their selection by visitor \p visitor . Only points and nodes accepted
+  //! by \p filter are visited.
+  template <typename P, typename V, typename Filter_>
+  inline void SearchNearest(
+      P const& x,
+      V& visitor,
+      SearchContextType& context,
+      Filter_ filter) const {
+    internal::PointWrapper<P> p(x);
+    SpaceWrapperType space(space_);
+
+    if constexpr (Dim == kDynamicSize) {
+      if (internal::DispatchStaticDim(space.sdim(), [&](auto dim) {
+            Size constexpr kDim = decltype(dim)::value;
+            internal::Point<ScalarType, kDim> node_box_offset;
+            SearchNearest(
+                internal::StaticDimSpaceWrapper<SpaceWrapperType, kDim>(space),
+                internal::StaticDimPointWrapper<ScalarType, kDim>(p.begin()),
+                node_box_offset,
+                visitor,
+                filter,
+                typename Metric_::SpaceTag());
+          })) {
+        return;
+      }
+    }
+
+    SearchNearest(
+        space,
+        p,
+        context.node_box_offset(space.sdim()),
+        visitor,
+        filter,
+        typename Metric_::SpaceTag());
+  }
+
+  //! \brief Filtered version of SearchNearest(P const&, V&,
+  //! SearchContextType&) const.
+  template <typename P, typename Filter_, typename V>
+  inline void SearchNearestIf(
+      P const& x,
+      Filter_ filter,
+      V& visitor,
+      SearchContextType& context) const {
+    static_assert(
+        std::is_same_v<typename Metric_::SpaceTag, EuclideanSpaceTag>,
+        "FILTERED_SEARCH_ONLY_SUPPORTED_FOR_EUCLIDEAN_SPACES");
+
+    SearchNearest(x, visitor, context, filter);
+  }
+
+  //! \brief Returns the nearest neighbor (or neighbors) of point \p x depending
+  //! on their selection by visitor \p visitor . Points excluded by \p exclude
+  //! never reach the visitor.
+  template <typename P, typename Exclude_, typename V>
+  inline void SearchNearestExcept(
+      P const& x,
+      Exclude_ exclude,
+      V& visitor,
+      SearchContextType& context) const {
+    internal::SearchExcluding<V, Exclude_> v(visitor, exclude);
+    SearchNearest(x, v, context);
+  }
+
+  //! \brief Visits the points with indices \p candidates before searching for
+  //! the nearest neighbors of point \p x using knn visitor \p visitor . The
+  //! candidates are not visited a second time.
+  template <typename P, typename V>
+  inline void SearchNearestWarm(
+      P const& x,
+      std::vector<IndexType> const& candidates,
+      V& visitor,
+      SearchContextType& context) const {
+    internal::PointWrapper<P> p(x);
+    SpaceWrapperType space(space_);
+    internal::EpochBitset& visited = context.indices(space.size());
+
+    for (IndexType const idx : candidates) {
+      if (!visited.Insert(idx)) {
+        continue;
+      }
+      ScalarType const d = metric_(p.begin(), p.end(), space[idx]);
+      if (visitor.max() > d) {
+        visitor(idx, d);
+      }
+    }
+
+    internal::SearchSkipCandidates<V, IndexType> v(visitor, visited);
+    SearchNearest(x, v, context);
+  }
+
+  //! \brief Runs \p search with a knn visitor that stores its results in the
+  //! range [begin, end).
+  template <typename RandomAccessIterator, typename Search_>
+  inline void VisitKnn(
+      RandomAccessIterator begin,
+      RandomAccessIterator end,
+      Search_ search) const {
+    if (begin == end) {
+      return;
+    }
+
+    if (static_cast<SizeType>(std::distance(begin, end)) <
+        internal::kSearchKnnHeapMinK) {
+      internal::SearchKnn<RandomAccessIterator> v(begin, end);
+      search(v);
+    } else {
+      internal::SearchKnnHeap<RandomAccessIterator> v(begin, end);
+      search(v);
+      v.Sort();
+    }
+  }
+
+  //! \brief Runs \p search with a knn visitor for at most \p k neighbors that
+  //! are stored in \p knn. The search may find less than \p k neighbors.
+  //! Unused neighbors keep their maximum distance and are removed afterwards.
+  template <typename Search_>
+  inline void SearchKnnPartial(
+      SizeType const k,
+      std::vector<NeighborType>& knn,
+      Search_ search) const {
+    knn.assign(
+        std::min(k, SpaceWrapperType(space_).size()),
+        NeighborType{IndexType(0), std::numeric_limits<ScalarType>::max()});
+    VisitKnn(knn.begin(), knn.end(), search);
+    knn.erase(
+        std::find_if(
+            knn.begin(),
+            knn.end(),
+            [](NeighborType const& n) {
+              return n.distance == std::numeric_limits<ScalarType>::max();
+            }),
+        knn.end());
+  }
+
   //! \brief Returns the nearest neighbor (or neighbors) of point \p x depending
   //! on their selection by visitor \p visitor for node \p node.
-  template <typename PointWrapper_, typename Visitor_>
+  template <
+      typename SpaceWrapper_,
+      typename PointWrapper_,
+      typename Point_,
+      typename Visitor_,
+      typename Filter_>
   inline void SearchNearest(
-      PointWrapper_ point, Visitor_& visitor, EuclideanSpaceTag) const {
+      SpaceWrapper_ space,
+      PointWrapper_ point,
+      Point_& node_box_offset,
+      Visitor_& visitor,
+      Filter_ filter,
+      EuclideanSpaceTag) const {
     internal::SearchNearestEuclidean<
-        SpaceWrapperType,
+        SpaceWrapper_,
         Metric_,
         PointWrapper_,
         Visitor_,
-        IndexType>(
-        SpaceWrapperType(space_), metric_, data_.indices, point, visitor)(
-        data_.root_node);
+        IndexType,
+        Filter_>(
+        space,
+        metric_,
+        data_.indices,
+        point,
+        node_box_offset,
+        visitor,
+        filter)(data_.root_node);
   }
 
   //! \brief Returns the nearest neighbor (or neighbors) of point \p x depending
   //! on their selection by visitor \p visitor for node \p node.
-  template <typename PointWrapper_, typename Visitor_>
+  template <
+      typename SpaceWrapper_,
+      typename PointWrapper_,
+      typename Point_,
+      typename Visitor_>
   inline void SearchNearest(
-      PointWrapper_ point, Visitor_& visitor, TopologicalSpaceTag) const {
+      SpaceWrapper_ space,
+      PointWrapper_ point,
+      Point_& node_box_offset,
+      Visitor_& visitor,
+      internal::NoFilter,
+      TopologicalSpaceTag) const {
     internal::SearchNearestTopological<
-        SpaceWrapperType,
+        SpaceWrapper_,
         Metric_,
         PointWrapper_,
         Visitor_,
         IndexType>(
-        SpaceWrapperType(space_), metric_, data_.indices, point, visitor)(
+        space, metric_, data_.indices, point, node_box_offset, visitor)(
         data_.root_node);
   }
 
+  //! \brief Visits all points of which the distance to point \p x is within
+  //! the radius of visitor \p visitor .
+  template <typename P, typename Visitor_>
+  inline void SearchRadiusEuclidean(
+      P const& x, Visitor_& visitor, SearchContextType& context) const {
+    internal::PointWrapper<P> p(x);
+    SpaceWrapperType space(space_);
+
+    internal::SearchRadiusEuclidean<
+        SpaceWrapperType,
+        Metric_,
+        internal::PointWrapper<P>,
+        Visitor_,
+        IndexType>(
+        space,
+        metric_,
+        data_.indices,
+        p,
+        context.node_box(data_.root_box),
+        context.node_box_offset(space.sdim()),
+        context.node_box_far_offset(space.sdim()),
+        visitor)(data_.root_node);
+  }
+
+  //! \brief Returns the scratch memory that is reused by all searches of the
+  //! current thread.
+  static inline SearchContextType& ThreadSearchContext() {
+    static thread_local SearchContextType context;
+    return context;
+  }
+
+  //! \brief Runs \p search with the default scratch memory of a search.
+  template <typename Search_>
+  inline void WithSearchContext(Search_ search) const {
+    if constexpr (Dim != kDynamicSize) {
+      // Without a run time dimension the scratch memory lives on the stack.
+      SearchContextType context;
+      search(context);
+    } else {
+      search(ThreadSearchContext());
+    }
+  }
+
   //! \brief Point set used for querying point data.
   SpaceType space_;
   //! \brief Metric used for comparing distances.
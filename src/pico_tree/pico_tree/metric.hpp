@@ -1,5 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iterator>
+#include <tuple>
+#include <utility>
+
 #include "core.hpp"
 
 namespace pico_tree {
@@ -12,6 +19,8 @@ template <typename T>
 inline T constexpr kPi = T(3.14159265358979323846l);
 template <typename T>
 inline T constexpr kTwoPi = T(6.28318530717958647693l);
+template <typename T>
+inline T constexpr kHalfPi = T(1.57079632679489661923l);
 
 //! \brief Calculates the square of a number.
 template <typename Scalar_>
@@ -67,11 +76,34 @@ constexpr Scalar_ SquaredDistanceBox(Scalar_ x, Scalar_ min, Scalar_ max) {
   return Squared(DistanceBox(x, min, max));
 }
 
+//! \brief Calculates the distance between two coordinates on a circle with
+//! circumference \p length.
+//! \details Both coordinates should lie within an interval of size \p length.
+template <typename Scalar_>
+constexpr Scalar_ PeriodicDistance(Scalar_ x, Scalar_ y, Scalar_ length) {
+  Scalar_ const d = std::abs(x - y);
+  return std::min(d, length - d);
+}
+
+//! \brief Calculates the distance between coordinate \p x and the box defined
+//! by [ \p min, \p max ] on a circle with circumference \p length.
+template <typename Scalar_>
+constexpr Scalar_ PeriodicDistanceBox(
+    Scalar_ x, Scalar_ min, Scalar_ max, Scalar_ length) {
+  // Rectangles can't currently wrap around the identification of the interval
+  // where the minimum is larger than he maximum.
+  if (x < min || x > max) {
+    return std::min(
+        PeriodicDistance(x, min, length), PeriodicDistance(x, max, length));
+  } else {
+    return Scalar_(0.0);
+  }
+}
+
 //! \brief Calculates the angular distance between two coordinates.
 template <typename Scalar_>
 constexpr Scalar_ AngleDistance(Scalar_ x, Scalar_ y) {
-  Scalar_ const d = std::abs(x - y);
-  return std::min(d, internal::kTwoPi<Scalar_> - d);
+  return PeriodicDistance(x, y, internal::kTwoPi<Scalar_>);
 }
 
 //! \brief Calculates the squared angular distance between two coordinates.
@@ -84,20 +116,14 @@ constexpr Scalar_ SquaredAngleDistance(Scalar_ x, Scalar_ y) {
 //! defined by [ \p min, \p max ].
 template <typename Scalar_>
 constexpr Scalar_ AngleDistanceBox(Scalar_ x, Scalar_ min, Scalar_ max) {
-  // Rectangles can't currently wrap around the identification of PI ~ -PI
-  // where the minimum is larger than he maximum.
-  if (x < min || x > max) {
-    return std::min(AngleDistance(x, min), AngleDistance(x, max));
-  } else {
-    return Scalar_(0.0);
-  }
+  return PeriodicDistanceBox(x, min, max, internal::kTwoPi<Scalar_>);
 }
 
 //! \brief Calculates the squared angular distance between a coordinate and a
 //! box.
 template <typename Scalar_>
 constexpr Scalar_ SquaredAngleDistanceBox(Scalar_ x, Scalar_ min, Scalar_ max) {
-  return Squared(AngleDistance(x, min, max));
+  return Squared(AngleDistanceBox(x, min, max));
 }
 
 //! \brief Calculates the squared angular distance between two coordinates.
@@ -109,6 +135,37 @@ struct AngleDistanceFn {
   }
 };
 
+//! \brief Calculates the squared chordal distance between two unit
+//! quaternions, where q ~ -q: min(|q1 - q2|^2, |q1 + q2|^2).
+//! \details For unit quaternions it equals 2 - 2 * |dot(q1, q2)| but it is
+//! calculated without loss of precision for small distances.
+template <typename InputIterator1, typename InputIterator2>
+constexpr auto SquaredQuaternionDistance(
+    InputIterator1 begin1, InputIterator2 begin2) {
+  using ScalarType = typename std::iterator_traits<InputIterator1>::value_type;
+
+  ScalarType d_minus{};
+  ScalarType d_plus{};
+
+  for (int i = 0; i < 4; ++i, ++begin1, ++begin2) {
+    d_minus += Squared(*begin1 - *begin2);
+    d_plus += Squared(*begin1 + *begin2);
+  }
+
+  return std::min(d_minus, d_plus);
+}
+
+//! \brief Calculates the squared distance between quaternion coordinate \p x
+//! and the box defined by [ \p min, \p max ], where q ~ -q.
+//! \details The sum of these distances for all four coordinates is a lower
+//! bound for both |q1 - q2|^2 and |q1 + q2|^2, and therefore for their minimum.
+template <typename Scalar_>
+constexpr Scalar_ SquaredQuaternionDistanceBox(
+    Scalar_ x, Scalar_ min, Scalar_ max) {
+  return std::min(
+      SquaredDistanceBox(x, min, max), SquaredDistanceBox(-x, min, max));
+}
+
 template <
     typename InputIterator1,
     typename InputSentinel1,
@@ -130,6 +187,26 @@ constexpr auto Sum(
   return d;
 }
 
+//! \brief Calculates the distance between coordinate \p v and the split value
+//! \p x of dimension \p dim.
+//! \details Metrics for Euclidean spaces that weigh dimensions differently can
+//! provide the box distance that takes the dimension. Otherwise the coordinate
+//! distance is used.
+template <typename Metric_, typename Scalar_>
+constexpr Scalar_ SplitDistance(
+    Metric_ const& metric, Scalar_ x, Scalar_ v, int dim) {
+  if constexpr (std::is_invocable_v<
+                    Metric_ const&,
+                    Scalar_,
+                    Scalar_,
+                    Scalar_,
+                    int>) {
+    return metric(v, x, x, dim);
+  } else {
+    return metric(x, v);
+  }
+}
+
 }  // namespace internal
 
 //! \brief Identifies a metric to support the most generic space that can be
@@ -142,6 +219,15 @@ constexpr auto Sum(
 //! circle represented by the interval [-PI, PI]. Here, -PI and PI are the same
 //! point on the circle and performing a radius query around both values should
 //! result in the same point set.
+//!
+//! A metric for a topological space calculates the distance between a query
+//! coordinate and the box of a node along a single dimension. When this
+//! distance depends on the other coordinates of the query, the metric can
+//! provide an overload that takes the entire query instead:
+//! \code{.cpp}
+//! Scalar operator()(Iterator begin, Sentinel end, Scalar min, Scalar max,
+//!     int dim) const;
+//! \endcode
 class TopologicalSpaceTag {};
 
 //! \brief Identifies a metric to support the Euclidean space with PicoTree's
@@ -245,6 +331,71 @@ struct LInf {
   }
 };
 
+//! \brief The WeightedL2Squared semimetric measures squared Euclidean distances
+//! between points for which each dimension has its own weight.
+//! \details The distance equals sum_i w_i * (x_i - y_i)^2. It is applied
+//! directly by the distance calculations of the search, such that the input
+//! points don't have to be rescaled. The weights are stored by value and
+//! Dim_ should be known at compile time. The metric has to be passed to the
+//! constructor of the tree:
+//! \code{.cpp}
+//! WeightedL2Squared<float, 3> metric({1.0f, 4.0f, 0.25f});
+//! KdTree<Space, WeightedL2Squared<float, 3>> tree(points, 8, metric);
+//! \endcode
+//! \see L2Squared
+template <typename Scalar_, Size Dim_>
+class WeightedL2Squared {
+  static_assert(Dim_ != kDynamicSize, "WEIGHTED_L2_SQUARED_DIM_NOT_FIXED");
+
+ public:
+  //! \brief This tag specifies the supported space by this metric.
+  using SpaceTag = EuclideanSpaceTag;
+  //! \brief Scalar type of the weights.
+  using ScalarType = Scalar_;
+  //! \brief Spatial dimension.
+  static Size constexpr Dim = Dim_;
+
+  //! \brief Creates a WeightedL2Squared metric with a weight per dimension.
+  explicit WeightedL2Squared(std::array<ScalarType, Dim> const& weights)
+      : weights_(weights) {}
+
+  template <
+      typename InputIterator1,
+      typename InputSentinel1,
+      typename InputIterator2>
+  constexpr ScalarType operator()(
+      InputIterator1 begin1, InputSentinel1, InputIterator2 begin2) const {
+    ScalarType d{};
+
+    for (Size i = 0; i < Dim; ++i, ++begin1, ++begin2) {
+      d += weights_[i] * internal::SquaredDistance(
+                             static_cast<ScalarType>(*begin1),
+                             static_cast<ScalarType>(*begin2));
+    }
+
+    return d;
+  }
+
+  //! \brief Calculates the weighted squared distance between coordinate \p x
+  //! and the box defined by [ \p min, \p max ] along dimension \p dim.
+  constexpr ScalarType operator()(
+      ScalarType x, ScalarType min, ScalarType max, int dim) const {
+    return weights_[static_cast<Size>(dim)] *
+           internal::SquaredDistanceBox(x, min, max);
+  }
+
+  //! \brief Returns the squared value of \p x.
+  constexpr ScalarType operator()(ScalarType x) const {
+    return internal::Squared(x);
+  }
+
+  //! \brief Returns the weight of each dimension.
+  inline std::array<ScalarType, Dim> const& weights() const { return weights_; }
+
+ private:
+  std::array<ScalarType, Dim> weights_;
+};
+
 //! \brief The SO2 metric measures distances on the unit circle S1. It is the
 //! intrinsic metric of points in R2 on S1 given by the great-circel distance.
 //! \details Named after the Special Orthogonal Group of dimension 2. The circle
@@ -282,6 +433,37 @@ struct SO2 {
   }
 };
 
+//! \brief The SO2Squared metric measures squared distances on the unit circle
+//! S1. It is mostly useful as a component of a ProductMetric.
+//! \see SO2
+struct SO2Squared {
+  //! \brief This tag specifies the supported space by this metric.
+  using SpaceTag = TopologicalSpaceTag;
+
+  template <
+      typename InputIterator1,
+      typename InputSentinel1,
+      typename InputIterator2>
+  constexpr auto operator()(
+      InputIterator1 begin1, InputSentinel1, InputIterator2 begin2) const {
+    return internal::SquaredAngleDistance(*begin1, *begin2);
+  }
+
+  //! \brief Calculates the squared distance between coordinate \p x and the box
+  //! defined by [ \p min, \p max ].
+  //! \details The last argument is the dimension. It is ignored here.
+  template <typename Scalar_>
+  constexpr Scalar_ operator()(Scalar_ x, Scalar_ min, Scalar_ max, int) const {
+    return internal::SquaredAngleDistanceBox(x, min, max);
+  }
+
+  //! \brief Returns the squared value of \p x.
+  template <typename Scalar_>
+  constexpr Scalar_ operator()(Scalar_ x) const {
+    return internal::Squared(x);
+  }
+};
+
 //! \brief The SE2Squared metric measures distances in Euclidean space between
 //! Euclidean motions.
 //! \details Named after the Special Euclidean group of dimension 2.
@@ -323,4 +505,473 @@ struct SE2Squared {
   }
 };
 
+//! \brief The SO3Squared metric measures squared chordal distances between
+//! rotations in 3D represented by unit quaternions.
+//! \details Named after the Special Orthogonal Group of dimension 3. The four
+//! coordinates of a point are those of a unit quaternion. Their order is not
+//! relevant to the metric. Because q and -q represent the same rotation, the
+//! distance between two rotations is given by min(|q1 - q2|^2, |q1 + q2|^2).
+//! It equals 4 * sin(theta / 4)^2, where theta is the angle of the rotation
+//! between them.
+//!
+//! For more details:
+//! * https://en.wikipedia.org/wiki/3D_rotation_group
+//! * https://en.wikipedia.org/wiki/Quaternions_and_spatial_rotation
+struct SO3Squared {
+  //! \brief This tag specifies the supported space by this metric.
+  using SpaceTag = TopologicalSpaceTag;
+
+  template <
+      typename InputIterator1,
+      typename InputSentinel1,
+      typename InputIterator2>
+  constexpr auto operator()(
+      InputIterator1 begin1, InputSentinel1, InputIterator2 begin2) const {
+    return internal::SquaredQuaternionDistance(begin1, begin2);
+  }
+
+  //! \brief Calculates the squared distance between coordinate \p x and the box
+  //! defined by [ \p min, \p max ].
+  //! \details The last argument is the dimension. It is ignored here.
+  template <typename Scalar_>
+  constexpr Scalar_ operator()(Scalar_ x, Scalar_ min, Scalar_ max, int) const {
+    return internal::SquaredQuaternionDistanceBox(x, min, max);
+  }
+
+  //! \brief Returns the squared chordal distance of rotation angle \p x.
+  template <typename Scalar_>
+  constexpr Scalar_ operator()(Scalar_ x) const {
+    return Scalar_(4.0) * internal::Squared(std::sin(x / Scalar_(4.0)));
+  }
+};
+
+//! \brief The SE3Squared metric measures weighted squared distances between
+//! rigid motions in 3D.
+//! \details Named after the Special Euclidean group of dimension 3. The first
+//! three coordinates of a point are those of the translation. The last four are
+//! those of a unit quaternion that represents the rotation. The distance equals
+//! the squared Euclidean distance between translations plus the weighted
+//! SO3Squared distance between rotations. The weight balances the units of
+//! translation against those of rotation.
+//! \see SO3Squared
+template <typename Scalar_>
+class SE3Squared {
+ public:
+  //! \brief This tag specifies the supported space by this metric.
+  using SpaceTag = TopologicalSpaceTag;
+  //! \brief Scalar type of the weight.
+  using ScalarType = Scalar_;
+
+  //! \brief Creates an SE3Squared metric that weights rotational distances by
+  //! \p rotation_weight.
+  constexpr explicit SE3Squared(ScalarType rotation_weight = ScalarType(1.0))
+      : rotation_weight_(rotation_weight) {}
+
+  template <
+      typename InputIterator1,
+      typename InputSentinel1,
+      typename InputIterator2>
+  constexpr auto operator()(
+      InputIterator1 begin1, InputSentinel1, InputIterator2 begin2) const {
+    return internal::Sum(
+               begin1, begin1 + 3, begin2, internal::SquaredDistanceFn()) +
+           rotation_weight_ *
+               internal::SquaredQuaternionDistance(begin1 + 3, begin2 + 3);
+  }
+
+  //! \brief Calculates the squared distance between coordinate \p x and the box
+  //! defined by [ \p min, \p max ] along dimension \p dim.
+  constexpr ScalarType operator()(
+      ScalarType x, ScalarType min, ScalarType max, int dim) const {
+    if (dim < 3) {
+      return internal::SquaredDistanceBox(x, min, max);
+    } else {
+      return rotation_weight_ *
+             internal::SquaredQuaternionDistanceBox(x, min, max);
+    }
+  }
+
+  //! \brief Returns the squared value of \p x.
+  constexpr ScalarType operator()(ScalarType x) const {
+    return internal::Squared(x);
+  }
+
+  //! \brief Returns the weight of rotational distances.
+  constexpr ScalarType rotation_weight() const { return rotation_weight_; }
+
+ private:
+  ScalarType rotation_weight_;
+};
+
+//! \brief The Haversine metric measures distances between points on the unit
+//! sphere S2 given by their latitude and longitude.
+//! \details Coordinates are in radians. The latitude is the first coordinate
+//! and is represented by the range [-PI/2, PI/2]. The longitude is the second
+//! coordinate and is represented by the range [-PI, PI] / -PI ~ PI.
+//!
+//! The metric returns the haversine of the great-circle distance theta between
+//! two points: hav(theta) = sin(theta / 2)^2. It increases monotonically with
+//! theta and theta = 2 * asin(sqrt(hav(theta))). The distance on a sphere with
+//! radius R equals R * theta. The haversine equals a term that only depends on
+//! the latitudes of both points plus a term that is bounded from below by the
+//! longitude range of a box. This results in tight box distances without
+//! converting points to R3.
+//!
+//! For more details:
+//! * https://en.wikipedia.org/wiki/Haversine_formula
+//! * https://en.wikipedia.org/wiki/Great-circle_distance
+struct Haversine {
+  //! \brief This tag specifies the supported space by this metric.
+  using SpaceTag = TopologicalSpaceTag;
+
+  template <
+      typename InputIterator1,
+      typename InputSentinel1,
+      typename InputIterator2>
+  constexpr auto operator()(
+      InputIterator1 begin1, InputSentinel1, InputIterator2 begin2) const {
+    using ScalarType =
+        typename std::iterator_traits<InputIterator1>::value_type;
+
+    ScalarType const lat1 = *begin1;
+    ScalarType const lat2 = *begin2;
+    // The haversine of the longitude is periodic and handles the wrapping.
+    return internal::Squared(std::sin((lat1 - lat2) / ScalarType(2.0))) +
+           std::cos(lat1) * std::cos(lat2) *
+               internal::Squared(std::sin(
+                   (*(begin1 + 1) - *(begin2 + 1)) / ScalarType(2.0)));
+  }
+
+  //! \brief Calculates the distance between the query [ \p begin, \p end ) and
+  //! the box defined by [ \p min, \p max ] along dimension \p dim.
+  //! \details Using the Cartesian coordinates of points on the sphere,
+  //! hav(theta) = |p - q|^2 / 4, where the z coordinate only depends on the
+  //! latitude. The latitude term is the squared difference between z
+  //! coordinates. The longitude term is bounded by the squared distance between
+  //! the projection of the query on the xy-plane and the wedge that contains
+  //! the projections of all points within the longitude range.
+  template <typename InputIterator_, typename InputSentinel_, typename Scalar_>
+  constexpr Scalar_ operator()(
+      InputIterator_ begin,
+      InputSentinel_,
+      Scalar_ min,
+      Scalar_ max,
+      int dim) const {
+    Scalar_ const lat = *begin;
+
+    if (dim == 0) {
+      return internal::Squared(
+                 std::sin(lat) - std::sin(std::clamp(lat, min, max))) /
+             Scalar_(4.0);
+    } else {
+      Scalar_ const d = internal::AngleDistanceBox(*(begin + 1), min, max);
+      // Beyond a quarter circle the closest point of the wedge is its apex,
+      // i.e., one of the poles.
+      Scalar_ const s =
+          d < internal::kHalfPi<Scalar_> ? std::sin(d) : Scalar_(1.0);
+      return internal::Squared(std::cos(lat) * s) / Scalar_(4.0);
+    }
+  }
+
+  //! \brief Returns the haversine of great-circle distance \p x.
+  template <typename Scalar_>
+  constexpr Scalar_ operator()(Scalar_ x) const {
+    return internal::Squared(std::sin(x / Scalar_(2.0)));
+  }
+};
+
+//! \brief The PeriodicL2Squared metric measures squared Euclidean distances
+//! between points inside a periodic box, i.e., on a flat torus.
+//! \details Each dimension wraps around with the length of the box in that
+//! dimension, such that the nearest neighbor of a point can be found across the
+//! boundary of the box. This is also known as the minimum image convention.
+//! Coordinates, including those of query points, should lie within an interval
+//! of the length of their dimension, e.g., [0, length).
+//!
+//! The metric stores the length of each dimension and has to be passed to the
+//! constructor of the tree:
+//! \code{.cpp}
+//! PeriodicL2Squared<float, 3> metric({10.0f, 10.0f, 20.0f});
+//! KdTree<Space, PeriodicL2Squared<float, 3>> tree(points, 8, metric);
+//! \endcode
+template <typename Scalar_, Size Dim_>
+class PeriodicL2Squared {
+  static_assert(Dim_ != kDynamicSize, "PERIODIC_L2_SQUARED_DIM_NOT_FIXED");
+
+ public:
+  //! \brief This tag specifies the supported space by this metric.
+  using SpaceTag = TopologicalSpaceTag;
+  //! \brief Scalar type of the box lengths.
+  using ScalarType = Scalar_;
+  //! \brief Spatial dimension.
+  static Size constexpr Dim = Dim_;
+
+  //! \brief Creates a PeriodicL2Squared metric for a cube with sides of length
+  //! \p length.
+  explicit PeriodicL2Squared(ScalarType length) { lengths_.fill(length); }
+
+  //! \brief Creates a PeriodicL2Squared metric for a box with sides of lengths
+  //! \p lengths.
+  explicit PeriodicL2Squared(std::array<ScalarType, Dim> const& lengths)
+      : lengths_(lengths) {}
+
+  template <
+      typename InputIterator1,
+      typename InputSentinel1,
+      typename InputIterator2>
+  constexpr auto operator()(
+      InputIterator1 begin1, InputSentinel1, InputIterator2 begin2) const {
+    ScalarType d{};
+
+    for (Size i = 0; i < Dim; ++i, ++begin1, ++begin2) {
+      d += internal::Squared(internal::PeriodicDistance(
+          static_cast<ScalarType>(*begin1),
+          static_cast<ScalarType>(*begin2),
+          lengths_[i]));
+    }
+
+    return d;
+  }
+
+  //! \brief Calculates the squared distance between coordinate \p x and the box
+  //! defined by [ \p min, \p max ] along dimension \p dim.
+  constexpr ScalarType operator()(
+      ScalarType x, ScalarType min, ScalarType max, int dim) const {
+    return internal::Squared(internal::PeriodicDistanceBox(
+        x, min, max, lengths_[static_cast<Size>(dim)]));
+  }
+
+  //! \brief Returns the squared value of \p x.
+  constexpr ScalarType operator()(ScalarType x) const {
+    return internal::Squared(x);
+  }
+
+  //! \brief Returns the length of the box for each dimension.
+  inline std::array<ScalarType, Dim> const& lengths() const { return lengths_; }
+
+ private:
+  std::array<ScalarType, Dim> lengths_;
+};
+
+//! \brief A MetricComponent describes a factor of the Cartesian product of
+//! spaces of a ProductMetric. Metric Metric_ measures the distance between Dim_
+//! consecutive coordinates of two points.
+template <typename Metric_, Size Dim_>
+struct MetricComponent {
+  static_assert(Dim_ != kDynamicSize, "METRIC_COMPONENT_DIM_NOT_FIXED");
+
+  //! \brief Metric of the component.
+  using MetricType = Metric_;
+  //! \brief Number of coordinates of the component.
+  static Size constexpr Dim = Dim_;
+};
+
+//! \brief The ProductMetric measures distances in the Cartesian product of
+//! spaces. Its distance equals the weighted sum of the distances of each of its
+//! components.
+//! \details Each component is a MetricComponent that measures distances for a
+//! consecutive range of coordinates using an existing metric. The components
+//! are resolved at compile time: Point distances are a sum that is fully
+//! expanded by the compiler, and box distances are looked up per dimension in a
+//! table that is generated at compile time. The metrics of the components
+//! should return values that can be summed, e.g., squared distances.
+//!
+//! The following metric is equivalent to SE2Squared:
+//! \code{.cpp}
+//! using Metric = ProductMetric<
+//!     float,
+//!     MetricComponent<L2Squared, 2>,
+//!     MetricComponent<SO2Squared, 1>>;
+//! \endcode
+//! The product R3 x S1 x S1, with a smaller weight for both angles:
+//! \code{.cpp}
+//! using Metric = ProductMetric<
+//!     float,
+//!     MetricComponent<L2Squared, 3>,
+//!     MetricComponent<SO2Squared, 1>,
+//!     MetricComponent<SO2Squared, 1>>;
+//! KdTree<Space, Metric> tree(points, 8, Metric({1.0f, 0.5f, 0.5f}));
+//! \endcode
+template <typename Scalar_, typename... Components_>
+class ProductMetric {
+  static_assert(sizeof...(Components_) > 0, "PRODUCT_METRIC_HAS_NO_COMPONENTS");
+
+  using ComponentIndices = std::index_sequence_for<Components_...>;
+
+  template <Size Index_>
+  using ComponentType =
+      std::tuple_element_t<Index_, std::tuple<Components_...>>;
+
+ public:
+  //! \brief This tag specifies the supported space by this metric.
+  using SpaceTag = TopologicalSpaceTag;
+  //! \brief Scalar type of the weights.
+  using ScalarType = Scalar_;
+  //! \brief Spatial dimension. It equals the sum of the dimensions of each
+  //! component.
+  static Size constexpr Dim = (Components_::Dim + ...);
+  //! \brief Number of components.
+  static Size constexpr ComponentCount = sizeof...(Components_);
+
+  //! \brief Creates a ProductMetric for which each component has a weight of 1.
+  constexpr ProductMetric() : ProductMetric(Ones(ComponentIndices())) {}
+
+  //! \brief Creates a ProductMetric using a weight per component.
+  constexpr explicit ProductMetric(
+      std::array<ScalarType, ComponentCount> const& weights)
+      : weights_(weights), metrics_() {}
+
+  //! \brief Creates a ProductMetric using a weight per component and the
+  //! metrics of the components.
+  constexpr explicit ProductMetric(
+      std::array<ScalarType, ComponentCount> const& weights,
+      typename Components_::MetricType... metrics)
+      : weights_(weights), metrics_(metrics...) {}
+
+  template <
+      typename InputIterator1,
+      typename InputSentinel1,
+      typename InputIterator2>
+  constexpr ScalarType operator()(
+      InputIterator1 begin1, InputSentinel1, InputIterator2 begin2) const {
+    return Distance(begin1, begin2, ComponentIndices());
+  }
+
+  //! \brief Calculates the distance between the query [ \p begin, \p end ) and
+  //! the box defined by [ \p min, \p max ] along dimension \p dim.
+  //! \details The distance is calculated by the component that contains
+  //! dimension \p dim.
+  template <typename InputIterator_, typename InputSentinel_>
+  constexpr ScalarType operator()(
+      InputIterator_ begin,
+      InputSentinel_,
+      ScalarType min,
+      ScalarType max,
+      int dim) const {
+    return kBoxDistance<InputIterator_>[static_cast<Size>(dim)](
+        *this, begin, min, max);
+  }
+
+  //! \brief Returns the value of \p x according to the metric of the first
+  //! component.
+  constexpr ScalarType operator()(ScalarType x) const {
+    return std::get<0>(metrics_)(x);
+  }
+
+  //! \brief Returns the weight of each component.
+  constexpr std::array<ScalarType, ComponentCount> const& weights() const {
+    return weights_;
+  }
+
+ private:
+  template <typename InputIterator_>
+  using BoxDistanceFn = ScalarType (*)(
+      ProductMetric const&, InputIterator_, ScalarType, ScalarType);
+
+  template <Size... I_>
+  static constexpr std::array<ScalarType, ComponentCount> Ones(
+      std::index_sequence<I_...>) {
+    return {((void)I_, ScalarType(1.0))...};
+  }
+
+  //! \brief Returns the first coordinate of each component.
+  static constexpr std::array<Size, ComponentCount + 1> Offsets() {
+    std::array<Size, ComponentCount + 1> offsets{};
+    std::array<Size, ComponentCount> dims{Components_::Dim...};
+    for (Size i = 0; i < ComponentCount; ++i) {
+      offsets[i + 1] = offsets[i] + dims[i];
+    }
+    return offsets;
+  }
+
+  //! \brief Returns the index of the component that contains dimension \p dim.
+  static constexpr Size ComponentOf(Size dim) {
+    Size i = 0;
+    while (kOffsets[i + 1] <= dim) {
+      ++i;
+    }
+    return i;
+  }
+
+  template <
+      typename InputIterator1,
+      typename InputIterator2,
+      std::size_t... I_>
+  constexpr ScalarType Distance(
+      InputIterator1 begin1,
+      InputIterator2 begin2,
+      std::index_sequence<I_...>) const {
+    return (
+        (weights_[I_] *
+         static_cast<ScalarType>(std::get<I_>(metrics_)(
+             begin1 + kOffsets[I_],
+             begin1 + kOffsets[I_ + 1],
+             begin2 + kOffsets[I_]))) +
+        ...);
+  }
+
+  //! \brief Calculates the box distance for dimension Dim_ using the metric of
+  //! the component that contains it.
+  template <Size Dim_, typename InputIterator_>
+  static constexpr ScalarType BoxDistance(
+      ProductMetric const& product,
+      InputIterator_ begin,
+      ScalarType min,
+      ScalarType max) {
+    constexpr Size kIndex = ComponentOf(Dim_);
+    constexpr Size kOffset = kOffsets[kIndex];
+    constexpr int kLocalDim = static_cast<int>(Dim_ - kOffset);
+    using MetricType = typename ComponentType<kIndex>::MetricType;
+
+    MetricType const& metric = std::get<kIndex>(product.metrics_);
+    ScalarType const x = static_cast<ScalarType>(*(begin + Dim_));
+    ScalarType d;
+    // A dimension aware box distance takes precedence, such that metrics like
+    // WeightedL2Squared apply their per dimension weights.
+    if constexpr (std::is_invocable_v<
+                      MetricType const&,
+                      ScalarType,
+                      ScalarType,
+                      ScalarType,
+                      int>) {
+      d = metric(x, min, max, kLocalDim);
+    } else if constexpr (std::is_invocable_v<
+                             MetricType const&,
+                             InputIterator_,
+                             InputIterator_,
+                             ScalarType,
+                             ScalarType,
+                             int>) {
+      d = metric(
+          begin + kOffset,
+          begin + kOffsets[kIndex + 1],
+          min,
+          max,
+          kLocalDim);
+    } else {
+      static_assert(
+          std::is_same_v<typename MetricType::SpaceTag, EuclideanSpaceTag>,
+          "COMPONENT_METRIC_DOES_NOT_SUPPORT_BOX_DISTANCE");
+      d = metric(internal::DistanceBox(x, min, max));
+    }
+    return product.weights_[kIndex] * d;
+  }
+
+  template <typename InputIterator_, Size... Dims_>
+  static constexpr std::array<BoxDistanceFn<InputIterator_>, Dim>
+  BoxDistanceTable(std::index_sequence<Dims_...>) {
+    return {&BoxDistance<Dims_, InputIterator_>...};
+  }
+
+  static constexpr std::array<Size, ComponentCount + 1> kOffsets = Offsets();
+
+  template <typename InputIterator_>
+  static constexpr std::array<BoxDistanceFn<InputIterator_>, Dim>
+      kBoxDistance =
+          BoxDistanceTable<InputIterator_>(std::make_index_sequence<Dim>());
+
+  std::array<ScalarType, ComponentCount> weights_;
+  std::tuple<typename Components_::MetricType...> metrics_;
+};
+
 }  // namespace pico_tree
@@ -229,6 +229,17 @@ input points and store the result in the specified output.
           R"ptdoc(
 Search for the approximate neighbors within a radius of each of the
 input points.
+)ptdoc")
+      .def(
+          "search_radius_csr",
+          &KdTree::SearchRadiusCsr,
+          py::arg("pts").noconvert().none(false),
+          py::arg("radius").none(false),
+          py::arg("sort").none(false) = false,
+          R"ptdoc(
+Search for all neighbors within a radius of each of the input points.
+Returns a tuple of offsets and neighbors. The neighbors of point i are
+neighbors[offsets[i]:offsets[i + 1]].
 )ptdoc")
       .def(
           "search_box",
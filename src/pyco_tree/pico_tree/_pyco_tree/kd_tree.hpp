@@ -2,8 +2,11 @@
 
 #include <pybind11/numpy.h>
 
+#include <algorithm>
+#include <numeric>
 #include <pico_tree/kd_tree.hpp>
 #include <thread>
+#include <tuple>
 
 #include "darray.hpp"
 #include "py_array_map.hpp"
@@ -141,6 +144,48 @@ class KdTree : public pico_tree::KdTree<Space_, Metric_> {
     return nns;
   }
 
+  //! \brief Searches for the neighbors within radius \p radius of each point
+  //! of \p pts and returns them in compressed sparse row (CSR) format.
+  //! \details The neighbors of point i are stored at [offsets[i],
+  //! offsets[i + 1]) of a single array. The first pass counts the neighbors of
+  //! each point, the second pass stores them. This avoids a separate vector
+  //! per point.
+  std::tuple<py::array_t<SizeType, 0>, py::array_t<NeighborType, 0>>
+  SearchRadiusCsr(
+      py::array_t<ScalarType, 0> const pts,
+      ScalarType const radius,
+      bool const sort) const {
+    auto query = MakeMap<Dim>(pts);
+    SSize const npts = static_cast<SSize>(query.size());
+
+    py::array_t<SizeType, 0> offsets(static_cast<py::ssize_t>(npts + 1));
+    auto offsets_data = static_cast<SizeType*>(offsets.mutable_data());
+    offsets_data[0] = 0;
+
+#pragma omp parallel for schedule(dynamic, kChunkSize)
+    for (SSize i = 0; i < npts; ++i) {
+      offsets_data[i + 1] = Base::SearchRadiusCount(query[i], radius);
+    }
+
+    std::partial_sum(offsets_data, offsets_data + npts + 1, offsets_data);
+
+    py::array_t<NeighborType, 0> nns(
+        static_cast<py::ssize_t>(offsets_data[npts]));
+    auto nns_data = static_cast<NeighborType*>(nns.mutable_data());
+
+#pragma omp parallel for schedule(dynamic, kChunkSize)
+    for (SSize i = 0; i < npts; ++i) {
+      NeighborType* begin = nns_data + offsets_data[i];
+      NeighborType* end = nns_data + offsets_data[i + 1];
+      Base::SearchRadius(query[i], radius, begin, end);
+      if (sort) {
+        std::sort(begin, end);
+      }
+    }
+
+    return {offsets, nns};
+  }
+
   void SearchBox(
       py::array_t<ScalarType, 0> const boxes, DArray& indices) const {
     auto query = MakeMap<Dim>(boxes);
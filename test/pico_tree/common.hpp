@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <limits>
 #include <pico_tree/core.hpp>
 #include <pico_tree/internal/space_wrapper.hpp>
 #include <pico_tree/map_traits.hpp>
@@ -206,3 +207,57 @@ void TestKnn(Tree const& tree, typename Tree::IndexType const k) {
 
   TestKnn(tree, k, p);
 }
+
+//! \brief Search visitor that ends the search once it found \p n points within
+//! radius \p radius.
+template <typename Index, typename Scalar>
+class SearchFirstN {
+ public:
+  using NeighborType = pico_tree::Neighbor<Index, Scalar>;
+
+  SearchFirstN(Scalar radius, std::size_t n)
+      : radius_(radius), n_(n), visited_(0) {}
+
+  inline void operator()(Index const idx, Scalar const dst) {
+    ++visited_;
+    if (max() > dst) {
+      hits_.push_back({idx, dst});
+    }
+  }
+
+  inline bool done() const { return hits_.size() >= n_; }
+
+  inline Scalar max() const { return radius_; }
+
+  inline std::vector<NeighborType> const& hits() const { return hits_; }
+
+  inline std::size_t visited() const { return visited_; }
+
+ private:
+  Scalar radius_;
+  std::size_t n_;
+  std::size_t visited_;
+  std::vector<NeighborType> hits_;
+};
+
+//! \brief Tests that a search ends once its visitor is done. The function
+//! \p search should search the neighbors of a single query using the visitor
+//! it receives.
+//! \details Engines check if a visitor is done after each leaf. A search may
+//! therefore find more points than requested.
+template <typename Index, typename Scalar, typename Search>
+void TestDone(Scalar const radius, Search search) {
+  SearchFirstN<Index, Scalar> all(
+      radius, std::numeric_limits<std::size_t>::max());
+  search(all);
+  ASSERT_GT(all.hits().size(), std::size_t(1));
+
+  SearchFirstN<Index, Scalar> first(radius, 1);
+  search(first);
+  EXPECT_GE(first.hits().size(), std::size_t(1));
+  EXPECT_LT(first.hits().size(), all.hits().size());
+  EXPECT_LT(first.visited(), all.visited());
+  for (auto const& h : first.hits()) {
+    EXPECT_LT(h.distance, radius);
+  }
+}
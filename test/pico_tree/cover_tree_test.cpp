@@ -1,7 +1,14 @@
 #include <gtest/gtest.h>
 
+#include <array>
+#include <cstdint>
+#include <random>
+#include <sstream>
+
 #include <pico_toolshed/point.hpp>
+#include <pico_tree/array_traits.hpp>
 #include <pico_tree/vector_traits.hpp>
+#include <pico_understory/brute_force.hpp>
 #include <pico_understory/cover_tree.hpp>
 
 #include "common.hpp"
@@ -46,6 +53,40 @@ void QueryKnn(
   TestKnn(tree2, static_cast<Index>(k));
 }
 
+//! Compares the nearest neighbors of the tree with those of the points that
+//! are marked as contained.
+template <typename Tree, typename PointX>
+void CheckKnnContained(
+    Tree const& tree,
+    std::vector<PointX> const& points,
+    std::vector<bool> const& contained,
+    std::size_t const k) {
+  using Neighbor = typename Tree::NeighborType;
+
+  std::vector<PointX> queries = GenerateRandomN<PointX>(32, 100.0f);
+  for (auto const& q : queries) {
+    std::vector<Neighbor> compare;
+    for (std::size_t i = 0; i < points.size(); ++i) {
+      if (contained[i]) {
+        compare.push_back(
+            {static_cast<int>(i),
+             tree.metric()(q.data(), q.data() + q.size(), points[i].data())});
+      }
+    }
+    std::sort(compare.begin(), compare.end());
+    compare.resize(std::min(k, compare.size()));
+
+    std::vector<Neighbor> knn;
+    tree.SearchKnn(q, k, knn);
+
+    ASSERT_EQ(knn.size(), compare.size());
+    for (std::size_t i = 0; i < knn.size(); ++i) {
+      EXPECT_TRUE(contained[static_cast<std::size_t>(knn[i].index)]);
+      FloatEq(knn[i].distance, compare[i].distance);
+    }
+  }
+}
+
 }  // namespace
 
 TEST(CoverTreeTest, QueryRadiusSubset2d) {
@@ -55,3 +96,248 @@ TEST(CoverTreeTest, QueryRadiusSubset2d) {
 TEST(CoverTreeTest, QueryKnn1) { QueryKnn<Point2f>(1024 * 128, 100.0f, 1); }
 
 TEST(CoverTreeTest, QueryKnn10) { QueryKnn<Point2f>(1024 * 128, 100.0f, 10); }
+
+TEST(CoverTreeTest, BreadthFirstLayout) {
+  using PointX = Point2f;
+  using Scalar = typename PointX::ScalarType;
+  using SpaceWrapper = pico_tree::internal::SpaceWrapper<std::vector<PointX>>;
+  using BuildCoverTree =
+      pico_tree::internal::BuildCoverTree<SpaceWrapper, pico_tree::L2, int>;
+
+  // Large enough such that subtrees are build concurrently.
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  SpaceWrapper space(random);
+  auto data = BuildCoverTree()(space, pico_tree::L2(), Scalar(2.0), 4);
+
+  ASSERT_EQ(data.nodes.size(), random.size());
+  ASSERT_EQ(data.points.size(), random.size());
+
+  // Each node is the child of exactly one node and the children of a node
+  // directly follow the children of the node before it.
+  int next = 1;
+  std::vector<int> count(random.size(), 0);
+  for (std::size_t i = 0; i < data.nodes.size(); ++i) {
+    auto const& node = data.nodes[i];
+    EXPECT_EQ(node.children_begin, next);
+    EXPECT_LE(node.children_begin, node.children_end);
+    next = node.children_end;
+    count[node.index]++;
+
+    for (pico_tree::Size j = 0; j < space.sdim(); ++j) {
+      EXPECT_EQ(data.points.data(i)[j], space[node.index][j]);
+    }
+  }
+  EXPECT_EQ(next, static_cast<int>(random.size()));
+  EXPECT_TRUE(
+      std::all_of(count.begin(), count.end(), [](int c) { return c == 1; }));
+}
+
+TEST(CoverTreeTest, QueryKnnBestFirst) {
+  using PointX = Point2f;
+  using Index = int;
+  using Scalar = typename PointX::ScalarType;
+  using Neighbor = pico_tree::Neighbor<Index, Scalar>;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  std::vector<PointX> queries = GenerateRandomN<PointX>(64, 100.0f);
+  CoverTree<PointX> tree(random, Scalar(2.0));
+
+  std::size_t const k = 8;
+  for (auto const& q : queries) {
+    std::vector<Neighbor> depth_first;
+    tree.SearchKnn(q, k, depth_first);
+    std::vector<Neighbor> best_first;
+    tree.SearchKnnBestFirst(q, k, best_first);
+
+    ASSERT_EQ(best_first.size(), depth_first.size());
+    for (std::size_t i = 0; i < k; ++i) {
+      EXPECT_EQ(best_first[i].index, depth_first[i].index);
+      FloatEq(best_first[i].distance, depth_first[i].distance);
+    }
+  }
+}
+
+TEST(CoverTreeTest, QueryDone) {
+  using PointX = Point2f;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  CoverTree<PointX> tree(random, 2.0f);
+  PointX q = random[random.size() / 2];
+  float const radius = tree.metric()(10.0f);
+
+  TestDone<int>(radius, [&tree, &q](auto& v) { tree.SearchNearest(q, v); });
+  TestDone<int>(
+      radius, [&tree, &q](auto& v) { tree.SearchNearestBestFirst(q, v); });
+}
+
+TEST(CoverTreeTest, QueryKnnDuplicates) {
+  using PointX = Point2f;
+  using Index = int;
+  using Scalar = typename PointX::ScalarType;
+
+  // Duplicate points cannot be separated by any level of the tree.
+  std::vector<PointX> random = GenerateRandomN<PointX>(256, 100.0f);
+  std::vector<PointX> duplicates;
+  for (int i = 0; i < 4; ++i) {
+    duplicates.insert(duplicates.end(), random.begin(), random.end());
+  }
+  CoverTree<PointX> tree(duplicates, Scalar(1.3));
+
+  TestKnn(tree, Index(8));
+}
+
+TEST(CoverTreeTest, InsertRemove) {
+  using PointX = Point2f;
+  using Scalar = typename PointX::ScalarType;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 4, 100.0f);
+  std::vector<PointX> more = GenerateRandomN<PointX>(1024 * 4, 100.0f);
+  std::vector<bool> contained(random.size() + more.size(), true);
+
+  CoverTree<PointX> tree(random, Scalar(1.3));
+  std::size_t const k = 8;
+
+  // New points are first added to the point set and then to the tree.
+  for (auto const& p : more) {
+    random.push_back(p);
+    tree.Insert(static_cast<int>(random.size() - 1));
+  }
+  EXPECT_EQ(tree.size(), random.size());
+  CheckKnnContained(tree, random, contained, k);
+
+  for (std::size_t i = 0; i < random.size(); i += 3) {
+    tree.Remove(static_cast<int>(i));
+    contained[i] = false;
+  }
+  CheckKnnContained(tree, random, contained, k);
+
+  tree.Compact();
+  EXPECT_EQ(
+      tree.size(),
+      static_cast<pico_tree::Size>(
+          std::count(contained.begin(), contained.end(), true)));
+  CheckKnnContained(tree, random, contained, k);
+
+  // Removed points can be inserted again.
+  tree.Insert(0);
+  contained[0] = true;
+  CheckKnnContained(tree, random, contained, k);
+}
+
+TEST(CoverTreeTest, RemoveAll) {
+  using PointX = Point2f;
+  using Scalar = typename PointX::ScalarType;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(64, 100.0f);
+  std::vector<bool> contained(random.size(), false);
+  CoverTree<PointX> tree(random, Scalar(2.0));
+
+  for (std::size_t i = 0; i < random.size(); ++i) {
+    tree.Remove(static_cast<int>(i));
+  }
+  tree.Compact();
+  EXPECT_EQ(tree.size(), 0);
+  CheckKnnContained(tree, random, contained, 4);
+
+  tree.Insert(5);
+  tree.Insert(7);
+  contained[5] = true;
+  contained[7] = true;
+  CheckKnnContained(tree, random, contained, 4);
+}
+
+TEST(CoverTreeTest, Deterministic) {
+  using PointX = Point2f;
+  using Scalar = typename PointX::ScalarType;
+  using SpaceWrapper = pico_tree::internal::SpaceWrapper<std::vector<PointX>>;
+  using BuildCoverTree =
+      pico_tree::internal::BuildCoverTree<SpaceWrapper, pico_tree::L2, int>;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  SpaceWrapper space(random);
+  auto data1 = BuildCoverTree()(space, pico_tree::L2(), Scalar(1.3), 1);
+  auto data4 = BuildCoverTree()(space, pico_tree::L2(), Scalar(1.3), 4);
+
+  // The number of threads doesn't affect the structure of the tree.
+  ASSERT_EQ(data1.nodes.size(), data4.nodes.size());
+  for (std::size_t i = 0; i < data1.nodes.size(); ++i) {
+    EXPECT_EQ(data1.nodes[i].index, data4.nodes[i].index);
+    EXPECT_EQ(data1.nodes[i].level, data4.nodes[i].level);
+    EXPECT_EQ(data1.nodes[i].max_distance, data4.nodes[i].max_distance);
+    EXPECT_EQ(data1.nodes[i].children_begin, data4.nodes[i].children_begin);
+    EXPECT_EQ(data1.nodes[i].children_end, data4.nodes[i].children_end);
+  }
+}
+
+TEST(CoverTreeTest, SaveLoad) {
+  using PointX = Point2f;
+  using Scalar = typename PointX::ScalarType;
+  using Neighbor = typename CoverTree<PointX>::NeighborType;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 4, 100.0f);
+  std::vector<PointX> queries = GenerateRandomN<PointX>(32, 100.0f);
+  CoverTree<PointX> tree(random, Scalar(1.3));
+  // A modified tree is stored as if it were compacted.
+  tree.Remove(1);
+
+  std::stringstream stream;
+  CoverTree<PointX>::Save(tree, stream);
+  CoverTree<PointX> loaded = CoverTree<PointX>::Load(random, stream);
+  EXPECT_EQ(loaded.size(), tree.size());
+
+  std::size_t const k = 8;
+  for (auto const& q : queries) {
+    std::vector<Neighbor> knn;
+    std::vector<Neighbor> compare;
+    tree.SearchKnn(q, k, knn);
+    loaded.SearchKnn(q, k, compare);
+
+    ASSERT_EQ(knn.size(), compare.size());
+    for (std::size_t i = 0; i < knn.size(); ++i) {
+      EXPECT_EQ(knn[i].index, compare[i].index);
+      FloatEq(knn[i].distance, compare[i].distance);
+    }
+  }
+}
+
+TEST(CoverTreeTest, QueryKnnHamming) {
+  using Descriptor = std::array<std::uint64_t, 4>;
+  using Space = std::reference_wrapper<std::vector<Descriptor>>;
+  using Neighbor = pico_tree::Neighbor<int, float>;
+
+  // Descriptors are generated around a few centers such that the data has some
+  // structure.
+  std::mt19937_64 e(7);
+  std::uniform_int_distribution<int> bit(0, 255);
+  std::vector<Descriptor> centers(16);
+  for (auto& c : centers) {
+    c = {e(), e(), e(), e()};
+  }
+  std::vector<Descriptor> descriptors(1024 * 4);
+  for (std::size_t i = 0; i < descriptors.size(); ++i) {
+    descriptors[i] = centers[i % centers.size()];
+    for (int j = 0; j < 16; ++j) {
+      int b = bit(e);
+      descriptors[i][b / 64] ^= std::uint64_t(1) << (b % 64);
+    }
+  }
+
+  pico_tree::CoverTree<Space, pico_tree::Hamming> tree(descriptors, 1.3f);
+  pico_tree::BruteForce<Space, pico_tree::Hamming> brute_force(descriptors);
+
+  std::size_t const k = 8;
+  for (std::size_t i = 0; i < 64; ++i) {
+    Descriptor const& q = descriptors[i * 61];
+    std::vector<Neighbor> knn;
+    std::vector<Neighbor> compare;
+    tree.SearchKnn(q, k, knn);
+    brute_force.SearchKnn(q, k, compare);
+
+    ASSERT_EQ(knn.size(), compare.size());
+    EXPECT_EQ(knn[0].distance, 0.0f);
+    for (std::size_t j = 0; j < k; ++j) {
+      // Many descriptors share the same distance. Only distances are compared.
+      EXPECT_EQ(knn[j].distance, compare[j].distance);
+    }
+  }
+}
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+
+#include <pico_toolshed/point.hpp>
+#include <pico_tree/kd_tree.hpp>
+#include <pico_tree/vector_traits.hpp>
+#include <pico_understory/inner_product.hpp>
+#include <pico_understory/kd_forest.hpp>
+
+namespace {
+
+using PointX = Point3f;
+using Scalar = typename PointX::ScalarType;
+using Space = std::reference_wrapper<std::vector<PointX>>;
+using Neighbor = pico_tree::Neighbor<int, Scalar>;
+
+Scalar Dot(PointX const& a, PointX const& b) {
+  Scalar d = Scalar(0);
+  for (std::size_t i = 0; i < PointX::Dim; ++i) {
+    d += a[i] * b[i];
+  }
+  return d;
+}
+
+Scalar Cosine(PointX const& a, PointX const& b) {
+  return Dot(a, b) / std::sqrt(Dot(a, a) * Dot(b, b));
+}
+
+//! Returns the k largest similarities between \p q and each of the \p points.
+template <typename Similarity_>
+std::vector<Scalar> TopK(
+    std::vector<PointX> const& points,
+    PointX const& q,
+    std::size_t k,
+    Similarity_ similarity) {
+  std::vector<Scalar> s;
+  for (auto const& p : points) {
+    s.push_back(similarity(q, p));
+  }
+  std::sort(s.begin(), s.end(), std::greater<Scalar>());
+  s.resize(k);
+  return s;
+}
+
+void CheckTopK(std::vector<Neighbor> const& knn, std::vector<Scalar> const& s) {
+  ASSERT_EQ(knn.size(), s.size());
+  for (std::size_t i = 0; i < knn.size(); ++i) {
+    EXPECT_NEAR(knn[i].distance, s[i], 1e-2f);
+  }
+}
+
+}  // namespace
+
+TEST(InnerProductTest, CosineKdTree) {
+  using Tree = pico_tree::
+      KdTree<pico_tree::CosineSpaceType<Space>, pico_tree::L2Squared>;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 4, -1.0f, 1.0f);
+  std::vector<PointX> queries = GenerateRandomN<PointX>(32, -1.0f, 1.0f);
+  pico_tree::CosineSearch<Tree> search(random, 8);
+
+  std::size_t const k = 8;
+  for (auto const& q : queries) {
+    std::vector<Neighbor> knn;
+    search.SearchKnn(q, k, knn);
+    // Similarities are compared with a loose tolerance because the KdTree
+    // computes them from squared distances.
+    CheckTopK(knn, TopK(random, q, k, Cosine));
+  }
+}
+
+TEST(InnerProductTest, MipsKdTree) {
+  using Tree =
+      pico_tree::KdTree<pico_tree::MipsSpaceType<Space>, pico_tree::L2Squared>;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 4, -1.0f, 1.0f);
+  std::vector<PointX> queries = GenerateRandomN<PointX>(32, -1.0f, 1.0f);
+  pico_tree::MipsSearch<Tree> search(random, 8);
+
+  std::size_t const k = 8;
+  for (auto const& q : queries) {
+    std::vector<Neighbor> knn;
+    search.SearchKnn(q, k, knn);
+    CheckTopK(knn, TopK(random, q, k, Dot));
+  }
+}
+
+TEST(InnerProductTest, MipsKdForest) {
+  using Forest = pico_tree::KdForest<
+      pico_tree::MipsSpaceType<Space>,
+      pico_tree::L2Squared,
+      pico_tree::SplittingRule::kRandomTopVariance>;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 4, -1.0f, 1.0f);
+  std::vector<PointX> queries = GenerateRandomN<PointX>(32, -1.0f, 1.0f);
+  pico_tree::MipsSearch<Forest> search(random, 8, 4);
+
+  std::size_t const k = 8;
+  for (auto const& q : queries) {
+    std::vector<Neighbor> knn;
+    // Visiting all leaves results in an exhaustive search.
+    search.SearchKnn(q, k, random.size(), knn);
+    CheckTopK(knn, TopK(random, q, k, Dot));
+  }
+}
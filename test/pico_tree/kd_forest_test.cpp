@@ -0,0 +1,393 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+#include <pico_toolshed/point.hpp>
+#include <pico_tree/vector_traits.hpp>
+#include <pico_understory/kd_forest.hpp>
+#include <pico_understory/kd_forest_tuner.hpp>
+
+#include "common.hpp"
+
+namespace {
+
+template <typename PointX>
+using Space = std::reference_wrapper<std::vector<PointX>>;
+
+template <typename PointX>
+using KdForest = pico_tree::KdForest<Space<PointX>>;
+
+template <typename Forest_, typename PointX>
+void CheckSaveLoad(
+    std::vector<PointX>& random, Forest_ const& forest, bool save_spaces) {
+  using Neighbor = typename Forest_::NeighborType;
+
+  std::stringstream stream;
+  Forest_::Save(forest, stream, save_spaces);
+  Forest_ loaded = Forest_::Load(random, stream);
+
+  std::vector<PointX> queries = GenerateRandomN<PointX>(32, 100.0f);
+  pico_tree::Size const k = 8;
+  pico_tree::Size const max_leaves_visited = 16;
+
+  for (auto const& q : queries) {
+    std::vector<Neighbor> knn;
+    std::vector<Neighbor> compare;
+    forest.SearchKnn(q, k, max_leaves_visited, knn);
+    loaded.SearchKnn(q, k, max_leaves_visited, compare);
+
+    // The loaded forest has the exact same rotations and trees.
+    ASSERT_EQ(knn.size(), compare.size());
+    for (std::size_t i = 0; i < knn.size(); ++i) {
+      EXPECT_EQ(knn[i].index, compare[i].index);
+      FloatEq(knn[i].distance, compare[i].distance);
+    }
+  }
+}
+
+template <typename Forest_, typename PointX>
+void CheckSeed(std::vector<PointX>& random) {
+  using Neighbor = typename Forest_::NeighborType;
+
+  Forest_ forest(random, 8, 4, 42);
+  Forest_ same(random, 8, 4, 42);
+
+  std::vector<PointX> queries = GenerateRandomN<PointX>(32, 100.0f);
+  pico_tree::Size const k = 8;
+  pico_tree::Size const max_leaves_visited = 4;
+
+  for (auto const& q : queries) {
+    std::vector<Neighbor> knn;
+    std::vector<Neighbor> compare;
+    forest.SearchKnn(q, k, max_leaves_visited, knn);
+    same.SearchKnn(q, k, max_leaves_visited, compare);
+
+    // Forests built with the same seed have the exact same trees. This holds
+    // for approximate results as well.
+    ASSERT_EQ(knn.size(), compare.size());
+    for (std::size_t i = 0; i < knn.size(); ++i) {
+      EXPECT_EQ(knn[i].index, compare[i].index);
+      FloatEq(knn[i].distance, compare[i].distance);
+    }
+  }
+}
+
+}  // namespace
+
+TEST(KdForestTest, Seed) {
+  using PointX = Point3f;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+
+  CheckSeed<KdForest<PointX>>(random);
+  CheckSeed<pico_tree::KdForest<
+      Space<PointX>,
+      pico_tree::L2Squared,
+      pico_tree::SplittingRule::kRandomTopVariance>>(random);
+}
+
+TEST(KdForestTest, QueryNnExhaustive) {
+  using PointX = Point3f;
+  using Index = int;
+  using Scalar = typename PointX::ScalarType;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  KdForest<PointX> forest(random, 8, 4);
+
+  // Moving the forest "tests" the move constructor.
+  auto forest2 = std::move(forest);
+
+  std::vector<PointX> queries = GenerateRandomN<PointX>(64, 100.0f);
+  std::size_t const max_leaves_visited = random.size();
+
+  for (auto const& q : queries) {
+    pico_tree::Neighbor<Index, Scalar> nn;
+    forest2.SearchNn(q, max_leaves_visited, nn);
+
+    std::vector<pico_tree::Neighbor<Index, Scalar>> compare;
+    SearchKnn<pico_tree::SpaceTraits<Space<PointX>>>(
+        q, random, 1, forest2.metric(), &compare);
+
+    ASSERT_EQ(compare.size(), 1);
+    // Distances are calculated in a rotated space.
+    EXPECT_NEAR(nn.distance, compare[0].distance, 1e-2f);
+  }
+}
+
+TEST(KdForestTest, QueryNnBudget) {
+  using PointX = Point3f;
+  using Index = int;
+  using Scalar = typename PointX::ScalarType;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  KdForest<PointX> forest(random, 8, 4);
+
+  PointX q = random[random.size() / 2];
+  pico_tree::Neighbor<Index, Scalar> nn;
+  // Each tree is descended at least once.
+  forest.SearchNn(q, 1, nn);
+
+  EXPECT_GE(nn.index, 0);
+  EXPECT_LT(nn.index, static_cast<Index>(random.size()));
+  EXPECT_NEAR(nn.distance, Scalar(0.0), 1e-2f);
+}
+
+TEST(KdForestTest, QueryKnnExhaustive) {
+  using PointX = Point3f;
+  using Index = int;
+  using Scalar = typename PointX::ScalarType;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  KdForest<PointX> forest(random, 8, 4);
+
+  PointX q = random[random.size() / 2];
+  pico_tree::Size const k = 10;
+  std::vector<pico_tree::Neighbor<Index, Scalar>> knn;
+  forest.SearchKnn(q, k, random.size(), knn);
+
+  std::vector<pico_tree::Neighbor<Index, Scalar>> compare;
+  SearchKnn<pico_tree::SpaceTraits<Space<PointX>>>(
+      q, random, k, forest.metric(), &compare);
+
+  ASSERT_EQ(compare.size(), knn.size());
+  for (std::size_t i = 0; i < knn.size(); ++i) {
+    EXPECT_NEAR(knn[i].distance, compare[i].distance, 1e-2f);
+    // Points contained by multiple trees are reported only once.
+    for (std::size_t j = 0; j < i; ++j) {
+      EXPECT_NE(knn[i].index, knn[j].index);
+    }
+  }
+}
+
+TEST(KdForestTest, QueryRadiusExhaustive) {
+  using PointX = Point3f;
+  using Index = int;
+  using Scalar = typename PointX::ScalarType;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  KdForest<PointX> forest(random, 8, 4);
+
+  PointX q = random[random.size() / 2];
+  Scalar const radius = forest.metric()(Scalar(5.0));
+  std::vector<pico_tree::Neighbor<Index, Scalar>> n;
+  forest.SearchRadius(q, radius, random.size(), n, true);
+
+  std::vector<Index> indices;
+  for (auto const& r : n) {
+    EXPECT_LE(r.distance, radius);
+    indices.push_back(r.index);
+  }
+  std::sort(indices.begin(), indices.end());
+  EXPECT_EQ(
+      std::adjacent_find(indices.begin(), indices.end()), indices.end());
+
+  std::size_t count = 0;
+  for (auto const& p : random) {
+    // Points very close to the radius may end up on either side of it in the
+    // rotated spaces.
+    if (forest.metric()(q.data(), q.data() + q.size(), p.data()) < radius) {
+      count++;
+    }
+  }
+
+  EXPECT_NEAR(
+      static_cast<double>(count), static_cast<double>(n.size()), 1.0);
+}
+
+TEST(KdForestTest, QueryKnnRandomTopVariance) {
+  using PointX = Point3f;
+  using Index = int;
+  using Scalar = typename PointX::ScalarType;
+  using Forest = pico_tree::KdForest<
+      Space<PointX>,
+      pico_tree::L2Squared,
+      pico_tree::SplittingRule::kRandomTopVariance>;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  Forest forest(random, 8, 4);
+
+  std::vector<PointX> queries = GenerateRandomN<PointX>(64, 100.0f);
+  pico_tree::Size const k = 10;
+
+  for (auto const& q : queries) {
+    std::vector<pico_tree::Neighbor<Index, Scalar>> knn;
+    forest.SearchKnn(q, k, random.size(), knn);
+
+    std::vector<pico_tree::Neighbor<Index, Scalar>> compare;
+    SearchKnn<pico_tree::SpaceTraits<Space<PointX>>>(
+        q, random, k, forest.metric(), &compare);
+
+    // The trees share the original space. Distances are exact.
+    ASSERT_EQ(compare.size(), knn.size());
+    for (std::size_t i = 0; i < knn.size(); ++i) {
+      FloatEq(knn[i].distance, compare[i].distance);
+    }
+  }
+}
+
+TEST(KdForestTest, QueryKnnLargeK) {
+  using PointX = Point3f;
+  using Index = int;
+  using Scalar = typename PointX::ScalarType;
+  using Forest = pico_tree::KdForest<
+      Space<PointX>,
+      pico_tree::L2Squared,
+      pico_tree::SplittingRule::kRandomTopVariance>;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  Forest forest(random, 8, 4);
+
+  PointX q = random[random.size() / 2];
+  // Large values of k use a bounded max-heap instead of an insertion sort.
+  pico_tree::Size const k = 128;
+  std::vector<pico_tree::Neighbor<Index, Scalar>> knn;
+  forest.SearchKnn(q, k, random.size(), knn);
+
+  std::vector<pico_tree::Neighbor<Index, Scalar>> compare;
+  SearchKnn<pico_tree::SpaceTraits<Space<PointX>>>(
+      q, random, k, forest.metric(), &compare);
+
+  ASSERT_EQ(compare.size(), knn.size());
+  for (std::size_t i = 0; i < knn.size(); ++i) {
+    FloatEq(knn[i].distance, compare[i].distance);
+  }
+
+  // Fewer than k neighbors are found when visiting a single leaf. These are
+  // still sorted.
+  forest.SearchKnn(q, k, 1, knn);
+  EXPECT_LT(knn.size(), k);
+  EXPECT_TRUE(std::is_sorted(knn.begin(), knn.end()));
+}
+
+TEST(KdForestTest, QueryDone) {
+  using PointX = Point3f;
+  using Forest = KdForest<PointX>;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  Forest forest(random, 8, 4);
+  PointX q = random[random.size() / 2];
+  pico_tree::Size const max_leaves_visited = random.size();
+
+  TestDone<typename Forest::IndexType>(
+      forest.metric()(15.0f), [&forest, &q, max_leaves_visited](auto& v) {
+        forest.SearchNearest(q, max_leaves_visited, v);
+      });
+}
+
+TEST(KdForestTest, QueryKnnSearchContext) {
+  using PointX = Point3f;
+  using Forest = KdForest<PointX>;
+  using Neighbor = typename Forest::NeighborType;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  Forest forest(random, 8, 4);
+
+  std::vector<PointX> queries = GenerateRandomN<PointX>(32, 100.0f);
+  pico_tree::Size const k = 8;
+  // Visiting all leaves makes sure that k neighbors are found.
+  pico_tree::Size const max_leaves_visited = random.size();
+
+  // A single context is reused by all queries. The results equal those of
+  // the search that uses the context of the current thread.
+  typename Forest::SearchContextType context;
+
+  for (auto const& q : queries) {
+    std::vector<Neighbor> knn(k);
+    pico_tree::internal::SearchKnn<typename std::vector<Neighbor>::iterator> v(
+        knn.begin(), knn.end());
+    forest.SearchNearest(q, max_leaves_visited, v, context);
+
+    std::vector<Neighbor> compare;
+    forest.SearchKnn(q, k, max_leaves_visited, compare);
+
+    ASSERT_EQ(compare.size(), knn.size());
+    for (std::size_t i = 0; i < knn.size(); ++i) {
+      EXPECT_EQ(knn[i].index, compare[i].index);
+      FloatEq(knn[i].distance, compare[i].distance);
+    }
+
+    forest.SearchKnn(q, k, max_leaves_visited, knn, context);
+    ASSERT_EQ(compare.size(), knn.size());
+    for (std::size_t i = 0; i < knn.size(); ++i) {
+      EXPECT_EQ(knn[i].index, compare[i].index);
+    }
+
+    Neighbor nn;
+    forest.SearchNn(q, max_leaves_visited, nn, context);
+    EXPECT_EQ(nn.index, compare[0].index);
+
+    std::vector<Neighbor> n;
+    forest.SearchRadius(
+        q, compare.back().distance, max_leaves_visited, n, true, context);
+    std::vector<Neighbor> compare_n;
+    forest.SearchRadius(
+        q, compare.back().distance, max_leaves_visited, compare_n, true);
+    ASSERT_EQ(compare_n.size(), n.size());
+    for (std::size_t i = 0; i < n.size(); ++i) {
+      EXPECT_EQ(n[i].index, compare_n[i].index);
+    }
+  }
+}
+
+TEST(KdForestTest, Tune) {
+  using PointX = Point3f;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 4, 100.0f);
+  std::vector<PointX> queries = GenerateRandomN<PointX>(32, 100.0f);
+
+  pico_tree::KdForestTuningGrid grid;
+  grid.forest_sizes = {1, 2};
+  grid.max_leaf_sizes = {8};
+  grid.max_leaves_visited = {1, random.size()};
+
+  // The trees of the forest share the original space such that distances are
+  // exact and the recall of an exhaustive search is exactly 1.
+  auto tuning = pico_tree::TuneKdForest<
+      pico_tree::L2Squared,
+      pico_tree::SplittingRule::kRandomTopVariance>(
+      random,
+      queries,
+      10,
+      1.0,
+      grid,
+      pico_tree::KdForestObjective::kMemory);
+
+  ASSERT_EQ(tuning.measurements.size(), 4);
+  ASSERT_FALSE(tuning.pareto_front.empty());
+
+  // Visiting all leaves results in an exhaustive search.
+  ASSERT_TRUE(tuning.best.has_value());
+  EXPECT_EQ(tuning.best->recall, 1.0);
+  // A single tree uses the least memory.
+  EXPECT_EQ(tuning.best->parameters.forest_size, 1);
+  EXPECT_EQ(tuning.best->parameters.max_leaves_visited, random.size());
+
+  for (std::size_t i = 1; i < tuning.pareto_front.size(); ++i) {
+    EXPECT_LE(
+        tuning.pareto_front[i - 1].memory, tuning.pareto_front[i].memory);
+    EXPECT_LT(
+        tuning.pareto_front[i - 1].recall, tuning.pareto_front[i].recall);
+  }
+}
+
+TEST(KdForestTest, SaveLoad) {
+  using PointX = Point3f;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 4, 100.0f);
+
+  {
+    KdForest<PointX> forest(random, 8, 4);
+    CheckSaveLoad(random, forest, true);
+    // The rotated spaces are recomputed during loading.
+    CheckSaveLoad(random, forest, false);
+  }
+
+  {
+    pico_tree::KdForest<
+        Space<PointX>,
+        pico_tree::L2Squared,
+        pico_tree::SplittingRule::kRandomTopVariance>
+        forest(random, 8, 4);
+    CheckSaveLoad(random, forest, true);
+  }
+}
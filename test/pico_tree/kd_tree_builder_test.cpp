@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#include <numeric>
+#include <random>
+
 #include <pico_toolshed/point.hpp>
 #include <pico_tree/internal/kd_tree_builder.hpp>
 #include <pico_tree/internal/space_wrapper.hpp>
@@ -195,3 +198,71 @@ TEST(KdTreeTest, SplitterSlidingMidpoint) {
   EXPECT_EQ(split_dim, 0);
   EXPECT_EQ(split_val, ptsx4[3][0]);
 }
+
+TEST(KdTreeTest, SplitterRandomTopVariance) {
+  using PointX = Point2f;
+  using Index = int;
+  using Scalar = typename PointX::ScalarType;
+  using SpaceX = Space<PointX>;
+  using SplitterX = pico_tree::internal::SplitterRandomTopVariance<
+      pico_tree::internal::SpaceWrapper<SpaceX>>;
+
+  std::vector<PointX> ptsx4{
+      {1.0f, 4.0f}, {2.0f, 2.0f}, {4.0f, 3.0f}, {3.0f, 1.0f}};
+  SpaceX spcx4(ptsx4);
+  pico_tree::internal::SpaceWrapper<SpaceX> spcx4_wrapper(spcx4);
+  std::vector<Index> idx4{0, 1, 2, 3};
+
+  // The box is ignored by this splitter.
+  pico_tree::internal::Box<Scalar, 2> box(2);
+  std::vector<Index>::iterator split;
+  pico_tree::Size split_dim;
+  Scalar split_val;
+
+  SplitterX splitter4(spcx4_wrapper);
+  splitter4(0, idx4.begin(), idx4.end(), box, split, split_dim, split_val);
+
+  // Both dimensions have the same variance and mean.
+  EXPECT_EQ(split - idx4.begin(), 2);
+  EXPECT_EQ(split_val, 2.5f);
+  for (auto it = idx4.begin(); it < split; ++it) {
+    EXPECT_LT(ptsx4[*it][split_dim], split_val);
+  }
+  for (auto it = split; it < idx4.end(); ++it) {
+    EXPECT_GE(ptsx4[*it][split_dim], split_val);
+  }
+
+  // All points are the same. A single point slides to the left.
+  std::vector<PointX> ptsx3{{1.0f, 1.0f}, {1.0f, 1.0f}, {1.0f, 1.0f}};
+  SpaceX spcx3(ptsx3);
+  pico_tree::internal::SpaceWrapper<SpaceX> spcx3_wrapper(spcx3);
+  std::vector<Index> idx3{0, 1, 2};
+
+  SplitterX splitter3(spcx3_wrapper);
+  splitter3(0, idx3.begin(), idx3.end(), box, split, split_dim, split_val);
+
+  EXPECT_EQ(split - idx3.begin(), 1);
+  EXPECT_EQ(split_val, 1.0f);
+
+  // The points are sorted along the first dimension. The mean of a sample
+  // that equals the first points of the range would be about 50.
+  std::vector<PointX> ptsxn;
+  for (int i = 0; i < 1000; ++i) {
+    ptsxn.push_back({static_cast<Scalar>(i), static_cast<Scalar>(i % 2)});
+  }
+  SpaceX spcxn(ptsxn);
+  pico_tree::internal::SpaceWrapper<SpaceX> spcxn_wrapper(spcxn);
+
+  for (std::mt19937::result_type seed = 0; seed < 8; ++seed) {
+    std::vector<Index> idxn(ptsxn.size());
+    std::iota(idxn.begin(), idxn.end(), 0);
+
+    SplitterX splittern(spcxn_wrapper, seed);
+    splittern(0, idxn.begin(), idxn.end(), box, split, split_dim, split_val);
+
+    if (split_dim == 0) {
+      EXPECT_GT(split_val, 250.0f);
+      EXPECT_LT(split_val, 750.0f);
+    }
+  }
+}
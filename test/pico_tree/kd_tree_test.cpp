@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <bitset>
+#include <cstdint>
 #include <filesystem>
 #include <pico_toolshed/dynamic_space.hpp>
 #include <pico_toolshed/point.hpp>
@@ -57,6 +59,194 @@ void QueryKnn(
   TestKnn(tree1, static_cast<typename KdTree<PointX>::IndexType>(k));
 }
 
+//! \brief Compares the results of exact knn and radius searches for each query
+//! against those of a brute force search.
+//! \details Unlike TestKnn and TestRadius, this doesn't test the approximate
+//! searches. These require that the metric scales distances up when applied to
+//! a ratio larger than 1, which is not the case for all metrics.
+template <typename Tree, typename PointX>
+void TestExact(
+    Tree const& tree,
+    std::vector<PointX> const& queries,
+    pico_tree::Size const k,
+    typename Tree::ScalarType const radius) {
+  using Scalar = typename Tree::ScalarType;
+  using Neighbor = typename Tree::NeighborType;
+  using Traits = pico_tree::SpaceTraits<typename Tree::SpaceType>;
+
+  auto const& metric = tree.metric();
+  pico_tree::internal::SpaceWrapper<typename Tree::SpaceType> points(
+      tree.points());
+
+  for (auto const& q : queries) {
+    std::vector<Neighbor> knn;
+    tree.SearchKnn(q, k, knn);
+
+    std::vector<Neighbor> compare;
+    SearchKnn<Traits>(q, tree.points(), k, metric, &compare);
+
+    ASSERT_EQ(compare.size(), knn.size());
+    for (std::size_t i = 0; i < compare.size(); ++i) {
+      FloatEq(knn[i].distance, compare[i].distance);
+    }
+
+    Scalar const metric_radius = metric(radius);
+    std::vector<Neighbor> n;
+    tree.SearchRadius(q, metric_radius, n);
+
+    // The tree and the brute force search may sum the coordinates of a
+    // distance in a different order. Points that lie within rounding error of
+    // the radius may therefore be reported by only one of the two.
+    Scalar const tolerance = metric_radius * Scalar(1e-5);
+    std::size_t count_min = 0;
+    std::size_t count_max = 0;
+    for (pico_tree::Size j = 0; j < points.size(); ++j) {
+      Scalar const d = metric(q.data(), q.data() + q.size(), points[j]);
+      if (d <= metric_radius - tolerance) {
+        count_min++;
+      }
+      if (d <= metric_radius + tolerance) {
+        count_max++;
+      }
+    }
+
+    EXPECT_LE(count_min, n.size());
+    EXPECT_GE(count_max, n.size());
+  }
+}
+
+//! \brief Generates \p n random poses. Each pose is a translation within
+//! [0, size]^3 followed by a unit quaternion.
+template <typename PointX>
+std::vector<PointX> GenerateRandomPoses(
+    std::size_t n, typename PointX::ScalarType size) {
+  using Scalar = typename PointX::ScalarType;
+
+  std::vector<PointX> poses = GenerateRandomN<PointX>(n, Scalar(-1.0), 1.0);
+  for (auto& p : poses) {
+    Scalar norm = Scalar(0.0);
+    for (std::size_t i = 3; i < 7; ++i) {
+      norm += p[i] * p[i];
+    }
+    norm = std::sqrt(norm);
+    for (std::size_t i = 0; i < 3; ++i) {
+      p[i] = (p[i] + Scalar(1.0)) * size / Scalar(2.0);
+    }
+    for (std::size_t i = 3; i < 7; ++i) {
+      p[i] /= norm;
+    }
+  }
+  return poses;
+}
+
+//! \brief Compares the results of a tree of which the spatial dimension is
+//! only known at run time against those of a brute force search.
+template <typename PointX>
+void QueryDynamicDim(typename PointX::ScalarType const radius) {
+  using DSpace = DynamicSpace<Space<PointX>>;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  std::vector<PointX> queries = GenerateRandomN<PointX>(32, 100.0f);
+  DSpace drandom(random);
+  pico_tree::KdTree<DSpace> tree(drandom, 8);
+
+  TestExact(tree, queries, 8, radius);
+}
+
+//! \brief Compares the neighbors that are counted and stored in a
+//! preallocated array against those of a regular radius search.
+template <typename Tree, typename PointX>
+void TestRadiusCount(
+    Tree const& tree,
+    std::vector<PointX> const& queries,
+    typename Tree::ScalarType const radius) {
+  using Neighbor = typename Tree::NeighborType;
+
+  auto by_index = [](Neighbor const& a, Neighbor const& b) {
+    return a.index < b.index;
+  };
+
+  typename Tree::ScalarType const metric_radius = tree.metric()(radius);
+  std::vector<std::size_t> offsets(queries.size() + 1, 0);
+  for (std::size_t i = 0; i < queries.size(); ++i) {
+    offsets[i + 1] =
+        offsets[i] + tree.SearchRadiusCount(queries[i], metric_radius);
+  }
+
+  std::vector<Neighbor> n(offsets.back());
+  for (std::size_t i = 0; i < queries.size(); ++i) {
+    tree.SearchRadius(
+        queries[i],
+        metric_radius,
+        n.begin() + static_cast<std::ptrdiff_t>(offsets[i]),
+        n.begin() + static_cast<std::ptrdiff_t>(offsets[i + 1]));
+  }
+
+  for (std::size_t i = 0; i < queries.size(); ++i) {
+    std::vector<Neighbor> compare;
+    tree.SearchRadius(queries[i], metric_radius, compare);
+    std::sort(compare.begin(), compare.end(), by_index);
+
+    auto begin = n.begin() + static_cast<std::ptrdiff_t>(offsets[i]);
+    auto end = n.begin() + static_cast<std::ptrdiff_t>(offsets[i + 1]);
+    std::sort(begin, end, by_index);
+
+    ASSERT_EQ(compare.size(), offsets[i + 1] - offsets[i]);
+    for (std::size_t j = 0; j < compare.size(); ++j, ++begin) {
+      EXPECT_EQ(compare[j].index, begin->index);
+      FloatEq(compare[j].distance, begin->distance);
+    }
+  }
+}
+
+//! \brief Compares the results of filtered searches against those of a brute
+//! force search over the points for which \p accept holds true.
+template <typename Tree, typename PointX, typename Search, typename Accept>
+void TestFiltered(
+    Tree const& tree,
+    std::vector<PointX> const& queries,
+    pico_tree::Size const k,
+    Search search,
+    Accept accept) {
+  using Neighbor = typename Tree::NeighborType;
+
+  pico_tree::internal::SpaceWrapper<typename Tree::SpaceType> points(
+      tree.points());
+
+  for (auto const& q : queries) {
+    std::vector<Neighbor> compare;
+    for (pico_tree::Size i = 0; i < points.size(); ++i) {
+      auto const idx = static_cast<typename Tree::IndexType>(i);
+      if (accept(idx)) {
+        compare.push_back(
+            {idx, tree.metric()(q.data(), q.data() + q.size(), points[i])});
+      }
+    }
+    std::sort(compare.begin(), compare.end());
+    compare.resize(std::min(k, compare.size()));
+
+    std::vector<Neighbor> knn;
+    search(q, k, knn);
+
+    ASSERT_EQ(compare.size(), knn.size());
+    for (std::size_t i = 0; i < compare.size(); ++i) {
+      EXPECT_TRUE(accept(knn[i].index));
+      FloatEq(knn[i].distance, compare[i].distance);
+    }
+  }
+}
+
+//! \brief Expects the neighbors of \p n to equal those of \p compare.
+template <typename Neighbor>
+void ExpectSame(
+    std::vector<Neighbor> const& compare, std::vector<Neighbor> const& n) {
+  ASSERT_EQ(compare.size(), n.size());
+  for (std::size_t i = 0; i < n.size(); ++i) {
+    EXPECT_EQ(compare[i].index, n[i].index);
+    EXPECT_EQ(compare[i].distance, n[i].distance);
+  }
+}
+
 }  // namespace
 
 TEST(KdTreeTest, QueryRangeSubset2d) {
@@ -75,6 +265,432 @@ TEST(KdTreeTest, QueryKnn1) { QueryKnn<Point2f>(1024 * 1024, 100.0f, 1); }
 
 TEST(KdTreeTest, QueryKnn10) { QueryKnn<Point2f>(1024 * 1024, 100.0f, 10); }
 
+// Large values of k use a bounded max-heap instead of an insertion sort.
+TEST(KdTreeTest, QueryKnn256) { QueryKnn<Point2f>(1024 * 1024, 100.0f, 256); }
+
+TEST(KdTreeTest, QueryDynamicDimKnnRadius) {
+  // Dimensions 2 to 16 are searched using a compile time dimension. Other
+  // dimensions use the generic search.
+  QueryDynamicDim<Point2f>(10.0f);
+  QueryDynamicDim<Point<float, 16>>(150.0f);
+  QueryDynamicDim<Point<float, 17>>(150.0f);
+}
+
+TEST(KdTreeTest, QueryRadiusCount) {
+  std::vector<Point2f> random = GenerateRandomN<Point2f>(1024 * 64, 100.0f);
+  std::vector<Point2f> queries = GenerateRandomN<Point2f>(32, 100.0f);
+  KdTree<Point2f> tree(random, 8);
+
+  // A large radius contains entire nodes that are counted at once.
+  TestRadiusCount(tree, queries, 2.5f);
+  TestRadiusCount(tree, queries, 25.0f);
+
+  using PointX = Point<float, 4>;
+  using DSpace = DynamicSpace<Space<PointX>>;
+
+  std::vector<PointX> drandom = GenerateRandomN<PointX>(1024 * 16, 100.0f);
+  std::vector<PointX> dqueries = GenerateRandomN<PointX>(32, 100.0f);
+  DSpace dspace(drandom);
+  pico_tree::KdTree<DSpace, pico_tree::L1> dtree(dspace, 8);
+
+  TestRadiusCount(dtree, dqueries, 50.0f);
+}
+
+TEST(KdTreeTest, QueryRadiusCsr) {
+  using Tree = KdTree<Point2f>;
+  using NeighborType = typename Tree::NeighborType;
+
+  std::vector<Point2f> random = GenerateRandomN<Point2f>(1024 * 64, 100.0f);
+  std::vector<Point2f> queries = GenerateRandomN<Point2f>(32, 100.0f);
+  Tree tree(random, 8);
+  float const radius = tree.metric()(2.5f);
+
+  std::vector<pico_tree::Size> offsets;
+  std::vector<NeighborType> neighbors;
+  tree.SearchRadiusCsr(queries, radius, offsets, neighbors, true);
+
+  ASSERT_EQ(offsets.size(), queries.size() + 1);
+  EXPECT_EQ(offsets.front(), 0);
+  EXPECT_EQ(offsets.back(), neighbors.size());
+
+  std::vector<NeighborType> n;
+  for (std::size_t i = 0; i < queries.size(); ++i) {
+    tree.SearchRadius(queries[i], radius, n, true);
+    ASSERT_EQ(offsets[i + 1] - offsets[i], n.size());
+    for (std::size_t j = 0; j < n.size(); ++j) {
+      EXPECT_EQ(neighbors[offsets[i] + j].index, n[j].index);
+      EXPECT_EQ(neighbors[offsets[i] + j].distance, n[j].distance);
+    }
+  }
+
+  // An empty query set results in a single offset.
+  tree.SearchRadiusCsr(
+      std::vector<Point2f>(), radius, offsets, neighbors, true);
+  EXPECT_EQ(offsets.size(), 1);
+  EXPECT_TRUE(neighbors.empty());
+}
+
+TEST(KdTreeTest, QueryDone) {
+  using Tree = KdTree<Point2f>;
+
+  std::vector<Point2f> random = GenerateRandomN<Point2f>(1024 * 64, 100.0f);
+  Tree tree(random, 8);
+  Point2f q = random[random.size() / 2];
+
+  TestDone<typename Tree::IndexType>(
+      tree.metric()(10.0f), [&tree, &q](auto& visitor) {
+        tree.SearchNearest(q, visitor);
+      });
+}
+
+TEST(KdTreeTest, QueryFiltered) {
+  using Tree = KdTree<Point2f>;
+  using Index = typename Tree::IndexType;
+  using Neighbor = typename Tree::NeighborType;
+
+  std::vector<Point2f> random = GenerateRandomN<Point2f>(1024 * 16, 100.0f);
+  std::vector<Point2f> queries = GenerateRandomN<Point2f>(32, 100.0f);
+  Tree tree(random, 8);
+
+  // Each point has one of 8 labels. Label 7 is rare and label 6 is unused.
+  std::vector<std::uint8_t> labels(random.size());
+  for (std::size_t i = 0; i < labels.size(); ++i) {
+    labels[i] = static_cast<std::uint8_t>(1 << (i % 6));
+  }
+  for (std::size_t i = 0; i < labels.size(); i += labels.size() / 3) {
+    labels[i] = static_cast<std::uint8_t>(1 << 7);
+  }
+  auto masks = tree.MakeMasks(labels);
+
+  for (std::uint8_t query_mask : {0x01, 0x06, 0x40, 0x80}) {
+    auto accept = [&labels, query_mask](Index idx) {
+      return (labels[static_cast<std::size_t>(idx)] & query_mask) != 0;
+    };
+
+    TestFiltered(
+        tree, queries, 8, [&](auto const& q, auto k, auto& knn) {
+          tree.SearchKnnIf(q, k, accept, knn);
+        },
+        accept);
+    TestFiltered(
+        tree, queries, 8, [&](auto const& q, auto k, auto& knn) {
+          tree.SearchKnnIf(q, k, masks, query_mask, knn);
+        },
+        accept);
+    TestFiltered(
+        tree, queries, 1, [&](auto const& q, auto, auto& knn) {
+          Neighbor nn;
+          tree.SearchNnIf(q, masks, query_mask, nn);
+          knn.clear();
+          if (nn.distance != std::numeric_limits<float>::max()) {
+            knn.push_back(nn);
+          }
+        },
+        accept);
+  }
+
+  // Bitsets are indexed by point index.
+  std::vector<bool> even(random.size());
+  for (std::size_t i = 0; i < even.size(); i += 2) {
+    even[i] = true;
+  }
+  TestFiltered(
+      tree, queries, 128, [&](auto const& q, auto k, auto& knn) {
+        tree.SearchKnnIf(q, k, even, knn);
+      },
+      [&even](Index idx) { return even[static_cast<std::size_t>(idx)]; });
+
+  // Run time dimensions are dispatched to the same filtered search.
+  using PointX = Point<float, 4>;
+  using DSpace = DynamicSpace<Space<PointX>>;
+
+  std::vector<PointX> drandom = GenerateRandomN<PointX>(1024 * 4, 100.0f);
+  std::vector<PointX> dqueries = GenerateRandomN<PointX>(8, 100.0f);
+  DSpace dspace(drandom);
+  pico_tree::KdTree<DSpace> dtree(dspace, 8);
+  std::vector<std::bitset<4>> dlabels(drandom.size());
+  for (std::size_t i = 0; i < dlabels.size(); ++i) {
+    dlabels[i].set(i % 4);
+  }
+  auto dmasks = dtree.MakeMasks(dlabels);
+  std::bitset<4> dquery_mask("0100");
+
+  TestFiltered(
+      dtree, dqueries, 8, [&](auto const& q, auto k, auto& knn) {
+        dtree.SearchKnnIf(q, k, dmasks, dquery_mask, knn);
+      },
+      [&dlabels, &dquery_mask](Index idx) {
+        return (dlabels[static_cast<std::size_t>(idx)] & dquery_mask).any();
+      });
+}
+
+TEST(KdTreeTest, QueryExcept) {
+  using Tree = KdTree<Point2f>;
+  using Index = typename Tree::IndexType;
+  using Neighbor = typename Tree::NeighborType;
+
+  // Each point has a duplicate, which a self query should still report.
+  std::vector<Point2f> random = GenerateRandomN<Point2f>(1024 * 4, 100.0f);
+  std::size_t const n = random.size();
+  random.insert(random.end(), random.begin(), random.end());
+  Tree tree(random, 8);
+
+  pico_tree::Size const k = 8;
+  float const radius = tree.metric()(5.0f);
+
+  for (std::size_t i = 0; i < n; i += 64) {
+    Index const idx = static_cast<Index>(i);
+    Point2f const& q = random[i];
+
+    std::vector<Neighbor> knn;
+    tree.SearchKnnExcept(q, k, idx, knn);
+    std::vector<Neighbor> compare;
+    tree.SearchKnn(q, k + 1, compare);
+
+    ASSERT_EQ(knn.size(), k);
+    EXPECT_EQ(knn[0].index, static_cast<Index>(i + n));
+    EXPECT_EQ(knn[0].distance, 0.0f);
+    for (std::size_t j = 0; j < k; ++j) {
+      EXPECT_NE(knn[j].index, idx);
+      // The query point and its duplicate are the first two neighbors.
+      FloatEq(knn[j].distance, compare[j + 1].distance);
+    }
+
+    // Excluding both copies of the query and its nearest other neighbor.
+    std::vector<Index> excluded{idx, static_cast<Index>(i + n), knn[1].index};
+    std::vector<Neighbor> knn_set;
+    tree.SearchKnnExcept(q, k, excluded, knn_set);
+
+    ASSERT_EQ(knn_set.size(), k);
+    for (std::size_t j = 0; j + 2 < k; ++j) {
+      EXPECT_EQ(
+          std::find(excluded.begin(), excluded.end(), knn_set[j].index),
+          excluded.end());
+      FloatEq(knn_set[j].distance, knn[j + 2].distance);
+    }
+
+    std::vector<Neighbor> n_radius;
+    tree.SearchRadiusExcept(q, radius, excluded, n_radius);
+    std::vector<Neighbor> compare_radius;
+    tree.SearchRadius(q, radius, compare_radius);
+    EXPECT_EQ(n_radius.size() + excluded.size(), compare_radius.size());
+  }
+}
+
+TEST(KdTreeTest, QueryKnnSelf) {
+  using Tree = KdTree<Point2f>;
+  using Index = typename Tree::IndexType;
+  using Neighbor = typename Tree::NeighborType;
+
+  std::vector<Point2f> random = GenerateRandomN<Point2f>(1024, 100.0f);
+  Tree tree(random, 8);
+
+  pico_tree::Size const k = 8;
+  std::vector<Neighbor> knns;
+  tree.SearchKnnSelf(k, knns);
+  ASSERT_EQ(knns.size(), random.size() * k);
+
+  for (std::size_t i = 0; i < random.size(); ++i) {
+    std::vector<Neighbor> knn;
+    tree.SearchKnnExcept(random[i], k, static_cast<Index>(i), knn);
+    ASSERT_EQ(knn.size(), k);
+    for (std::size_t j = 0; j < k; ++j) {
+      EXPECT_EQ(knns[i * k + j].index, knn[j].index);
+      FloatEq(knns[i * k + j].distance, knn[j].distance);
+    }
+  }
+
+  // With less than k + 1 points, all other points are neighbors.
+  std::vector<Point2f> few(random.begin(), random.begin() + 4);
+  Tree tree_few(few, 8);
+  tree_few.SearchKnnSelf(k, knns);
+  EXPECT_EQ(knns.size(), few.size() * (few.size() - 1));
+}
+
+TEST(KdTreeTest, QueryKnnWarm) {
+  using Tree = KdTree<Point2f>;
+  using Index = typename Tree::IndexType;
+  using Neighbor = typename Tree::NeighborType;
+
+  std::vector<Point2f> random = GenerateRandomN<Point2f>(1024 * 16, 100.0f);
+  std::vector<Point2f> queries = GenerateRandomN<Point2f>(32, 100.0f);
+  std::vector<Point2f> jitter = GenerateRandomN<Point2f>(32, -0.5f, 0.5f);
+  Tree tree(random, 8);
+  typename Tree::SearchContextType context;
+
+  // Large values of k use the bounded max-heap.
+  for (pico_tree::Size k : {8, 128}) {
+    for (std::size_t i = 0; i < queries.size(); ++i) {
+      std::vector<Neighbor> previous;
+      tree.SearchKnn(queries[i], k, previous);
+
+      std::vector<Index> candidates;
+      for (auto const& n : previous) {
+        candidates.push_back(n.index);
+      }
+
+      Point2f q = queries[i];
+      q[0] += jitter[i][0];
+      q[1] += jitter[i][1];
+
+      std::vector<Neighbor> knn;
+      tree.SearchKnnWarm(q, k, candidates, knn);
+      std::vector<Neighbor> compare;
+      tree.SearchKnn(q, k, compare);
+
+      ASSERT_EQ(compare.size(), knn.size());
+      for (std::size_t j = 0; j < compare.size(); ++j) {
+        FloatEq(knn[j].distance, compare[j].distance);
+      }
+
+      // Each neighbor is reported once, even when it is also a candidate.
+      std::sort(knn.begin(), knn.end(), [](auto const& a, auto const& b) {
+        return a.index < b.index;
+      });
+      EXPECT_EQ(
+          std::adjacent_find(
+              knn.begin(),
+              knn.end(),
+              [](auto const& a, auto const& b) { return a.index == b.index; }),
+          knn.end());
+
+      // Without candidates it equals a cold search.
+      tree.SearchKnnWarm(q, k, {}, knn);
+      ASSERT_EQ(compare.size(), knn.size());
+      for (std::size_t j = 0; j < compare.size(); ++j) {
+        FloatEq(knn[j].distance, compare[j].distance);
+      }
+
+      // Duplicate candidates are ignored. The context is reused by all
+      // queries.
+      std::vector<Index> duplicates = candidates;
+      duplicates.insert(duplicates.end(), candidates.begin(), candidates.end());
+      tree.SearchKnnWarm(q, k, duplicates, knn, context);
+      ASSERT_EQ(compare.size(), knn.size());
+      for (std::size_t j = 0; j < compare.size(); ++j) {
+        FloatEq(knn[j].distance, compare[j].distance);
+      }
+    }
+  }
+}
+
+TEST(KdTreeTest, QuerySearchContext) {
+  using PointX = Point<float, 17>;
+  using DSpace = DynamicSpace<Space<PointX>>;
+  using Tree = pico_tree::KdTree<DSpace>;
+  using Index = typename Tree::IndexType;
+  using Neighbor = typename Tree::NeighborType;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 4, 100.0f);
+  std::vector<PointX> queries = GenerateRandomN<PointX>(32, 100.0f);
+  DSpace drandom(random);
+  Tree tree(drandom, 8);
+
+  // A single context is reused by all queries.
+  typename Tree::SearchContextType context;
+  pico_tree::Size const k = 8;
+
+  auto const even = [](Index i) { return i % 2 == 0; };
+  std::vector<std::uint32_t> labels(random.size());
+  for (std::size_t i = 0; i < labels.size(); ++i) {
+    labels[i] = std::uint32_t(1) << (i % 2);
+  }
+  auto const masks = tree.MakeMasks(labels);
+
+  for (auto const& q : queries) {
+    std::vector<Neighbor> knn(k);
+    pico_tree::internal::SearchKnn<typename std::vector<Neighbor>::iterator> v(
+        knn.begin(), knn.end());
+    tree.SearchNearest(q, v, context);
+
+    std::vector<Neighbor> compare;
+    SearchKnn<pico_tree::SpaceTraits<DSpace>>(
+        q, tree.points(), k, tree.metric(), &compare);
+
+    ASSERT_EQ(compare.size(), knn.size());
+    for (std::size_t i = 0; i < compare.size(); ++i) {
+      FloatEq(knn[i].distance, compare[i].distance);
+    }
+
+    // Each of the searches accepts a context.
+    tree.SearchKnn(q, k, knn, context);
+    ASSERT_EQ(compare.size(), knn.size());
+    for (std::size_t i = 0; i < compare.size(); ++i) {
+      FloatEq(knn[i].distance, compare[i].distance);
+    }
+
+    tree.SearchKnn(q, k, 1.0f, knn, context);
+    ASSERT_EQ(compare.size(), knn.size());
+    for (std::size_t i = 0; i < compare.size(); ++i) {
+      FloatEq(knn[i].distance, compare[i].distance);
+    }
+
+    Neighbor nn;
+    tree.SearchNn(q, nn, context);
+    FloatEq(nn.distance, compare[0].distance);
+    tree.SearchNn(q, 1.0f, nn, context);
+    FloatEq(nn.distance, compare[0].distance);
+
+    float const radius = compare.back().distance * 1.5f;
+    std::vector<Neighbor> n;
+    tree.SearchRadius(q, radius, n, true, context);
+    std::vector<Neighbor> compare_n;
+    tree.SearchRadius(q, radius, compare_n, true);
+    ASSERT_EQ(compare_n.size(), n.size());
+    for (std::size_t i = 0; i < n.size(); ++i) {
+      FloatEq(n[i].distance, compare_n[i].distance);
+    }
+
+    tree.SearchRadius(q, radius, 1.0f, n, false, context);
+    EXPECT_EQ(compare_n.size(), n.size());
+
+    auto const count = tree.SearchRadiusCount(q, radius, context);
+    EXPECT_EQ(compare_n.size(), count);
+    n.resize(count);
+    tree.SearchRadius(q, radius, n.begin(), n.end(), context);
+    std::sort(n.begin(), n.end());
+    for (std::size_t i = 0; i < n.size(); ++i) {
+      FloatEq(n[i].distance, compare_n[i].distance);
+    }
+
+    // Exclusion and filtered searches equal those without a context.
+    Index const excluded = compare[0].index;
+    std::vector<Index> const excluded_set{compare[0].index, compare[1].index};
+    tree.SearchKnnExcept(q, k, excluded, knn, context);
+    tree.SearchKnnExcept(q, k, excluded, compare);
+    ExpectSame(compare, knn);
+    tree.SearchKnnExcept(q, k, excluded_set, knn, context);
+    tree.SearchKnnExcept(q, k, excluded_set, compare);
+    ExpectSame(compare, knn);
+    tree.SearchRadiusExcept(q, radius, excluded, n, true, context);
+    tree.SearchRadiusExcept(q, radius, excluded, compare_n, true);
+    ExpectSame(compare_n, n);
+    tree.SearchRadiusExcept(q, radius, excluded_set, n, true, context);
+    tree.SearchRadiusExcept(q, radius, excluded_set, compare_n, true);
+    ExpectSame(compare_n, n);
+
+    Neighbor compare_nn;
+    tree.SearchNnIf(q, even, nn, context);
+    tree.SearchNnIf(q, even, compare_nn);
+    EXPECT_EQ(compare_nn.index, nn.index);
+    tree.SearchNnIf(q, masks, std::uint32_t(2), nn, context);
+    tree.SearchNnIf(q, masks, std::uint32_t(2), compare_nn);
+    EXPECT_EQ(compare_nn.index, nn.index);
+    tree.SearchKnnIf(q, k, even, knn, context);
+    tree.SearchKnnIf(q, k, even, compare);
+    ExpectSame(compare, knn);
+    tree.SearchKnnIf(q, k, masks, std::uint32_t(2), knn, context);
+    tree.SearchKnnIf(q, k, masks, std::uint32_t(2), compare);
+    ExpectSame(compare, knn);
+  }
+
+  std::vector<Neighbor> knns;
+  std::vector<Neighbor> compare_knns;
+  tree.SearchKnnSelf(k, knns, context);
+  tree.SearchKnnSelf(k, compare_knns);
+  ExpectSame(compare_knns, knns);
+}
+
 TEST(KdTreeTest, QuerySo2Knn4) {
   using PointX = Point1f;
   using SpaceX = Space<PointX>;
@@ -85,6 +701,152 @@ TEST(KdTreeTest, QuerySo2Knn4) {
   TestKnn(tree, static_cast<typename KdTree<PointX>::IndexType>(8), PointX{pi});
 }
 
+TEST(KdTreeTest, QueryWeightedKnnRadius3d) {
+  using PointX = Point3f;
+  using SpaceX = Space<PointX>;
+  using Metric = pico_tree::WeightedL2Squared<float, 3>;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(256 * 256, 10.0f);
+  pico_tree::KdTree<SpaceX, Metric> tree(
+      random, 10, Metric({1.0f, 100.0f, 0.01f}));
+
+  TestKnn(tree, static_cast<typename KdTree<PointX>::IndexType>(8));
+  TestRadius(tree, 2.5f);
+}
+
+TEST(KdTreeTest, QueryPeriodicKnnRadius3d) {
+  using PointX = Point3f;
+  using SpaceX = Space<PointX>;
+  using Scalar = typename PointX::ScalarType;
+  using Metric = pico_tree::PeriodicL2Squared<Scalar, 3>;
+
+  Metric metric({10.0f, 10.0f, 20.0f});
+  std::vector<PointX> random = GenerateRandomN<PointX>(256 * 256, 1.0f);
+  for (auto& p : random) {
+    for (std::size_t i = 0; i < PointX::Dim; ++i) {
+      p[i] *= metric.lengths()[i];
+    }
+  }
+  pico_tree::KdTree<SpaceX, Metric> tree(random, 10, metric);
+
+  // A query near a corner of the box has neighbors across each boundary.
+  PointX const corner{0.1f, 9.9f, 0.2f};
+  TestKnn(tree, static_cast<typename KdTree<PointX>::IndexType>(8), corner);
+  TestRadius(tree, 1.5f);
+
+  Scalar const radius = tree.metric()(Scalar(1.5));
+  std::vector<pico_tree::Neighbor<int, Scalar>> n;
+  tree.SearchRadius(corner, radius, n);
+
+  std::size_t count = 0;
+  for (auto const& p : random) {
+    if (metric(corner.data(), corner.data() + 3, p.data()) <= radius) {
+      count++;
+    }
+  }
+
+  EXPECT_EQ(count, n.size());
+}
+
+TEST(KdTreeTest, QueryHaversineKnnRadius) {
+  using PointX = Point2f;
+  using SpaceX = Space<PointX>;
+  using Scalar = typename PointX::ScalarType;
+
+  auto const pi = pico_tree::internal::kPi<Scalar>;
+  // Latitudes in [-PI/2, PI/2] and longitudes in [-PI, PI].
+  std::vector<PointX> random = GenerateRandomN<PointX>(256 * 256, -pi, pi);
+  for (auto& p : random) {
+    p[0] /= Scalar(2.0);
+  }
+  pico_tree::KdTree<SpaceX, pico_tree::Haversine> tree(random, 10);
+
+  std::vector<PointX> queries{
+      random[random.size() / 2],
+      // Near the identification of the longitude.
+      PointX{0.3f, pi - 0.001f},
+      // Near a pole.
+      PointX{pi / Scalar(2.0) - 0.001f, 0.0f}};
+
+  TestExact(tree, queries, 8, 0.1f);
+}
+
+TEST(KdTreeTest, QuerySo3Se3KnnRadius) {
+  using PointX = Point<float, 7>;
+  using SpaceX = Space<PointX>;
+  using Scalar = typename PointX::ScalarType;
+
+  std::vector<PointX> random = GenerateRandomPoses<PointX>(256 * 256, 10.0f);
+  std::vector<PointX> queries = GenerateRandomPoses<PointX>(16, 10.0f);
+  // Quaternions that are identified with those of the queries.
+  for (std::size_t i = 0; i < 8; ++i) {
+    for (std::size_t j = 3; j < 7; ++j) {
+      queries[i][j] = -queries[i][j];
+    }
+  }
+
+  pico_tree::KdTree<SpaceX, pico_tree::SE3Squared<Scalar>> se3(
+      random, 10, pico_tree::SE3Squared<Scalar>(4.0f));
+  TestExact(se3, queries, 8, 1.0f);
+
+  using Point4 = Point<float, 4>;
+  std::vector<Point4> rotations(random.size());
+  std::vector<Point4> rotation_queries(queries.size());
+  auto to_rotation = [](PointX const& p) {
+    return Point4{p[3], p[4], p[5], p[6]};
+  };
+  std::transform(random.begin(), random.end(), rotations.begin(), to_rotation);
+  std::transform(
+      queries.begin(), queries.end(), rotation_queries.begin(), to_rotation);
+
+  pico_tree::KdTree<Space<Point4>, pico_tree::SO3Squared> so3(rotations, 10);
+  TestExact(so3, rotation_queries, 8, 0.2f);
+}
+
+TEST(KdTreeTest, QueryProductMetricKnnRadius) {
+  using PointX = Point<float, 5>;
+  using SpaceX = Space<PointX>;
+  using Scalar = typename PointX::ScalarType;
+  // R3 x S1 x S1.
+  using Metric = pico_tree::ProductMetric<
+      Scalar,
+      pico_tree::MetricComponent<pico_tree::L2Squared, 3>,
+      pico_tree::MetricComponent<pico_tree::SO2Squared, 1>,
+      pico_tree::MetricComponent<pico_tree::SO2Squared, 1>>;
+
+  auto const pi = pico_tree::internal::kPi<Scalar>;
+  std::vector<PointX> random = GenerateRandomN<PointX>(256 * 256, -pi, pi);
+  std::vector<PointX> queries = GenerateRandomN<PointX>(16, -pi, pi);
+  // Near the identification of both angles.
+  queries[0][3] = pi - 0.001f;
+  queries[0][4] = -pi + 0.001f;
+
+  pico_tree::KdTree<SpaceX, Metric> tree(
+      random, 10, Metric({1.0f, 0.5f, 2.0f}));
+  TestExact(tree, queries, 8, 0.5f);
+
+  // R2 x S1 with weights below 1 for the Euclidean coordinates. The box
+  // distance of the weighted component should apply the same weights as its
+  // point distance.
+  using PointW = Point<float, 3>;
+  using WeightedMetric = pico_tree::ProductMetric<
+      Scalar,
+      pico_tree::MetricComponent<pico_tree::WeightedL2Squared<Scalar, 2>, 2>,
+      pico_tree::MetricComponent<pico_tree::SO2Squared, 1>>;
+
+  std::vector<PointW> wrandom = GenerateRandomN<PointW>(256 * 128, -pi, pi);
+  std::vector<PointW> wqueries = GenerateRandomN<PointW>(16, -pi, pi);
+
+  pico_tree::KdTree<Space<PointW>, WeightedMetric> wtree(
+      wrandom,
+      10,
+      WeightedMetric(
+          {1.0f, 1.0f},
+          pico_tree::WeightedL2Squared<Scalar, 2>({0.001f, 0.001f}),
+          pico_tree::SO2Squared()));
+  TestExact(wtree, wqueries, 8, 0.5f);
+}
+
 TEST(KdTreeTest, WriteRead) {
   using Index = int;
   using Scalar = typename Point2f::ScalarType;
@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+
+#include <pico_toolshed/point.hpp>
+#include <pico_tree/kd_tree.hpp>
+#include <pico_tree/vector_traits.hpp>
+#include <pico_understory/mahalanobis.hpp>
+
+#include "common.hpp"
+
+namespace {
+
+using PointX = Point2f;
+using Scalar = typename PointX::ScalarType;
+using Space = std::reference_wrapper<std::vector<PointX>>;
+using Neighbor = pico_tree::Neighbor<int, Scalar>;
+
+//! Squared Mahalanobis distance for the inverse covariance matrix of
+//! [[4, 2], [2, 3]], which is [[3, -2], [-2, 4]] / 8.
+Scalar SquaredMahalanobis(PointX const& a, PointX const& b) {
+  Scalar const x = a[0] - b[0];
+  Scalar const y = a[1] - b[1];
+  return (Scalar(3) * x * x - Scalar(4) * x * y + Scalar(4) * y * y) /
+         Scalar(8);
+}
+
+}  // namespace
+
+TEST(MahalanobisTest, CholeskyFactor) {
+  std::vector<double> a{4.0, 2.0, 2.0, 3.0};
+  std::vector<double> l = pico_tree::internal::CholeskyFactor(a, 2);
+
+  EXPECT_DOUBLE_EQ(l[0], 2.0);
+  EXPECT_DOUBLE_EQ(l[1], 0.0);
+  EXPECT_DOUBLE_EQ(l[2], 1.0);
+  EXPECT_DOUBLE_EQ(l[3], std::sqrt(2.0));
+
+  std::vector<double> not_positive_definite{1.0, 2.0, 2.0, 1.0};
+  EXPECT_THROW(
+      pico_tree::internal::CholeskyFactor(not_positive_definite, 2),
+      std::invalid_argument);
+}
+
+TEST(MahalanobisTest, EstimateCovariance) {
+  std::vector<PointX> points{{0.0f, 0.0f}, {2.0f, 1.0f}, {4.0f, 2.0f}};
+  std::vector<Scalar> covariance = pico_tree::EstimateCovariance(points);
+
+  ASSERT_EQ(covariance.size(), 4);
+  EXPECT_FLOAT_EQ(covariance[0], 4.0f);
+  EXPECT_FLOAT_EQ(covariance[1], 2.0f);
+  EXPECT_FLOAT_EQ(covariance[2], 2.0f);
+  EXPECT_FLOAT_EQ(covariance[3], 1.0f);
+}
+
+TEST(MahalanobisTest, KnnRadius) {
+  using Tree = pico_tree::
+      KdTree<pico_tree::MahalanobisSpaceType<Space>, pico_tree::L2Squared>;
+
+  std::vector<PointX> random = GenerateRandomN<PointX>(1024 * 4, 10.0f);
+  std::vector<PointX> queries = GenerateRandomN<PointX>(32, 10.0f);
+  pico_tree::MahalanobisSearch<Tree> search(
+      random, std::vector<Scalar>{4.0f, 2.0f, 2.0f, 3.0f}, 8);
+
+  std::size_t const k = 8;
+  Scalar const radius = 0.5f;
+  for (auto const& q : queries) {
+    std::vector<Scalar> d;
+    for (auto const& p : random) {
+      d.push_back(SquaredMahalanobis(q, p));
+    }
+    std::sort(d.begin(), d.end());
+
+    std::vector<Neighbor> knn;
+    search.SearchKnn(q, k, knn);
+
+    ASSERT_EQ(knn.size(), k);
+    for (std::size_t i = 0; i < k; ++i) {
+      EXPECT_NEAR(knn[i].distance, d[i], 1e-4f);
+      EXPECT_NEAR(
+          knn[i].distance,
+          SquaredMahalanobis(q, random[knn[i].index]),
+          1e-4f);
+    }
+
+    std::vector<Neighbor> n;
+    search.SearchRadius(q, radius, n);
+    for (auto const& r : n) {
+      EXPECT_NEAR(r.distance, SquaredMahalanobis(q, random[r.index]), 1e-4f);
+    }
+    // Distances near the radius may round to either side.
+    auto const count = std::count_if(
+        d.begin(), d.end(), [&](Scalar v) { return v <= radius; });
+    EXPECT_NEAR(static_cast<double>(n.size()), static_cast<double>(count), 1.0);
+  }
+}
@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
 
+#include <array>
+#include <cstdint>
+
 #include <pico_toolshed/point.hpp>
+#include <pico_tree/array_traits.hpp>
 #include <pico_tree/internal/point_wrapper.hpp>
 #include <pico_tree/metric.hpp>
 #include <pico_understory/metric.hpp>
@@ -45,6 +49,21 @@ TEST(MetricTest, L2Squared) {
   EXPECT_FLOAT_EQ(metric(-3.1f), 9.61f);
 }
 
+TEST(MetricTest, WeightedL2Squared) {
+  Point2f p0{2.0f, 4.0f};
+  Point2f p1{10.0f, 1.0f};
+
+  pico_tree::WeightedL2Squared<float, 2> metric({0.5f, 2.0f});
+
+  EXPECT_FLOAT_EQ(Distance(metric, p0, p1), 50.0f);
+  EXPECT_FLOAT_EQ(metric(-3.1f), 9.61f);
+  EXPECT_FLOAT_EQ(metric(1.0f, 2.0f, 3.0f, 0), 0.5f);
+  EXPECT_FLOAT_EQ(metric(1.0f, 2.0f, 3.0f, 1), 2.0f);
+  EXPECT_FLOAT_EQ(metric(2.5f, 2.0f, 3.0f, 1), 0.0f);
+  EXPECT_FLOAT_EQ(
+      pico_tree::internal::SplitDistance(metric, 4.0f, 1.0f, 1), 18.0f);
+}
+
 TEST(MetricTest, LInf) {
   Point2f p0{2.0f, 4.0f};
   Point2f p1{10.0f, 1.0f};
@@ -68,3 +87,120 @@ TEST(MetricTest, SO2) {
   EXPECT_FLOAT_EQ(metric(-0.4f, -0.3f, -0.2f, 0), std::abs(-0.4f - -0.3f));
   EXPECT_FLOAT_EQ(metric(-0.25f, -0.3f, -0.2f, 0), 0.0f);
 }
+
+TEST(MetricTest, ProductMetric) {
+  using Metric = pico_tree::ProductMetric<
+      float,
+      pico_tree::MetricComponent<pico_tree::L2Squared, 2>,
+      pico_tree::MetricComponent<pico_tree::SO2Squared, 1>>;
+
+  Point3f p0{1.0f, 2.0f, 3.0f};
+  Point3f p1{2.0f, 0.0f, -3.0f};
+
+  // Equivalent to SE2Squared.
+  Metric metric;
+  pico_tree::SE2Squared se2;
+
+  EXPECT_FLOAT_EQ(Distance(metric, p0, p1), Distance(se2, p0, p1));
+  EXPECT_FLOAT_EQ(metric(-3.1f), 9.61f);
+  for (int d = 0; d < 3; ++d) {
+    EXPECT_FLOAT_EQ(
+        metric(p0.data(), p0.data() + 3, -0.5f, 0.5f, d),
+        se2(p0[d], -0.5f, 0.5f, d));
+  }
+
+  Metric weighted({2.0f, 0.5f});
+
+  EXPECT_FLOAT_EQ(
+      Distance(weighted, p0, p1),
+      2.0f * 5.0f +
+          0.5f * pico_tree::internal::SquaredAngleDistance(3.0f, -3.0f));
+  EXPECT_FLOAT_EQ(weighted(p0.data(), p0.data() + 3, 3.0f, 4.0f, 1), 2.0f);
+  EXPECT_FLOAT_EQ(weighted(p0.data(), p0.data() + 3, 2.0f, 2.5f, 2), 0.125f);
+}
+
+TEST(MetricTest, SO3Squared) {
+  float const pi = pico_tree::internal::kPi<float>;
+  float const h = std::sqrt(0.5f);
+  // The identity and a rotation of PI / 2 around the z-axis.
+  Point<float, 4> p0{1.0f, 0.0f, 0.0f, 0.0f};
+  Point<float, 4> p1{h, 0.0f, 0.0f, h};
+  Point<float, 4> p2{-h, 0.0f, 0.0f, -h};
+
+  pico_tree::SO3Squared metric;
+
+  EXPECT_FLOAT_EQ(Distance(metric, p0, p1), metric(pi / 2.0f));
+  EXPECT_FLOAT_EQ(Distance(metric, p0, p2), metric(pi / 2.0f));
+  EXPECT_FLOAT_EQ(Distance(metric, p1, p2), 0.0f);
+  EXPECT_FLOAT_EQ(metric(pi), 2.0f);
+  EXPECT_FLOAT_EQ(metric(0.5f, 0.1f, 0.2f, 3), 0.09f);
+  EXPECT_FLOAT_EQ(metric(0.5f, -0.6f, -0.2f, 3), 0.0f);
+}
+
+TEST(MetricTest, SE3Squared) {
+  float const h = std::sqrt(0.5f);
+  Point<float, 7> p0{1.0f, 2.0f, 3.0f, 1.0f, 0.0f, 0.0f, 0.0f};
+  Point<float, 7> p1{2.0f, 2.0f, 1.0f, -h, 0.0f, 0.0f, -h};
+
+  pico_tree::SE3Squared<float> metric(2.0f);
+
+  EXPECT_FLOAT_EQ(Distance(metric, p0, p1), 5.0f + 2.0f * (2.0f - 2.0f * h));
+  EXPECT_FLOAT_EQ(metric(-3.1f), 9.61f);
+  EXPECT_FLOAT_EQ(metric(0.5f, 1.0f, 2.0f, 0), 0.25f);
+  EXPECT_FLOAT_EQ(metric(0.5f, -0.6f, -0.2f, 3), 0.0f);
+  EXPECT_FLOAT_EQ(metric(0.5f, 0.1f, 0.2f, 4), 0.18f);
+}
+
+TEST(MetricTest, Haversine) {
+  float const pi = pico_tree::internal::kPi<float>;
+  Point2f p0{0.0f, 0.0f};
+  Point2f p1{0.0f, pi / 2.0f};
+  Point2f p2{0.0f, -pi};
+  Point2f p3{0.0f, pi};
+
+  pico_tree::Haversine metric;
+
+  EXPECT_FLOAT_EQ(Distance(metric, p0, p1), 0.5f);
+  EXPECT_FLOAT_EQ(Distance(metric, p0, p2), 1.0f);
+  EXPECT_NEAR(Distance(metric, p2, p3), 0.0f, 1e-6f);
+  EXPECT_FLOAT_EQ(metric(pi / 2.0f), 0.5f);
+
+  // The latitude and longitude boxes contain the query.
+  EXPECT_FLOAT_EQ(metric(p1.data(), p1.data() + 2, -0.1f, 0.1f, 0), 0.0f);
+  EXPECT_FLOAT_EQ(metric(p1.data(), p1.data() + 2, 1.0f, 2.0f, 1), 0.0f);
+  // From the equator to the north pole, the latitude term bounds half of the
+  // haversine. The other half is bounded by the longitude term.
+  EXPECT_FLOAT_EQ(
+      metric(p0.data(), p0.data() + 2, pi / 2.0f, pi / 2.0f, 0), 0.25f);
+  // The distance to a meridian at a quarter circle.
+  EXPECT_FLOAT_EQ(metric(p0.data(), p0.data() + 2, pi / 2.0f, pi, 1), 0.25f);
+}
+
+TEST(MetricTest, PeriodicL2Squared) {
+  Point2f p0{0.5f, 1.0f};
+  Point2f p1{9.5f, 3.0f};
+
+  pico_tree::PeriodicL2Squared<float, 2> metric({10.0f, 20.0f});
+
+  EXPECT_FLOAT_EQ(Distance(metric, p0, p1), 5.0f);
+  EXPECT_FLOAT_EQ(metric(-3.1f), 9.61f);
+  EXPECT_FLOAT_EQ(metric(0.5f, 4.0f, 9.0f, 0), 2.25f);
+  EXPECT_FLOAT_EQ(metric(0.5f, 4.0f, 9.0f, 1), 12.25f);
+  EXPECT_FLOAT_EQ(metric(5.0f, 4.0f, 9.0f, 0), 0.0f);
+}
+
+TEST(MetricTest, Hamming) {
+  std::array<std::uint64_t, 2> p0{0x0ULL, 0xFFFFFFFFFFFFFFFFULL};
+  std::array<std::uint64_t, 2> p1{0xF0ULL, 0xFFFFFFFFFFFFFFFEULL};
+
+  pico_tree::Hamming metric;
+
+  EXPECT_EQ(Distance(metric, p0, p1), 5.0f);
+  EXPECT_EQ(Distance(metric, p0, p0), 0.0f);
+
+  // Words smaller than an int.
+  std::array<std::uint8_t, 2> b0{0x01, 0xFF};
+  std::array<std::uint8_t, 2> b1{0x80, 0x00};
+
+  EXPECT_EQ(Distance(metric, b0, b1), 10.0f);
+}
@@ -115,6 +115,21 @@ class KdTreeTest(unittest.TestCase):
         t.search_radius(a, radius, nns)
         self.assertEqual(addresses(nns), datas)
 
+    def test_search_radius_csr(self):
+        a = np.array([[2, 1], [4, 3], [8, 7]], dtype=np.float32)
+        t = pt.KdTree(a, pt.Metric.L2Squared, 10)
+
+        radius = t.metric(3.0)
+        offsets, nns = t.search_radius_csr(a, radius, sort=True)
+        self.assertEqual(nns.dtype, t.dtype_neighbor)
+        np.testing.assert_array_equal(offsets, [0, 2, 4, 5])
+
+        expected = [[0, 1], [1, 0], [2]]
+        for i in range(len(a)):
+            n = nns[offsets[i] : offsets[i + 1]]
+            self.assertEqual([x[0] for x in n], expected[i])
+            self.assertAlmostEqual(n[0][1], 0)
+
     def test_search_approximate_radius(self):
         a = np.array([[2, 1], [4, 3], [8, 7]], dtype=np.float32)
         t = pt.KdTree(a, pt.Metric.L2Squared, 10)